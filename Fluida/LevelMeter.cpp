@@ -0,0 +1,107 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include "LevelMeter.h"
+#include <cmath>
+
+namespace xsynth {
+
+#define LANES 16
+
+void block_level(const float *buf, int n, float& peak, float& energy) {
+    float p[LANES] = {0.0f};
+    float e[LANES] = {0.0f};
+    const int m = n & ~(LANES - 1);
+    for (int j = 0; j < m; j += LANES) {
+        for (int i = 0; i < LANES; i++) {
+            const float v = buf[j + i];
+            const float a = fabsf(v);
+            p[i] = a > p[i] ? a : p[i];
+            e[i] += v * v;
+        }
+    }
+    float pk = 0.0f;
+    float en = 0.0f;
+    for (int i = 0; i < LANES; i++) {
+        pk = p[i] > pk ? p[i] : pk;
+        en += e[i];
+    }
+    for (int i = m; i < n; i++) {
+        const float a = fabsf(buf[i]);
+        pk = a > pk ? a : pk;
+        en += buf[i] * buf[i];
+    }
+    peak = pk;
+    energy = en;
+}
+
+/****************************************************************
+ ** class LevelMeter
+ */
+
+LevelMeter::LevelMeter() {
+    clear();
+}
+
+LevelMeter::~LevelMeter() {
+}
+
+void LevelMeter::clear() {
+    for (int i = 0; i < METER_SLOTS; i++) {
+        peak[i] = 0.0f;
+        energy[i] = 0.0;
+        frames[i] = 0;
+    }
+}
+
+void LevelMeter::add(int slot, const float *buf, int n) {
+    float p, e;
+    block_level(buf, n, p, e);
+    if (p > peak[slot]) peak[slot] = p;
+    energy[slot] += e;
+    frames[slot] += n;
+}
+
+void LevelMeter::add(int slot, const float *l, const float *r, int n) {
+    float pl, el, pr, er;
+    block_level(l, n, pl, el);
+    block_level(r, n, pr, er);
+    const float p = pl > pr ? pl : pr;
+    if (p > peak[slot]) peak[slot] = p;
+    energy[slot] += 0.5 * ((double)el + er);
+    frames[slot] += n;
+}
+
+static inline float to_db(double v) {
+    // 3.1623e-4 is METER_FLOOR
+    return v > 3.1623e-4 ? 20.0f * (float)log10(v) : METER_FLOOR;
+}
+
+void LevelMeter::take(int slot, float& peak_db, float& rms_db) {
+    peak_db = to_db(peak[slot]);
+    rms_db = frames[slot] ? to_db(sqrt(energy[slot] / frames[slot])) : METER_FLOOR;
+    peak[slot] = 0.0f;
+    energy[slot] = 0.0;
+    frames[slot] = 0;
+}
+
+} // namespace xsynth
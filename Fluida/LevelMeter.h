@@ -0,0 +1,77 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <cstdint>
+#include <cstddef>
+
+#pragma once
+
+#ifndef LEVELMETER_H
+#define LEVELMETER_H
+
+// signals a meter could follow
+#define METER_SLOTS 16
+// dB shown for silence
+#define METER_FLOOR -70.0f
+
+
+namespace xsynth {
+
+
+/****************************************************************
+ ** block_level
+ **
+ ** peak and sum of squares of a buffer. The loop keep 16 lanes,
+ ** so that the compiler turn it into vector max and multiply-add
+ ** without reordering a single accumulator.
+ */
+
+void block_level(const float *buf, int n, float& peak, float& energy);
+
+/****************************************************************
+ ** class LevelMeter
+ **
+ ** peak and RMS of up to METER_SLOTS signals, collected block by
+ ** block on the audio thread. take() return the values since the
+ ** last call in dB, the caller set the rate the UI get them.
+ */
+
+class LevelMeter {
+private:
+    float peak[METER_SLOTS];
+    double energy[METER_SLOTS];
+    uint32_t frames[METER_SLOTS];
+
+public:
+    void add(int slot, const float *buf, int n);
+    // a stereo pair on one slot
+    void add(int slot, const float *l, const float *r, int n);
+    // peak and RMS in dB, the slot start over
+    void take(int slot, float& peak_db, float& rms_db);
+    void clear();
+
+    LevelMeter();
+    ~LevelMeter();
+};
+
+} // namespace xsynth
+
+#endif //LEVELMETER_H
@@ -0,0 +1,251 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "MasterBus.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace xsynth {
+
+// frames processed per pass, when the host don't tell
+#define BUS_BLOCK 256
+#define BUS_BLOCK_MAX 8192
+// taps per phase of the true-peak interpolator
+#define TP_TAPS 8
+#define TP_PHASES 4
+// the interpolator look TP_TAPS/2 samples ahead
+#define TP_DELAY (TP_TAPS / 2)
+// limiter lookahead in ms
+#define LOOKAHEAD_MS 1.5
+
+// windowed sinc for the phases between two samples
+static float tp_coef[TP_PHASES - 1][TP_TAPS];
+
+static void init_tp_coef() {
+    for (int p = 1; p < TP_PHASES; p++) {
+        double sum = 0.0;
+        for (int k = 0; k < TP_TAPS; k++) {
+            const double t = (double)(k - TP_DELAY + 1) - (double)p / TP_PHASES;
+            const double sinc = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+            const double w = 0.5 * (1.0 + cos(M_PI * t / (TP_TAPS / 2)));
+            tp_coef[p-1][k] = (float)(sinc * w);
+            sum += sinc * w;
+        }
+        for (int k = 0; k < TP_TAPS; k++) tp_coef[p-1][k] /= (float)sum;
+    }
+}
+
+/****************************************************************
+ ** class MasterBus
+ */
+
+MasterBus::MasterBus() {
+    sample_rate = 48000;
+    block_length = BUS_BLOCK;
+    active = 0;
+    quiet = 0;
+    lookahead = 1;
+    delay = 0;
+    mode = 0;
+    ceiling = -1.0;
+    release = 50.0;
+    dither_bits = 24;
+    init_tp_coef();
+}
+
+MasterBus::~MasterBus() {
+}
+
+void MasterBus::init(unsigned int rate, unsigned int max_block) {
+    sample_rate = rate;
+    block_length = max_block ? (int)std::min(max_block, (unsigned int)BUS_BLOCK_MAX) : BUS_BLOCK;
+    dc_coef = 1.0f - (float)(2.0 * M_PI * 10.0 / rate);
+    lookahead = std::max(1, (int)(LOOKAHEAD_MS * 0.001 * rate + 0.5));
+    delay = lookahead - 1 + TP_DELAY;
+    for (int c = 0; c < 2; c++) {
+        history[c].assign(TP_TAPS - 1 + block_length, 0.0f);
+        delay_line[c].assign(delay + block_length, 0.0f);
+    }
+    peak.assign(block_length, 0.0f);
+    tmp.assign(block_length, 0.0f);
+    gain.assign(block_length, 1.0f);
+    min_val.assign(lookahead, 1.0f);
+    min_pos.assign(lookahead, 0);
+    box.assign(lookahead, 1.0f);
+    seed = 0x2545F491;
+    reset();
+}
+
+void MasterBus::reset() {
+    frame = 0;
+    dc_x[0] = dc_x[1] = 0.0f;
+    dc_y[0] = dc_y[1] = 0.0f;
+    for (int c = 0; c < 2; c++) {
+        std::fill(history[c].begin(), history[c].end(), 0.0f);
+        std::fill(delay_line[c].begin(), delay_line[c].end(), 0.0f);
+    }
+    min_head = 0;
+    min_count = 0;
+    std::fill(box.begin(), box.end(), 1.0f);
+    box_idx = 0;
+    box_sum = (double)lookahead;
+    current_gain = 1.0f;
+    block_gain = 1.0f;
+}
+
+float MasterBus::gain_reduction() {
+    const float g = block_gain;
+    block_gain = current_gain;
+    return 20.0f * log10f(std::max(g, 1e-5f));
+}
+
+// silent input is skipped once the lookahead delay is drained, the
+// output stay digital silence then, without dither noise
+void MasterBus::process(int count, float *l, float *r, bool silent) {
+    if (!mode || peak.empty()) {
+        active = 0;
+        return;
+    }
+    if (!silent) {
+        quiet = 0;
+    } else if (quiet > delay) {
+        return;
+    } else if ((quiet += count) > delay) {
+        dc_x[0] = dc_x[1] = 0.0f;
+        dc_y[0] = dc_y[1] = 0.0f;
+    }
+    // the limiter state is stale when it was switched off in between
+    if ((mode & MASTER_LIMITER) && !(active & MASTER_LIMITER)) reset();
+    active = mode;
+    for (int pos = 0; pos < count; pos += block_length) {
+        const int n = std::min(count - pos, block_length);
+        if (mode & MASTER_DC_BLOCK) dc_block(n, l + pos, r + pos);
+        if (mode & MASTER_LIMITER) {
+            true_peak(n, l + pos, r + pos);
+            limit(n, l + pos, r + pos);
+        }
+        if (mode & MASTER_DITHER) dither(n, l + pos, r + pos);
+    }
+}
+
+// one pole high pass at 10Hz, both channels in one pass
+void MasterBus::dc_block(int n, float *l, float *r) {
+    float xl = dc_x[0], xr = dc_x[1];
+    float yl = dc_y[0], yr = dc_y[1];
+    for (int i = 0; i < n; i++) {
+        yl = l[i] - xl + dc_coef * yl;
+        yr = r[i] - xr + dc_coef * yr;
+        xl = l[i];
+        xr = r[i];
+        l[i] = yl;
+        r[i] = yr;
+    }
+    // flush denormals
+    dc_x[0] = xl; dc_x[1] = xr;
+    dc_y[0] = fabsf(yl) < 1e-20f ? 0.0f : yl;
+    dc_y[1] = fabsf(yr) < 1e-20f ? 0.0f : yr;
+}
+
+// stereo linked true peak of the frame TP_DELAY behind the input
+void MasterBus::true_peak(int n, const float *l, const float *r) {
+    float *pk = peak.data();
+    float *acc = tmp.data();
+    for (int i = 0; i < n; i++) pk[i] = 0.0f;
+    for (int c = 0; c < 2; c++) {
+        float *h = history[c].data();
+        memcpy(h + TP_TAPS - 1, c ? r : l, n * sizeof(float));
+        for (int i = 0; i < n; i++) pk[i] = std::max(pk[i], fabsf(h[i + TP_DELAY - 1]));
+        for (int p = 0; p < TP_PHASES - 1; p++) {
+            for (int i = 0; i < n; i++) acc[i] = 0.0f;
+            for (int k = 0; k < TP_TAPS; k++) {
+                const float coef = tp_coef[p][k];
+                const float *x = h + k;
+                for (int i = 0; i < n; i++) acc[i] += coef * x[i];
+            }
+            for (int i = 0; i < n; i++) pk[i] = std::max(pk[i], fabsf(acc[i]));
+        }
+        memmove(h, h + n, (TP_TAPS - 1) * sizeof(float));
+    }
+}
+
+void MasterBus::limit(int n, float *l, float *r) {
+    const float ceil = powf(10.0f, (float)ceiling / 20.0f);
+    const float rel = expf(-1.0f / (std::max(1.0f, (float)release) * 0.001f * sample_rate));
+    float *pk = peak.data();
+    float *g = gain.data();
+    // the gain needed for each frame
+    for (int i = 0; i < n; i++) pk[i] = std::min(1.0f, ceil / std::max(pk[i], 1e-9f));
+
+    // the minimum over the lookahead window, smoothed by a box filter of
+    // the same length, so that the gain is down when the peak arrive
+    const int len = lookahead;
+    for (int i = 0; i < n; i++, frame++) {
+        while (min_count && min_val[(min_head + min_count - 1) % len] >= pk[i]) min_count--;
+        if (min_count == len) { min_head = (min_head + 1) % len; min_count--; }
+        const int back = (min_head + min_count) % len;
+        min_val[back] = pk[i];
+        min_pos[back] = frame;
+        min_count++;
+        while (frame - min_pos[min_head] >= (uint32_t)len) {
+            min_head = (min_head + 1) % len;
+            min_count--;
+        }
+        const float hold = min_val[min_head];
+        box_sum += hold - box[box_idx];
+        box[box_idx] = hold;
+        if (++box_idx == len) box_idx = 0;
+        const float target = (float)(box_sum / len);
+        if (target < current_gain) current_gain = target;
+        else current_gain = target + (current_gain - target) * rel;
+        g[i] = current_gain;
+        if (current_gain < block_gain) block_gain = current_gain;
+    }
+
+    // delay the audio by the lookahead and apply the gain
+    for (int c = 0; c < 2; c++) {
+        float *d = delay_line[c].data();
+        float *out = c ? r : l;
+        memcpy(d + delay, out, n * sizeof(float));
+        for (int i = 0; i < n; i++) out[i] = d[i] * g[i];
+        memmove(d, d + n, delay * sizeof(float));
+    }
+}
+
+// triangular PDF noise of +-1 LSB from a counter based hash
+void MasterBus::dither(int n, float *l, float *r) {
+    const float lsb = ldexpf(1.0f, -(std::max(8, std::min(24, dither_bits)) - 1)) / 65536.0f;
+    for (int c = 0; c < 2; c++) {
+        float *out = c ? r : l;
+        const uint32_t s = seed + (c ? 0x68E31DA4u : 0u);
+        for (int i = 0; i < n; i++) {
+            uint32_t h = (s + (uint32_t)i) * 0x9E3779B1u;
+            h ^= h >> 15;
+            h *= 0x85EBCA77u;
+            h ^= h >> 13;
+            const int t = (int)(h & 0xffff) + (int)(h >> 16) - 65535;
+            out[i] += (float)t * lsb;
+        }
+    }
+    seed += (uint32_t)n;
+}
+
+} // namespace xsynth
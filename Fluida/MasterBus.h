@@ -0,0 +1,108 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#pragma once
+
+#ifndef MASTERBUS_H
+#define MASTERBUS_H
+
+
+namespace xsynth {
+
+
+/****************************************************************
+ ** master bus stages, bitmask for MasterBus::mode
+ */
+
+enum {
+    MASTER_DC_BLOCK        = 1<<0,
+    MASTER_LIMITER         = 1<<1,
+    MASTER_DITHER          = 1<<2,
+};
+
+/****************************************************************
+ ** class MasterBus
+ **
+ ** optional output stage behind the synth: DC blocker, lookahead
+ ** true-peak limiter and TPDF dither. Work in fixed blocks on
+ ** buffers allocated in init(), so process() is RT safe.
+ */
+
+class MasterBus {
+private:
+    unsigned int sample_rate;
+    int block_length;
+    int active;
+    int quiet;
+    int lookahead;
+    int delay;
+    uint32_t frame;
+    uint32_t seed;
+    // DC blocker
+    float dc_coef;
+    float dc_x[2];
+    float dc_y[2];
+    // true-peak detection, 4x oversampled
+    std::vector<float> history[2];
+    std::vector<float> peak;
+    std::vector<float> tmp;
+    // limiter gain
+    std::vector<float> gain;
+    std::vector<float> min_val;
+    std::vector<uint32_t> min_pos;
+    int min_head;
+    int min_count;
+    std::vector<float> box;
+    int box_idx;
+    double box_sum;
+    float current_gain;
+    float block_gain;
+    // lookahead delay
+    std::vector<float> delay_line[2];
+
+    void reset();
+    void dc_block(int n, float *l, float *r);
+    void true_peak(int n, const float *l, const float *r);
+    void limit(int n, float *l, float *r);
+    void dither(int n, float *l, float *r);
+
+public:
+    int mode;
+    double ceiling;
+    double release;
+    int dither_bits;
+
+    void init(unsigned int rate, unsigned int max_block = 0);
+    void process(int count, float *l, float *r, bool silent = false);
+    int latency() const { return (mode & MASTER_LIMITER) ? delay : 0; }
+    // the lowest limiter gain since the last call, in dB
+    float gain_reduction();
+
+    MasterBus();
+    ~MasterBus();
+};
+
+} // namespace xsynth
+
+#endif //MASTERBUS_H
@@ -0,0 +1,302 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include "MidiFile.h"
+#include <cstring>
+#include <algorithm>
+
+namespace xsynth {
+
+// controllers which select a (N)RPN, chased before the data entry
+static const uint8_t param_select[4] = {99, 98, 101, 100};
+
+static inline uint32_t read_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+        ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint16_t read_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// variable length quantity, returns false when it run over the end
+static inline bool read_vlq(const uint8_t *&p, const uint8_t *end, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (p >= end) return false;
+        const uint8_t b = *p++;
+        value = (value << 7) | (b & 0x7f);
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+/****************************************************************
+ ** struct ChaseState
+ */
+
+void ChaseState::clear() {
+    memset(this, CHASE_UNSET, sizeof(ChaseState));
+}
+
+void ChaseState::apply(const MidiEvent& ev) {
+    const int ch = ev.msg[0] & 0x0f;
+    switch (ev.msg[0] & 0xf0) {
+    case 0xB0:
+        // channel mode messages are not state
+        if (ev.msg[1] < 120) cc[ch][ev.msg[1]] = ev.msg[2];
+        else if (ev.msg[1] == 121) {
+            // reset all controllers
+            memset(cc[ch], CHASE_UNSET, sizeof(cc[ch]));
+            bend[ch][0] = bend[ch][1] = CHASE_UNSET;
+        }
+        break;
+    case 0xC0:
+        program[ch] = ev.msg[1];
+        break;
+    case 0xE0:
+        bend[ch][0] = ev.msg[1];
+        bend[ch][1] = ev.msg[2];
+        break;
+    default:
+        break;
+    }
+}
+
+/****************************************************************
+ ** class MidiFile
+ */
+
+MidiFile::MidiFile() : ppq(480) {
+}
+
+MidiFile::~MidiFile() {
+}
+
+void MidiFile::clear() {
+    events.clear();
+    checkpoints.clear();
+    ppq = 480;
+}
+
+bool MidiFile::read_track(const uint8_t *data, size_t size) {
+    const uint8_t *p = data;
+    const uint8_t *end = data + size;
+    uint32_t tick = 0;
+    uint8_t status = 0;
+    while (p < end) {
+        uint32_t delta;
+        if (!read_vlq(p, end, delta)) return false;
+        tick += delta;
+        if (p >= end) return false;
+        if (*p == 0xFF) {
+            // meta event
+            if (end - p < 2) return false;
+            const uint8_t type = p[1];
+            p += 2;
+            uint32_t len;
+            if (!read_vlq(p, end, len) || (size_t)(end - p) < len) return false;
+            p += len;
+            if (type == 0x2F) break;
+            continue;
+        } else if (*p == 0xF0 || *p == 0xF7) {
+            // sysex isn't played
+            p++;
+            uint32_t len;
+            if (!read_vlq(p, end, len) || (size_t)(end - p) < len) return false;
+            p += len;
+            status = 0;
+            continue;
+        }
+        if (*p & 0x80) status = *p++;
+        else if (!status) return false; // running status without a status
+        const uint8_t type = status & 0xf0;
+        const int n = (type == 0xC0 || type == 0xD0) ? 1 : 2;
+        if (end - p < n) return false;
+        MidiEvent ev;
+        ev.tick = tick;
+        ev.msg[0] = status;
+        ev.msg[1] = p[0] & 0x7f;
+        ev.msg[2] = n == 2 ? (p[1] & 0x7f) : 0;
+        ev.size = n + 1;
+        p += n;
+        events.push_back(ev);
+    }
+    return true;
+}
+
+bool MidiFile::load(const char *path) {
+    clear();
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(fp);
+
+    if (data.size() < 14 || memcmp(data.data(), "MThd", 4) != 0) return false;
+    const uint32_t hdr_size = read_be32(data.data() + 4);
+    const int format = read_be16(data.data() + 8);
+    const int division = read_be16(data.data() + 12);
+    // SMPTE time isn't supported, we follow the host tempo
+    if (format > 1 || (division & 0x8000) || !division || hdr_size < 6) return false;
+    ppq = division;
+
+    size_t pos = 8 + hdr_size;
+    while (pos + 8 <= data.size()) {
+        const uint32_t size = read_be32(data.data() + pos + 4);
+        if (size > data.size() - pos - 8) break;
+        if (memcmp(data.data() + pos, "MTrk", 4) == 0) {
+            if (!read_track(data.data() + pos + 8, size)) {
+                clear();
+                return false;
+            }
+        }
+        pos += 8 + size;
+    }
+    // tracks are merged in file order for events at the same tick
+    std::stable_sort(events.begin(), events.end(), [](const MidiEvent& a, const MidiEvent& b) {
+        return a.tick < b.tick;
+    });
+    std::vector<MidiEvent>(events).swap(events);
+
+    ChaseState state;
+    state.clear();
+    checkpoints.reserve(events.size() / CHASE_STEP + 1);
+    for (size_t i = 0; i < events.size(); i++) {
+        if (!(i % CHASE_STEP)) checkpoints.push_back(state);
+        state.apply(events[i]);
+    }
+    return !events.empty();
+}
+
+size_t MidiFile::find(double quarters) const {
+    const double tick = quarters * ppq;
+    return std::lower_bound(events.begin(), events.end(), tick,
+        [](const MidiEvent& ev, double t) { return (double)ev.tick < t; }) - events.begin();
+}
+
+void MidiFile::chase(size_t index, ChaseState& state) const {
+    if (checkpoints.empty()) {
+        state.clear();
+        return;
+    }
+    const size_t c = std::min(index / CHASE_STEP, checkpoints.size() - 1);
+    state = checkpoints[c];
+    for (size_t i = c * CHASE_STEP; i < index && i < events.size(); i++) {
+        state.apply(events[i]);
+    }
+}
+
+/****************************************************************
+ ** class MidiPlayer
+ */
+
+MidiPlayer::MidiPlayer() : file(NULL), index(0), expected(-1.0),
+    rolling(false), seek(true) {
+    memset(held, 0, sizeof(held));
+    state.clear();
+}
+
+void MidiPlayer::set_file(const MidiFile* f) {
+    file = f;
+    seek = true;
+}
+
+void MidiPlayer::release(MidiSink sink, void* data) {
+    for (int ch = 0; ch < 16; ch++) {
+        for (int note = 0; note < 128; note++) {
+            if (!held[ch][note]) continue;
+            const uint8_t msg[3] = {(uint8_t)(0x80 | ch), (uint8_t)note, 0};
+            sink(data, msg);
+            held[ch][note] = 0;
+        }
+    }
+}
+
+// bank and program first, the parameter selects before the data entry
+void MidiPlayer::send_chase(MidiSink sink, void* data) {
+    for (int ch = 0; ch < 16; ch++) {
+        uint8_t msg[3];
+        msg[0] = 0xB0 | ch;
+        for (int b = 0; b < 2; b++) {
+            msg[1] = b ? 32 : 0;
+            msg[2] = state.cc[ch][msg[1]];
+            if (msg[2] != CHASE_UNSET) sink(data, msg);
+        }
+        if (state.program[ch] != CHASE_UNSET) {
+            const uint8_t pc[3] = {(uint8_t)(0xC0 | ch), state.program[ch], 0};
+            sink(data, pc);
+        }
+        for (int i = 0; i < 4; i++) {
+            msg[1] = param_select[i];
+            msg[2] = state.cc[ch][msg[1]];
+            if (msg[2] != CHASE_UNSET) sink(data, msg);
+        }
+        for (int cc = 1; cc < 120; cc++) {
+            if (cc == 32 || (cc >= 98 && cc <= 101)) continue;
+            if (state.cc[ch][cc] == CHASE_UNSET) continue;
+            msg[1] = cc;
+            msg[2] = state.cc[ch][cc];
+            sink(data, msg);
+        }
+        if (state.bend[ch][0] != CHASE_UNSET) {
+            const uint8_t pb[3] = {(uint8_t)(0xE0 | ch), state.bend[ch][0], state.bend[ch][1]};
+            sink(data, pb);
+        }
+    }
+}
+
+void MidiPlayer::stop(MidiSink sink, void* data) {
+    release(sink, data);
+    rolling = false;
+    seek = true;
+}
+
+void MidiPlayer::process(double start, double end, bool roll, MidiSink sink, void* data) {
+    if (!roll || !file || file->events.empty()) {
+        if (rolling) stop(sink, data);
+        return;
+    }
+    // a jump in the transport, or a new file, chase the state there
+    if (seek || !rolling || start < expected - 1e-6 || start > expected + 1e-6) {
+        release(sink, data);
+        index = file->find(start);
+        file->chase(index, state);
+        send_chase(sink, data);
+        seek = false;
+    }
+    rolling = true;
+    const size_t n = file->events.size();
+    while (index < n && file->quarters(index) < end) {
+        const MidiEvent& ev = file->events[index++];
+        const int ch = ev.msg[0] & 0x0f;
+        const uint8_t type = ev.msg[0] & 0xf0;
+        if (type == 0x90 && ev.msg[2]) held[ch][ev.msg[1]] = 1;
+        else if (type == 0x80 || type == 0x90) held[ch][ev.msg[1]] = 0;
+        sink(data, ev.msg);
+    }
+    expected = end;
+}
+
+} // namespace xsynth
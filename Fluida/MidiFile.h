@@ -0,0 +1,131 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#pragma once
+
+#ifndef MIDIFILE_H
+#define MIDIFILE_H
+
+
+namespace xsynth {
+
+// events between two chase checkpoints
+#define CHASE_STEP 256
+#define CHASE_UNSET 0xff
+
+/****************************************************************
+ ** struct MidiEvent
+ **
+ ** a channel message from the file, at it's absolute tick
+ */
+
+struct MidiEvent {
+    uint32_t tick;
+    uint8_t msg[3];
+    uint8_t size;
+};
+
+/****************************************************************
+ ** struct ChaseState
+ **
+ ** controller, program and pitch bend state of all channels,
+ ** CHASE_UNSET for values the file didn't set so far
+ */
+
+struct ChaseState {
+    uint8_t cc[16][128];
+    uint8_t program[16];
+    uint8_t bend[16][2];
+    void clear();
+    void apply(const MidiEvent& ev);
+};
+
+/****************************************************************
+ ** class MidiFile
+ **
+ ** a standard midi file (type 0 or 1) merged to one sorted event
+ ** array. Every CHASE_STEP events the chase state is stored, so
+ ** that the state at any position is found without a scan from
+ ** the start. Tempo is taken from the host, tempo events are
+ ** skipped.
+ */
+
+class MidiFile {
+private:
+    std::vector<ChaseState> checkpoints;
+    bool read_track(const uint8_t *data, size_t size);
+
+public:
+    std::vector<MidiEvent> events;
+    int ppq;
+
+    bool load(const char *path);
+    void clear();
+    // first event at or behind the position in quarter notes
+    size_t find(double quarters) const;
+    // the state right before events[index]
+    void chase(size_t index, ChaseState& state) const;
+    double quarters(size_t index) const { return (double)events[index].tick / ppq; }
+
+    MidiFile();
+    ~MidiFile();
+};
+
+/****************************************************************
+ ** class MidiPlayer
+ **
+ ** play a MidiFile along the host transport, called once per
+ ** block from the audio thread. Events go to the sink, notes
+ ** still held are released on stop and seek.
+ */
+
+typedef void (*MidiSink)(void* data, const uint8_t* msg);
+
+class MidiPlayer {
+private:
+    const MidiFile* file;
+    size_t index;
+    double expected;
+    bool rolling;
+    bool seek;
+    uint8_t held[16][128];
+    ChaseState state;
+    void release(MidiSink sink, void* data);
+    void send_chase(MidiSink sink, void* data);
+
+public:
+    // a new file, or NULL, takes effect on the next process()
+    void set_file(const MidiFile* f);
+    const MidiFile* get_file() const { return file; }
+    // play the events from start to end, positions in quarter notes
+    void process(double start, double end, bool roll, MidiSink sink, void* data);
+    void stop(MidiSink sink, void* data);
+
+    MidiPlayer();
+};
+
+} // namespace xsynth
+
+#endif //MIDIFILE_H
@@ -0,0 +1,138 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "RenderPool.h"
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define cpu_relax() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax()
+#endif
+
+namespace xsynth {
+
+/****************************************************************
+ ** class Semaphore
+ */
+
+#ifdef __APPLE__
+Semaphore::Semaphore() { sem = dispatch_semaphore_create(0); }
+Semaphore::~Semaphore() { dispatch_release(sem); }
+void Semaphore::post() { dispatch_semaphore_signal(sem); }
+void Semaphore::wait() { dispatch_semaphore_wait(sem, DISPATCH_TIME_FOREVER); }
+#else
+Semaphore::Semaphore() { sem_init(&sem, 0, 0); }
+Semaphore::~Semaphore() { sem_destroy(&sem); }
+void Semaphore::post() { sem_post(&sem); }
+void Semaphore::wait() { while (sem_wait(&sem) != 0) {} }
+#endif
+
+/****************************************************************
+ ** class RenderPool
+ */
+
+RenderPool::RenderPool() : job(NULL), data(NULL), threads(0),
+    pending(0), running(false), policy(-1), priority(0), sched_checked(false) {
+}
+
+RenderPool::~RenderPool() {
+    stop();
+}
+
+void RenderPool::start(int count, RenderJob job_, void* data_) {
+    if (count > MAX_POOL_THREADS) count = MAX_POOL_THREADS;
+    const int current = threads.load(std::memory_order_relaxed);
+    if (count <= current) return;
+    // the audio thread only call job while threads are running
+    if (!current) {
+        job = job_;
+        data = data_;
+    }
+    running.store(true, std::memory_order_release);
+    for (int i = current; i < count; i++) {
+        pool[i] = std::thread(&RenderPool::thread_run, this, i);
+    }
+    threads.store(count, std::memory_order_release);
+}
+
+void RenderPool::stop() {
+    const int current = threads.load(std::memory_order_relaxed);
+    if (!current) return;
+    threads.store(0, std::memory_order_release);
+    running.store(false, std::memory_order_release);
+    for (int i = 0; i < current; i++) wake[i].post();
+    for (int i = 0; i < current; i++) {
+        if (pool[i].joinable()) pool[i].join();
+    }
+}
+
+void RenderPool::thread_run(int index) {
+    int current_policy = -1;
+    int current_priority = 0;
+    for (;;) {
+        wake[index].wait();
+        if (!running.load(std::memory_order_acquire)) break;
+#ifndef _WIN32
+        // follow the audio thread, one step below it
+        const int p = policy.load(std::memory_order_relaxed);
+        const int prio = priority.load(std::memory_order_relaxed);
+        if (p >= 0 && (p != current_policy || prio != current_priority)) {
+            sched_param param;
+            param.sched_priority = prio > 1 ? prio - 1 : prio;
+            pthread_setschedparam(pthread_self(), p, &param);
+            current_policy = p;
+            current_priority = prio;
+        }
+#endif
+        job(data, index + 1);
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void RenderPool::run(int count) {
+    const int current = threads.load(std::memory_order_acquire);
+    if (count > current + 1) count = current + 1;
+#ifndef _WIN32
+    if (!sched_checked) {
+        // the scheduling of the audio thread, for the pool threads
+        int p;
+        sched_param param;
+        if (pthread_getschedparam(pthread_self(), &p, &param) == 0) {
+            priority.store(param.sched_priority, std::memory_order_relaxed);
+            policy.store(p, std::memory_order_relaxed);
+        }
+        sched_checked = true;
+    }
+#endif
+    pending.store(count - 1, std::memory_order_release);
+    for (int i = 1; i < count; i++) wake[i-1].post();
+    job(data, 0);
+    while (pending.load(std::memory_order_acquire) > 0) cpu_relax();
+}
+
+} // namespace xsynth
@@ -0,0 +1,100 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <thread>
+
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+#pragma once
+
+#ifndef RENDERPOOL_H
+#define RENDERPOOL_H
+
+
+namespace xsynth {
+
+#define MAX_POOL_THREADS 8
+
+/****************************************************************
+ ** class Semaphore
+ **
+ ** wake a pool thread, post is safe to call from the audio thread
+ */
+
+class Semaphore {
+private:
+#ifdef __APPLE__
+    dispatch_semaphore_t sem;
+#else
+    sem_t sem;
+#endif
+public:
+    void post();
+    void wait();
+    Semaphore();
+    ~Semaphore();
+};
+
+/****************************************************************
+ ** class RenderPool
+ **
+ ** a small pool of threads, running with the scheduling policy of
+ ** the audio thread. run() wake the threads, run job 0 on the
+ ** calling thread and spin until all jobs are done, so the audio
+ ** thread never block on a lock.
+ */
+
+typedef void (*RenderJob)(void* data, int index);
+
+class RenderPool {
+private:
+    RenderJob job;
+    void* data;
+    std::atomic<int> threads;
+    std::thread pool[MAX_POOL_THREADS];
+    Semaphore wake[MAX_POOL_THREADS];
+    std::atomic<int> pending;
+    std::atomic<bool> running;
+    std::atomic<int> policy;
+    std::atomic<int> priority;
+    bool sched_checked;
+    void thread_run(int index);
+
+public:
+    // start up to count threads, jobs 1..count get a thread each. The
+    // new threads are running before size() report them.
+    void start(int count, RenderJob job_, void* data_);
+    void stop();
+    // run jobs 0..count-1, job 0 on the calling thread
+    void run(int count);
+    int size() const { return threads.load(std::memory_order_acquire); }
+
+    RenderPool();
+    ~RenderPool();
+};
+
+} // namespace xsynth
+
+#endif //RENDERPOOL_H
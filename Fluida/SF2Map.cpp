@@ -0,0 +1,250 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "SF2Map.h"
+#include <cstring>
+#include <algorithm>
+
+namespace xsynth {
+
+// size of the records in the pdta sub chunks
+#define PHDR_SIZE 38
+#define BAG_SIZE 4
+#define GEN_SIZE 4
+#define INST_SIZE 22
+#define SHDR_SIZE 46
+
+// generator operators
+#define GEN_INSTRUMENT 41
+#define GEN_SAMPLE_ID 53
+
+// fluidsynth reads 46 zero samples behind each sample
+#define SAMPLE_PADDING 46
+#define SAMPLE_ROM 0x8000
+#define SAMPLE_VORBIS 0x10
+
+static inline uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+        ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/****************************************************************
+ ** class SF2Map
+ **
+ ** map presets of a soundfont to there sample data
+ */
+
+SF2Map::SF2Map() {
+    clear();
+}
+
+SF2Map::~SF2Map() {
+}
+
+void SF2Map::clear() {
+    smpl_offset = 0;
+    smpl_size = 0;
+    sm24_offset = 0;
+    sm24_size = 0;
+    compressed = false;
+    headers.clear();
+    presets.clear();
+}
+
+bool SF2Map::parse(const char *path) {
+    clear();
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    bool ret = false;
+    uint8_t hdr[12];
+    if (fread(hdr, 1, 12, fp) == 12 && memcmp(hdr, "RIFF", 4) == 0 &&
+                                       memcmp(hdr + 8, "sfbk", 4) == 0) {
+        const long riff_end = 8 + (long)read_u32(hdr + 4);
+        long pos = 12;
+        while (pos + 12 <= riff_end) {
+            uint8_t ck[12];
+            if (fseek(fp, pos, SEEK_SET) != 0 || fread(ck, 1, 12, fp) != 12) break;
+            const uint32_t size = read_u32(ck + 4);
+            if (memcmp(ck, "LIST", 4) == 0 && size >= 4) {
+                if (memcmp(ck + 8, "sdta", 4) == 0) {
+                    read_sdta(fp, pos + 12, size - 4);
+                } else if (memcmp(ck + 8, "pdta", 4) == 0) {
+                    ret = read_pdta(fp, pos + 12, size - 4);
+                }
+            }
+            pos += 8 + (long)size + (size & 1);
+        }
+    }
+    fclose(fp);
+    if (!ret || !smpl_size) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+void SF2Map::read_sdta(FILE *fp, long pos, uint32_t size) {
+    const long end = pos + (long)size;
+    while (pos + 8 <= end) {
+        uint8_t ck[8];
+        if (fseek(fp, pos, SEEK_SET) != 0 || fread(ck, 1, 8, fp) != 8) break;
+        const uint32_t ck_size = read_u32(ck + 4);
+        if (memcmp(ck, "smpl", 4) == 0) {
+            smpl_offset = pos + 8;
+            smpl_size = ck_size;
+        } else if (memcmp(ck, "sm24", 4) == 0) {
+            sm24_offset = pos + 8;
+            sm24_size = ck_size;
+        }
+        pos += 8 + (long)ck_size + (ck_size & 1);
+    }
+}
+
+bool SF2Map::read_pdta(FILE *fp, long pos, uint32_t size) {
+    std::vector<uint8_t> phdr, pbag, pgen, inst, ibag, igen, shdr;
+    const long end = pos + (long)size;
+    while (pos + 8 <= end) {
+        uint8_t ck[8];
+        if (fseek(fp, pos, SEEK_SET) != 0 || fread(ck, 1, 8, fp) != 8) return false;
+        const uint32_t ck_size = read_u32(ck + 4);
+        std::vector<uint8_t> *dst = NULL;
+        if (memcmp(ck, "phdr", 4) == 0) dst = &phdr;
+        else if (memcmp(ck, "pbag", 4) == 0) dst = &pbag;
+        else if (memcmp(ck, "pgen", 4) == 0) dst = &pgen;
+        else if (memcmp(ck, "inst", 4) == 0) dst = &inst;
+        else if (memcmp(ck, "ibag", 4) == 0) dst = &ibag;
+        else if (memcmp(ck, "igen", 4) == 0) dst = &igen;
+        else if (memcmp(ck, "shdr", 4) == 0) dst = &shdr;
+        if (dst) {
+            dst->resize(ck_size);
+            if (ck_size && fread(dst->data(), 1, ck_size, fp) != ck_size) return false;
+        }
+        pos += 8 + (long)ck_size + (ck_size & 1);
+    }
+
+    // every list ends with a terminal record
+    const size_t n_phdr = phdr.size() / PHDR_SIZE;
+    const size_t n_pbag = pbag.size() / BAG_SIZE;
+    const size_t n_pgen = pgen.size() / GEN_SIZE;
+    const size_t n_inst = inst.size() / INST_SIZE;
+    const size_t n_ibag = ibag.size() / BAG_SIZE;
+    const size_t n_igen = igen.size() / GEN_SIZE;
+    const size_t n_shdr = shdr.size() / SHDR_SIZE;
+    if (n_phdr < 2 || n_inst < 2 || n_shdr < 2) return false;
+
+    for (size_t i = 0; i + 1 < n_shdr; i++) {
+        const uint8_t *p = shdr.data() + i * SHDR_SIZE;
+        SampleHeader h;
+        h.start = read_u32(p + 20);
+        h.end = read_u32(p + 24);
+        h.type = read_u16(p + 44);
+        if (h.type & SAMPLE_VORBIS) compressed = true;
+        headers.push_back(h);
+    }
+
+    std::vector<std::vector<int> > inst_samples(n_inst - 1);
+    for (size_t i = 0; i + 1 < n_inst; i++) {
+        const size_t b0 = read_u16(inst.data() + i * INST_SIZE + 20);
+        const size_t b1 = read_u16(inst.data() + (i + 1) * INST_SIZE + 20);
+        for (size_t b = b0; b < b1 && b + 1 < n_ibag; b++) {
+            const size_t g0 = read_u16(ibag.data() + b * BAG_SIZE);
+            const size_t g1 = read_u16(ibag.data() + (b + 1) * BAG_SIZE);
+            for (size_t g = g0; g < g1 && g < n_igen; g++) {
+                const uint8_t *p = igen.data() + g * GEN_SIZE;
+                if (read_u16(p) == GEN_SAMPLE_ID && read_u16(p + 2) < headers.size()) {
+                    inst_samples[i].push_back(read_u16(p + 2));
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i + 1 < n_phdr; i++) {
+        const uint8_t *p = phdr.data() + i * PHDR_SIZE;
+        PresetSamples preset;
+        preset.program = read_u16(p + 20);
+        preset.bank = read_u16(p + 22);
+        const size_t b0 = read_u16(p + 24);
+        const size_t b1 = read_u16(p + PHDR_SIZE + 24);
+        for (size_t b = b0; b < b1 && b + 1 < n_pbag; b++) {
+            const size_t g0 = read_u16(pbag.data() + b * BAG_SIZE);
+            const size_t g1 = read_u16(pbag.data() + (b + 1) * BAG_SIZE);
+            for (size_t g = g0; g < g1 && g < n_pgen; g++) {
+                const uint8_t *q = pgen.data() + g * GEN_SIZE;
+                const size_t n = read_u16(q + 2);
+                if (read_u16(q) == GEN_INSTRUMENT && n < inst_samples.size()) {
+                    preset.samples.insert(preset.samples.end(),
+                        inst_samples[n].begin(), inst_samples[n].end());
+                }
+            }
+        }
+        std::sort(preset.samples.begin(), preset.samples.end());
+        preset.samples.erase(std::unique(preset.samples.begin(),
+                        preset.samples.end()), preset.samples.end());
+        presets.push_back(preset);
+    }
+    return true;
+}
+
+const PresetSamples* SF2Map::find_preset(int bank, int program) const {
+    for (auto& p : presets) {
+        if (p.bank == bank && p.program == program) return &p;
+    }
+    return NULL;
+}
+
+// byte ranges in the file used by the preset, sorted and merged
+void SF2Map::get_spans(const PresetSamples& preset, std::vector<SampleSpan>& spans) const {
+    spans.clear();
+    for (auto s : preset.samples) {
+        const SampleHeader& h = headers[s];
+        if ((h.type & SAMPLE_ROM) || h.end <= h.start) continue;
+        const size_t frames = h.end - h.start + SAMPLE_PADDING;
+        const size_t start = (size_t)h.start * 2;
+        if (start < smpl_size) {
+            spans.push_back(SampleSpan(smpl_offset + (long)start,
+                std::min(frames * 2, smpl_size - start)));
+        }
+        if (sm24_size && h.start < sm24_size) {
+            spans.push_back(SampleSpan(sm24_offset + (long)h.start,
+                std::min(frames, sm24_size - h.start)));
+        }
+    }
+    std::sort(spans.begin(), spans.end(), [](const SampleSpan& a, const SampleSpan& b) {
+        return a.offset < b.offset;
+    });
+    size_t n = 0;
+    for (size_t i = 0; i < spans.size(); i++) {
+        if (n && spans[n-1].offset + (long)spans[n-1].size >= spans[i].offset) {
+            const long e = std::max(spans[n-1].offset + (long)spans[n-1].size,
+                                    spans[i].offset + (long)spans[i].size);
+            spans[n-1].size = e - spans[n-1].offset;
+        } else {
+            spans[n++] = spans[i];
+        }
+    }
+    spans.erase(spans.begin() + n, spans.end());
+}
+
+} // namespace xsynth
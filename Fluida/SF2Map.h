@@ -0,0 +1,99 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#pragma once
+
+#ifndef SF2MAP_H
+#define SF2MAP_H
+
+
+namespace xsynth {
+
+
+/****************************************************************
+ ** struct SampleSpan
+ **
+ ** a byte range in the soundfont file
+ */
+
+struct SampleSpan {
+    long offset;
+    size_t size;
+    SampleSpan(long o, size_t s) : offset(o), size(s) {}
+};
+
+/****************************************************************
+ ** struct PresetSamples
+ **
+ ** the samples (shdr index) used by a preset
+ */
+
+struct PresetSamples {
+    int bank;
+    int program;
+    std::vector<int> samples;
+};
+
+/****************************************************************
+ ** class SF2Map
+ **
+ ** read the RIFF structure of a soundfont and map the presets
+ ** to the sample data they use. Only the hydra (pdta) is read,
+ ** the sample data itself is skipped.
+ */
+
+class SF2Map {
+private:
+    struct SampleHeader {
+        uint32_t start;
+        uint32_t end;
+        uint16_t type;
+    };
+    std::vector<SampleHeader> headers;
+    void read_sdta(FILE *fp, long pos, uint32_t size);
+    bool read_pdta(FILE *fp, long pos, uint32_t size);
+
+public:
+    long smpl_offset;
+    size_t smpl_size;
+    long sm24_offset;
+    size_t sm24_size;
+    // Ogg Vorbis samples (SF3), fluidsynth decode them to memory of it's own
+    bool compressed;
+    std::vector<PresetSamples> presets;
+
+    bool parse(const char *path);
+    void clear();
+    const PresetSamples* find_preset(int bank, int program) const;
+    void get_spans(const PresetSamples& preset, std::vector<SampleSpan>& spans) const;
+
+    SF2Map();
+    ~SF2Map();
+};
+
+} // namespace xsynth
+
+#endif //SF2MAP_H
@@ -0,0 +1,85 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+
+#include "TextSlot.h"
+#include <cstring>
+
+namespace xsynth {
+
+TextSlot::TextSlot() : pending(false), latest(0) {
+    memset(text, 0, sizeof(text));
+    staged[0] = 0;
+    readers[0] = 0;
+    readers[1] = 0;
+}
+
+TextSlot::~TextSlot() {
+}
+
+bool TextSlot::set(const char *s) {
+    strncpy(staged, s, TEXT_SLOT_SIZE - 1);
+    staged[TEXT_SLOT_SIZE - 1] = 0;
+    pending = true;
+    flush();
+    return !pending;
+}
+
+// the reader mark the buffer before it check that it's still the
+// latest one, the writer check the mark before it write. With both
+// sequentially consistent one of them see the other.
+bool TextSlot::flush() {
+    if (!pending) return false;
+    const int t = 1 - latest.load(std::memory_order_relaxed);
+    if (readers[t].load(std::memory_order_seq_cst)) return false;
+    memcpy(text[t], staged, strlen(staged) + 1);
+    latest.store(t, std::memory_order_seq_cst);
+    pending = false;
+    return true;
+}
+
+std::string TextSlot::get() {
+    for (;;) {
+        const int s = latest.load(std::memory_order_seq_cst);
+        readers[s].fetch_add(1, std::memory_order_seq_cst);
+        if (latest.load(std::memory_order_seq_cst) == s) {
+            std::string ret(text[s]);
+            readers[s].fetch_sub(1, std::memory_order_seq_cst);
+            return ret;
+        }
+        readers[s].fetch_sub(1, std::memory_order_seq_cst);
+    }
+}
+
+void TextSlot::read(char *buf) {
+    for (;;) {
+        const int s = latest.load(std::memory_order_seq_cst);
+        readers[s].fetch_add(1, std::memory_order_seq_cst);
+        if (latest.load(std::memory_order_seq_cst) == s) {
+            memcpy(buf, text[s], strlen(text[s]) + 1);
+            readers[s].fetch_sub(1, std::memory_order_seq_cst);
+            return;
+        }
+        readers[s].fetch_sub(1, std::memory_order_seq_cst);
+    }
+}
+
+} // namespace xsynth
@@ -0,0 +1,71 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <atomic>
+#include <string>
+#include <cstddef>
+
+#pragma once
+
+#ifndef TEXTSLOT_H
+#define TEXTSLOT_H
+
+// longest text a slot hold, paths included
+#define TEXT_SLOT_SIZE 4096
+
+
+namespace xsynth {
+
+
+/****************************************************************
+ ** class TextSlot
+ **
+ ** a string set on the audio thread and read by the worker and the
+ ** host. There are two buffers, the writer fill the one no reader is
+ ** in. A string which find it taken is kept and published by the
+ ** next flush(). set(), flush() and read() never allocate, only one
+ ** thread set at a time.
+ */
+
+class TextSlot {
+private:
+    char text[2][TEXT_SLOT_SIZE];
+    char staged[TEXT_SLOT_SIZE];
+    bool pending;
+    std::atomic<int> latest;
+    std::atomic<int> readers[2];
+
+public:
+    // returns false when the string wait for the next flush()
+    bool set(const char *s);
+    // true when a waiting string was published now
+    bool flush();
+    std::string get();
+    // copy the string to buf, which hold TEXT_SLOT_SIZE bytes
+    void read(char *buf);
+
+    TextSlot();
+    ~TextSlot();
+};
+
+} // namespace xsynth
+
+#endif //TEXTSLOT_H
@@ -0,0 +1,108 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "VoiceBudget.h"
+#include <cstdio>
+#include <cstring>
+
+namespace xsynth {
+
+/****************************************************************
+ ** class VoiceBudget
+ */
+
+VoiceBudget::VoiceBudget() {
+    for (int i = 0; i < 16; i++) {
+        min_voices[i] = 0;
+        max_voices[i] = 128;
+        priority[i] = 0;
+    }
+    clear();
+}
+
+VoiceBudget::~VoiceBudget() {
+}
+
+void VoiceBudget::clear() {
+    memset(active, 0, sizeof(active));
+    for (int i = 0; i < 16; i++) {
+        head[i] = -1;
+        tail[i] = -1;
+        count[i] = 0;
+    }
+}
+
+void VoiceBudget::note_on(int channel, int note) {
+    // a retriggered note move to the end of the list
+    if (active[channel][note]) note_off(channel, note);
+    active[channel][note] = true;
+    prev[channel][note] = tail[channel];
+    next[channel][note] = -1;
+    if (tail[channel] >= 0) next[channel][tail[channel]] = note;
+    else head[channel] = note;
+    tail[channel] = note;
+    count[channel]++;
+}
+
+void VoiceBudget::note_off(int channel, int note) {
+    if (!active[channel][note]) return;
+    active[channel][note] = false;
+    const int p = prev[channel][note];
+    const int n = next[channel][note];
+    if (p >= 0) next[channel][p] = n;
+    else head[channel] = n;
+    if (n >= 0) prev[channel][n] = p;
+    else tail[channel] = p;
+    count[channel]--;
+}
+
+// a channel below it's minimum may take from every channel above it's
+// minimum, otherwise only from channels with a lower priority. The
+// lowest priority go first, the busiest channel on a tie.
+int VoiceBudget::victim(int channel) const {
+    const bool reserved = count[channel] < min_voices[channel];
+    int v = -1;
+    for (int c = 0; c < 16; c++) {
+        if (c == channel || count[c] <= min_voices[c] || !count[c]) continue;
+        if (!reserved && priority[c] <= priority[channel]) continue;
+        if (v < 0 || priority[c] > priority[v] ||
+                (priority[c] == priority[v] && count[c] > count[v])) v = c;
+    }
+    return v;
+}
+
+void VoiceBudget::important_channels(char *buf, size_t size) const {
+    buf[0] = 0;
+    int top = priority[0];
+    bool equal = true;
+    for (int c = 1; c < 16; c++) {
+        if (priority[c] != priority[0]) equal = false;
+        if (priority[c] < top) top = priority[c];
+    }
+    if (equal) return;
+    size_t len = 0;
+    for (int c = 0; c < 16 && len < size; c++) {
+        if (priority[c] != top) continue;
+        len += snprintf(buf + len, size - len, len ? ",%i" : "%i", c + 1);
+    }
+}
+
+} // namespace xsynth
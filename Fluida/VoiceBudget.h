@@ -0,0 +1,72 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <cstdint>
+#include <cstddef>
+
+#pragma once
+
+#ifndef VOICEBUDGET_H
+#define VOICEBUDGET_H
+
+
+namespace xsynth {
+
+
+/****************************************************************
+ ** class VoiceBudget
+ **
+ ** per channel voice policy: a guaranteed minimum and a hard
+ ** maximum of notes, and a stealing priority (0 = most important).
+ ** The sounding notes of each channel are kept in a linked list
+ ** in note on order, so that every update is O(1).
+ */
+
+class VoiceBudget {
+private:
+    int16_t prev[16][128];
+    int16_t next[16][128];
+    bool active[16][128];
+    int16_t head[16];
+    int16_t tail[16];
+
+public:
+    int min_voices[16];
+    int max_voices[16];
+    int priority[16];
+    int count[16];
+
+    void note_on(int channel, int note);
+    void note_off(int channel, int note);
+    // the oldest sounding note on the channel, or -1
+    int oldest(int channel) const { return head[channel]; }
+    // the channel a note could be taken from for a new note, or -1
+    int victim(int channel) const;
+    // comma separated list (1 based) of the channels with the highest priority
+    void important_channels(char *buf, size_t size) const;
+    void clear();
+
+    VoiceBudget();
+    ~VoiceBudget();
+};
+
+} // namespace xsynth
+
+#endif //VOICEBUDGET_H
@@ -0,0 +1,94 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include "WavFile.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+namespace xsynth {
+
+static void put_u32(FILE *fp, uint32_t v) {
+    const uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    fwrite(b, 1, 4, fp);
+}
+
+static void put_u16(FILE *fp, uint16_t v) {
+    const uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    fwrite(b, 1, 2, fp);
+}
+
+bool write_wav(const char *path, const std::vector<float>& frames, int rate) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    const uint32_t bytes = frames.size() * sizeof(float);
+    fwrite("RIFF", 1, 4, fp);
+    put_u32(fp, 36 + bytes);
+    fwrite("WAVEfmt ", 1, 8, fp);
+    put_u32(fp, 16);
+    put_u16(fp, 3);            // IEEE float
+    put_u16(fp, 2);
+    put_u32(fp, rate);
+    put_u32(fp, rate * 2 * sizeof(float));
+    put_u16(fp, 2 * sizeof(float));
+    put_u16(fp, 32);
+    fwrite("data", 1, 4, fp);
+    put_u32(fp, bytes);
+    fwrite(frames.data(), sizeof(float), frames.size(), fp);
+    fclose(fp);
+    return true;
+}
+
+bool read_wav(const char *path, std::vector<float>& frames, int& rate) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return false;
+    uint8_t hdr[12];
+    bool ok = false;
+    int format = 0;
+    int channels = 0;
+    int bits = 0;
+    if (fread(hdr, 1, 12, fp) == 12 && !memcmp(hdr, "RIFF", 4) && !memcmp(hdr + 8, "WAVE", 4)) {
+        uint8_t ck[8];
+        while (fread(ck, 1, 8, fp) == 8) {
+            const uint32_t size = ck[4] | (ck[5] << 8) | (ck[6] << 16) | ((uint32_t)ck[7] << 24);
+            if (!memcmp(ck, "fmt ", 4) && size >= 16) {
+                uint8_t f[16];
+                if (fread(f, 1, 16, fp) != 16) break;
+                format = f[0] | (f[1] << 8);
+                channels = f[2] | (f[3] << 8);
+                rate = f[4] | (f[5] << 8) | (f[6] << 16) | (f[7] << 24);
+                bits = f[14] | (f[15] << 8);
+                fseek(fp, size - 16 + (size & 1), SEEK_CUR);
+            } else if (!memcmp(ck, "data", 4)) {
+                if (format != 3 || channels != 2 || bits != 32) break;
+                frames.resize(size / sizeof(float));
+                ok = fread(frames.data(), sizeof(float), frames.size(), fp) == frames.size();
+                break;
+            } else {
+                fseek(fp, size + (size & 1), SEEK_CUR);
+            }
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+} // namespace xsynth
@@ -22,6 +22,25 @@
 #include "XSynth.h"
 #include <sstream>
 #include <algorithm>
+#include <set>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <dirent.h>
+#endif
 
 namespace xsynth {
 
@@ -35,6 +54,25 @@ namespace xsynth {
 #define USE_FLUID_API 1
 #endif
 
+// free voices left before the voice budget start to take notes
+#define VOICE_HEADROOM 16
+
+// mean square below -120dB count as silence
+#define SILENCE_ENERGY 1e-12f
+// and must last that long, the reverb and chorus lines are empty then
+#define FX_TAIL_SECONDS 1.0
+
+// threads pulling the sample data of a font into the page cache
+#define READAHEAD_THREADS 3
+#define READAHEAD_SLICE (4 * 1024 * 1024)
+
+// frames rendered per pass of the output stage, when the host don't tell
+#define FX_BLOCK 256
+#define FX_BLOCK_MAX 8192
+
+// the per channel state copied to a partition
+#define CC_COUNT 128
+
 
 
 /****************************************************************
@@ -44,7 +82,6 @@ namespace xsynth {
  */
 
 XSynth::XSynth() : cents{} {
-    sf_id = -1;
     adriver = NULL;
     mdriver = NULL;
     synth = NULL;
@@ -58,6 +95,20 @@ XSynth::XSynth() : cents{} {
         channel_banks[i] = 0;
     }
 
+    for(int i = 0; i < 16; i++) {
+        channel_font[i] = 0;
+    }
+
+    memory_policy = MEMORY_LOCK;
+    font_hash = true;
+    readahead = true;
+    channel_meter = false;
+    hold_audio = NULL;
+    hold_data = NULL;
+    sample_budget = 0;
+    budget_refused = 0;
+    late_notes = 0;
+
     reverb_on = 0;
     reverb_level = 0.7;
     reverb_width = 10.0;
@@ -74,6 +125,23 @@ XSynth::XSynth() : cents{} {
     
     channel_pressure = 0;
     volume_level = 0.2;
+    smooth_time = 20.0;
+    smooth_mode = RAMP_LINEAR;
+    sample_rate = 48000;
+    block_length = FX_BLOCK;
+    block_pow2 = false;
+    silent = false;
+    quiet_frames = 0;
+    wake = false;
+    engines = 0;
+    part_count = 1;
+    job_frames = 0;
+    job_out[0] = job_out[1] = NULL;
+    finetune_cents = 0.0;
+    tuning_program = 1;
+    gain_ramp.reset(volume_level);
+    reverb_ramp.reset(reverb_level);
+    chorus_ramp.reset(chorus_level);
 };
 
 XSynth::~XSynth() {
@@ -82,7 +150,9 @@ XSynth::~XSynth() {
     scala_ratios.clear();
 };
 
-void XSynth::setup(unsigned int SampleRate) {
+// BlockLength is the max block length the host will use, when known,
+// Pow2 is set when the host promise power of two blocks
+void XSynth::setup(unsigned int SampleRate, unsigned int BlockLength, bool Pow2) {
 
     // we don't use a audio driver, so we register the file driver to avoid
     // that fluidsynth register it's default audi drivers for jack and alsa
@@ -95,6 +165,23 @@ void XSynth::setup(unsigned int SampleRate) {
 #endif
     settings = new_fluid_settings();
     fluid_settings_setnum(settings, "synth.sample-rate", SampleRate);
+    sample_rate = SampleRate;
+    block_length = BlockLength ? std::min(BlockLength, (unsigned int)FX_BLOCK_MAX) : FX_BLOCK;
+    block_pow2 = Pow2;
+    if (block_pow2) {
+        // largest power of two below the max, so that every block divide it
+        unsigned int l = 1;
+        while (l * 2 <= block_length) l *= 2;
+        block_length = l;
+    }
+    fx_buffer.assign(4 * block_length, 0.0f);
+#if USE_FX_BUFFERS
+    // one stereo group, set_channel_meter() switch to a group per MIDI
+    // channel while the channels are metered
+    fluid_settings_setint(settings, "synth.audio-channels", 1);
+    fluid_settings_setint(settings, "synth.audio-groups", 1);
+    parts[0].channels.assign(32 * block_length, 0.0f);
+#endif
     //fluid_settings_setint (settings, "synth.threadsafe-api", 0);
     //fluid_settings_setstr(settings, "audio.driver", "jack");
     //fluid_settings_setstr(settings, "audio.jack.id", "mamba");
@@ -105,16 +192,21 @@ void XSynth::setup(unsigned int SampleRate) {
 
 void XSynth::finetune(float A4) {
     // Calculate the detune in cents
-    double cents = 1200.0 * log2(A4 / 440.0);
+    finetune_cents = 1200.0 * log2(A4 / 440.0);
     // Set global tuning via fluid_synth_set_gen
-    for (int chan = 0; chan < 16; chan++) {
-        fluid_synth_set_gen(synth, chan, GEN_FINETUNE, cents);
+    for (int e = 0; e < engines; e++) {
+        for (int chan = 0; chan < 16; chan++) {
+            fluid_synth_set_gen(parts[e].synth, chan, GEN_FINETUNE, finetune_cents);
+        }
     }
 }
 
-void XSynth::activate_tunning_for_all_channel(int set) {
+// tuning program 0 is the scala tuning, 1 the 12edo tuning
+void XSynth::apply_tuning(fluid_synth_t* s) {
+    fluid_synth_activate_key_tuning(s, 0, tuning_program,
+        tuning_program ? "12edotuning" : "scalatuning", cents, 1);
     for(int i = 0; i < 16; i++) {
-        fluid_synth_activate_tuning(synth, i, 0, set, 1);
+        fluid_synth_activate_tuning(s, i, 0, tuning_program, 1);
     }
 }
 
@@ -128,8 +220,8 @@ void XSynth::setup_scala_tuning() {
             oc *=2;
         }
     }
-    fluid_synth_activate_key_tuning(synth, 0, 0, "scalatuning", cents, 1);
-    activate_tunning_for_all_channel(0);
+    tuning_program = 0;
+    for (int e = 0; e < engines; e++) apply_tuning(parts[e].synth);
 }
 
 void XSynth::setup_12edo_tuning(double cent) {
@@ -138,8 +230,8 @@ void XSynth::setup_12edo_tuning(double cent) {
         cents[i] = val;
         val += cent;
     }
-    fluid_synth_activate_key_tuning(synth, 0, 1, "12edotuning", cents, 1);
-    activate_tunning_for_all_channel(1);
+    tuning_program = 1;
+    for (int e = 0; e < engines; e++) apply_tuning(parts[e].synth);
 }
 
 void XSynth::delete_envelope() {
@@ -264,88 +356,857 @@ void XSynth::setup_envelope() {
     }
 }
 
+// the envelope modulators for a partition, the main synth got them in
+// setup_envelope()
+void XSynth::add_envelope(fluid_synth_t* s) {
+#if FLUIDSYNTH_VERSION_MAJOR > 1
+    fluid_mod_t *mods[6] = {amod, dmod, smod, rmod, qmod, fmod};
+    for (int i = 0; i < 6; i++) {
+        fluid_synth_add_default_mod(s, mods[i], FLUID_SYNTH_ADD);
+    }
+#endif
+    for (int i = 0; i<16; i++) {
+        fluid_synth_cc(s, i, 73, 0);
+        fluid_synth_cc(s, i, 75, 0);
+        fluid_synth_cc(s, i, 77, 0);
+        fluid_synth_cc(s, i, 72, 0);
+        fluid_synth_cc(s, i, 71, 0);
+        fluid_synth_cc(s, i, 74, 0);
+    }
+}
+
 void XSynth::init_synth() {
     synth = new_fluid_synth(settings);
+    parts[0].synth = synth;
+    engines = synth ? 1 : 0;
+    // the partitions get the same polyphony
+    if (synth) note_voices.resize(fluid_synth_get_polyphony(synth) + 1);
     setup_12edo_tuning(100.0);
     setup_envelope();
+#if USE_FX_BUFFERS
+    // gain and fx return levels are applied in synth_process()
+    set_gain();
+    set_reverb_levels();
+    set_chorus_levels();
+    gain_ramp.reset(volume_level);
+    reverb_ramp.reset(reverb_level);
+    chorus_ramp.reset(chorus_level);
+#endif
     //adriver = new_fluid_audio_driver(settings, synth);
    // mdriver = new_fluid_midi_driver(settings, fluid_synth_handle_midi_event, synth);
 }
 
+// enforce the voice budget before fluidsynth steal voices on it's own.
+// All voices of a note taken from a channel are released, fluidsynth
+// prefer released voices when it need to steal.
 int XSynth::synth_note_on(int channel, int note, int velocity) {
     if (!synth) return -1;
-    return fluid_synth_noteon(synth, channel, note, velocity);
+    if (!velocity) return synth_note_off(channel, note);
+    channel &= 0x0f;
+    note &= 0x7f;
+    // the voice pool is per engine, only notes from the same
+    // partition could make room
+    const int p = owner(channel);
+    fluid_synth_t* s = parts[p].synth;
+    if (voices.count[channel] >= voices.max_voices[channel]) {
+        release_oldest(channel);
+    } else if (fluid_synth_get_active_voice_count(s) >=
+                fluid_synth_get_polyphony(s) - VOICE_HEADROOM) {
+        const int v = voices.victim(channel);
+        if (v >= 0 && owner(v) == p) release_oldest(v);
+    }
+    voices.note_on(channel, note);
+    silent = false;
+    quiet_frames = 0;
+    return fluid_synth_noteon(s, channel, note, velocity);
 }
 
 int XSynth::synth_note_off(int channel, int note) {
     if (!synth) return -1;
-    return fluid_synth_noteoff(synth, channel, note);
+    voices.note_off(channel & 0x0f, note & 0x7f);
+    return fluid_synth_noteoff(owner_synth(channel), channel, note);
+}
+
+// a note off leave the voices of a note playing while the sustain or
+// sostenuto pedal hold them, so each voice of it is released instead.
+// Every layer of the preset is a voice of it's own.
+void XSynth::release_oldest(int channel) {
+    const int note = voices.oldest(channel);
+    if (note < 0) return;
+    voices.note_off(channel, note);
+    fluid_synth_t* s = owner_synth(channel);
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    const int size = (int)note_voices.size();
+    if (size) {
+        fluid_synth_get_voicelist(s, note_voices.data(), size, -1);
+        for (int n = 0; n < size && note_voices[n]; n++) {
+            if (fluid_voice_get_channel(note_voices[n]) == channel &&
+                    fluid_voice_get_key(note_voices[n]) == note)
+                fluid_synth_release_voice(s, note_voices[n]);
+        }
+        return;
+    }
+#endif
+    fluid_synth_noteoff(s, channel, note);
 }
 
+// the main synth keep the state of all channels, so that it could be
+// queried and copied to a partition, the partition play the notes
 int XSynth::synth_send_cc(int channel, int num, int value) {
     if (!synth) return -1;
+    wake_up();
+    fluid_synth_t* s = owner_synth(channel);
+    if (s != synth) fluid_synth_cc(s, channel, num, value);
     return fluid_synth_cc(synth, channel, num, value);
 }
 
 int XSynth::synth_send_pitch_bend(int channel, int value) {
     if (!synth) return -1;
+    fluid_synth_t* s = owner_synth(channel);
+    if (s != synth) fluid_synth_pitch_bend(s, channel, value);
     return fluid_synth_pitch_bend(synth, channel, value);
 }
 
-bool XSynth::check_instrument(int bank, int instrument) {
+// called from the audio thread, compare in place without temporary strings
+bool XSynth::check_instrument(int font, int bank, int instrument) {
+    if (font < 0 || font >= (int)sfonts.size()) return false;
     char inst[10];
     snprintf(inst, 10, "%03d %03d", bank, instrument);
-    std::string prefix = inst;
-    auto it = std::find_if(instruments.begin(), instruments.end(),
-        [&](const std::string& s) {
-            if (s.length() >= 7) {
-                return s.substr(0, 7) == prefix;
-            }
-            return false;
-        });
-    if (it != instruments.end()) return true;
+    for (auto& s : sfonts[font].instruments) {
+        if (s.compare(0, 7, inst) == 0) return true;
+    }
     return false;
 }
 
 int XSynth::synth_pgm_changed(int channel, int num) {
     if (!synth) return -1;
     if (num >= (int)instruments.size()) return -1;
-    if (check_instrument(channel_banks[channel], num))
-        return fluid_synth_program_select (synth, channel, sf_id, channel_banks[channel], num);
+    const int font = channel_font[channel];
+    if (check_instrument(font, channel_banks[channel], num))
+        return program_select(channel, font, channel_banks[channel], num);
     return -1;
 }
 
 int XSynth::synth_bank_changed(int channel, int num) {
     if (!synth) return -1;
     channel_banks[channel] = num;
+    fluid_synth_t* s = owner_synth(channel);
+    if (s != synth) fluid_synth_bank_select(s, channel, num);
     if(fluid_synth_bank_select(synth, channel, num)) {
         return 0;
     }
     return -1;
 }
 
+/****************************************************************
+ ** output stage
+ **
+ ** fluidsynth render the dry signal and the reverb and chorus
+ ** returns with unity levels, the master gain and the fx return
+ ** levels are ramped here on the RT thread, so that a change
+ ** never reach the output as a step.
+ */
+
+// the value at the end of the next n frames
+float Ramp::next(float value, int n, int time, int mode) {
+    if (value != target) {
+        target = value;
+        remaining = time;
+        step = time > 0 ? (target - current) / (float)time : 0.0f;
+    }
+    if (current == target) return current;
+    if (time <= 0) {
+        current = target;
+    } else if (mode == RAMP_EXPONENTIAL) {
+        // one pole, reach -40dB of the distance after time frames
+        current = target + (current - target) * expf(-4.6f * (float)n / (float)time);
+        if (fabsf(target - current) < 1e-5f) current = target;
+    } else if (remaining <= n) {
+        current = target;
+        remaining = 0;
+    } else {
+        current += step * (float)n;
+        remaining -= n;
+    }
+    return current;
+}
+
+void mix_fx(float* __restrict out, const float* __restrict rev,
+            const float* __restrict chorus, int n,
+            float g, float dg, float r, float dr, float c, float dc) {
+    for (int i = 0; i < n; i++) {
+        const float t = (float)i;
+        out[i] = (g + dg * t) * (out[i] + (r + dr * t) * rev[i] + (c + dc * t) * chorus[i]);
+    }
+}
+
+// the ramps start in 16 lanes and step 16 frames at a time, the inner
+// loop is then a fixed size multiply-add without the int to float
+// conversion and the scalar tail of mix_fx()
+void mix_fx16(float* __restrict out, const float* __restrict rev,
+              const float* __restrict chorus, int n,
+              float g, float dg, float r, float dr, float c, float dc) {
+    float gl[MIX_LANES];
+    float rl[MIX_LANES];
+    float cl[MIX_LANES];
+    for (int i = 0; i < MIX_LANES; i++) {
+        gl[i] = g + dg * (float)i;
+        rl[i] = r + dr * (float)i;
+        cl[i] = c + dc * (float)i;
+    }
+    const float gs = dg * MIX_LANES;
+    const float rs = dr * MIX_LANES;
+    const float cs = dc * MIX_LANES;
+    for (int j = 0; j < n; j += MIX_LANES) {
+        float* __restrict o = out + j;
+        const float* __restrict rv = rev + j;
+        const float* __restrict ch = chorus + j;
+        for (int i = 0; i < MIX_LANES; i++) {
+            o[i] = gl[i] * (o[i] + rl[i] * rv[i] + cl[i] * ch[i]);
+            gl[i] += gs;
+            rl[i] += rs;
+            cl[i] += cs;
+        }
+    }
+}
+
+static inline float energy(const float *buf, int n) {
+    float e = 0.0f;
+    for (int i = 0; i < n; i++) e += buf[i] * buf[i];
+    return e;
+}
+
+// when no voice is active and the output stayed below the silence
+// level for the reverb and chorus tail, fluidsynth is skipped until
+// the next note on, or a change which could make it sound again
 int XSynth::synth_process(int count, float *outl, float *outr) {
     if (!synth) return -1;
+    if (wake.load(std::memory_order_acquire) && wake.exchange(false, std::memory_order_acq_rel)) {
+        silent = false;
+        quiet_frames = 0;
+    }
+#if USE_FX_BUFFERS
+    // the gain and the fx return levels are set here, a ramp to a new
+    // target is rendered
+    if (silent && (gain_ramp.target != (float)volume_level ||
+            reverb_ramp.target != (float)reverb_level ||
+            chorus_ramp.target != (float)chorus_level)) {
+        silent = false;
+        quiet_frames = 0;
+    }
+#endif
+    if (silent) {
+        memset(outl, 0, count * sizeof(float));
+        memset(outr, 0, count * sizeof(float));
+        return FLUID_OK;
+    }
+    const int ret = render(count, outl, outr);
+    int active = 0;
+    const int n_parts = part_count.load(std::memory_order_acquire);
+    for (int p = 0; p < n_parts; p++) {
+        active += fluid_synth_get_active_voice_count(parts[p].synth);
+    }
+    if (ret == FLUID_OK && !active &&
+            energy(outl, count) + energy(outr, count) < SILENCE_ENERGY * count) {
+        quiet_frames += count;
+        if (quiet_frames >= (unsigned int)(FX_TAIL_SECONDS * sample_rate)) silent = true;
+    } else {
+        quiet_frames = 0;
+    }
+    return ret;
+}
+
+static inline void add_to(float* __restrict out, const float* __restrict in, int n) {
+    for (int i = 0; i < n; i++) out[i] += in[i];
+}
+
+// render the next job_frames on partition index, the main synth render
+// straight to the output and the fx buffer. With channel metering each
+// MIDI channel come in it's own pair, metered on the partition owning
+// it and mixed down here.
+void XSynth::render_partition(int index) {
+    Partition& part = parts[index];
+    const int n = job_frames;
+    const int len = (int)block_length;
+    float *dry[2];
+    float *fx[4];
+    if (index) {
+        float *buf = part.buffer.data();
+        memset(buf, 0, 6 * len * sizeof(float));
+        dry[0] = buf;
+        dry[1] = buf + len;
+        for (int i = 0; i < 4; i++) fx[i] = buf + (2 + i) * len;
+    } else {
+        dry[0] = job_out[0];
+        dry[1] = job_out[1];
+        memset(dry[0], 0, n * sizeof(float));
+        memset(dry[1], 0, n * sizeof(float));
+        memset(fx_buffer.data(), 0, 4 * len * sizeof(float));
+        for (int i = 0; i < 4; i++) fx[i] = fx_buffer.data() + i * len;
+    }
+    if (!channel_meter) {
+        part.ret = fluid_synth_process(part.synth, n, 4, fx, 2, dry);
+        return;
+    }
+    float *groups[32];
+    float *buf = part.channels.data();
+    memset(buf, 0, 32 * len * sizeof(float));
+    for (int i = 0; i < 32; i++) groups[i] = buf + i * len;
+    part.ret = fluid_synth_process(part.synth, n, 4, fx, 32, groups);
+    for (int c = 0; c < 16; c++) {
+        add_to(dry[0], groups[2 * c], n);
+        add_to(dry[1], groups[2 * c + 1], n);
+        if (owner(c) == index) channel_levels.add(c, groups[2 * c], groups[2 * c + 1], n);
+    }
+}
+
+void XSynth::render_job(void* data, int index) {
+    static_cast<XSynth*>(data)->render_partition(index);
+}
+
+int XSynth::render(int count, float *outl, float *outr) {
+#if !USE_FX_BUFFERS
     return fluid_synth_write_float(synth,count, outl, 0, 1, outr, 0, 1);
+#else
+    const int time = (int)(smooth_time * 0.001 * sample_rate);
+    const int len = (int)block_length;
+    float *rev_l = fx_buffer.data();
+    float *rev_r = rev_l + len;
+    float *chorus_l = rev_r + len;
+    float *chorus_r = chorus_l + len;
+    const int n_parts = part_count.load(std::memory_order_acquire);
+    const int jobs = std::min(n_parts, pool.size() + 1);
+    int ret = FLUID_OK;
+    for (int pos = 0; pos < count; pos += len) {
+        const int n = std::min(count - pos, len);
+        float *dry[2] = {outl + pos, outr + pos};
+        job_frames = n;
+        job_out[0] = dry[0];
+        job_out[1] = dry[1];
+        // the partitions render in parallel, the pool return when all are done
+        if (jobs > 1) pool.run(jobs);
+        else render_partition(0);
+        for (int p = jobs; p < n_parts; p++) render_partition(p);
+        ret = parts[0].ret;
+        for (int p = 1; p < n_parts; p++) {
+            const float *buf = parts[p].buffer.data();
+            if (parts[p].ret != FLUID_OK) ret = parts[p].ret;
+            add_to(dry[0], buf, n);
+            add_to(dry[1], buf + len, n);
+            add_to(rev_l, buf + 2 * len, n);
+            add_to(rev_r, buf + 3 * len, n);
+            add_to(chorus_l, buf + 4 * len, n);
+            add_to(chorus_r, buf + 5 * len, n);
+        }
+        if (ret != FLUID_OK) break;
+
+        const float g = gain_ramp.current;
+        const float r = reverb_ramp.current;
+        const float c = chorus_ramp.current;
+        const float dg = (gain_ramp.next((float)volume_level, n, time, smooth_mode) - g) / n;
+        const float dr = (reverb_ramp.next((float)reverb_level, n, time, smooth_mode) - r) / n;
+        const float dc = (chorus_ramp.next((float)chorus_level, n, time, smooth_mode) - c) / n;
+        if (!(n % MIX_LANES)) {
+            mix_fx16(dry[0], rev_l, chorus_l, n, g, dg, r, dr, c, dc);
+            mix_fx16(dry[1], rev_r, chorus_r, n, g, dg, r, dr, c, dc);
+        } else {
+            mix_fx(dry[0], rev_l, chorus_l, n, g, dg, r, dr, c, dc);
+            mix_fx(dry[1], rev_r, chorus_r, n, g, dg, r, dr, c, dc);
+        }
+    }
+    return ret;
+#endif
 }
 
-int XSynth::load_soundfont(const char *path) {
+static size_t page_size() {
+#ifndef _WIN32
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+#else
+    return 4096;
+#endif
+}
+
+// the whole pages inside a sample block. The block is heap memory of
+// fluidsynth, the pages it share with other data are left alone.
+static bool inner_pages(const SampleBlock& b, uintptr_t& start, uintptr_t& end) {
+    const uintptr_t page = page_size();
+    start = ((uintptr_t)b.data + page - 1) & ~(page - 1);
+    end = ((uintptr_t)b.data + b.size) & ~(page - 1);
+    return end > start;
+}
+
+/****************************************************************
+ ** file callbacks for the soundfont loader
+ **
+ ** the same as the default ones, but remember where fluidsynth
+ ** read the sample data to, so that we could prefault it later.
+ ** Only a read of a whole sample chunk is kept, that's the sample
+ ** store of the loaded font, freed when the font is unloaded.
+ ** Samples read one by one (SF3 data decoded from a temporary
+ ** buffer, dynamic sample loading) live in memory fluidsynth
+ ** doesn't show us, fluid_sample_t is opaque.
+ */
+
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+#if FLUIDSYNTH_VERSION_MAJOR > 2 || FLUIDSYNTH_VERSION_MINOR >= 2
+typedef fluid_long_long_t sf_count_t;
+typedef fluid_long_long_t sf_offset_t;
+#else
+typedef int sf_count_t;
+typedef long sf_offset_t;
+#endif
+
+// the font loaded on this thread
+static thread_local SoundFont* loading_font = NULL;
+static thread_local LoadProgress* loading_progress = NULL;
+
+static void* sf_open(const char *path) {
+    FILE *fp = fopen(path, "rb");
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (fp) posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return fp;
+}
+
+static int sf_read(void *buf, sf_count_t count, void *handle) {
+    FILE *fp = (FILE*)handle;
+    const long pos = ftell(fp);
+    if (fread(buf, 1, count, fp) != (size_t)count) return FLUID_FAILED;
+    if (LoadProgress *p = loading_progress) {
+        if (p->cancel.load(std::memory_order_relaxed)) return FLUID_FAILED;
+        p->bytes.fetch_add(count, std::memory_order_relaxed);
+    }
+    SoundFont *font = loading_font;
+    if (font && !font->dynamic && font->map.smpl_size && !font->map.compressed) {
+        const SF2Map& m = font->map;
+        // the sm24 chunk may carry a pad byte
+        if ((pos == m.smpl_offset && (size_t)count + 1 >= m.smpl_size) ||
+            (m.sm24_size && pos == m.sm24_offset && (size_t)count + 1 >= m.sm24_size)) {
+            font->blocks.push_back(SampleBlock(pos, count, (const char*)buf));
+        }
+    }
+    return FLUID_OK;
+}
+
+static int sf_seek(void *handle, sf_offset_t offset, int origin) {
+    return fseek((FILE*)handle, offset, origin) == 0 ? FLUID_OK : FLUID_FAILED;
+}
+
+static sf_offset_t sf_tell(void *handle) {
+    return ftell((FILE*)handle);
+}
+
+static int sf_close(void *handle) {
+    return fclose((FILE*)handle) == 0 ? FLUID_OK : FLUID_FAILED;
+}
+#endif
+
+/****************************************************************
+ ** struct Readahead
+ **
+ ** read the sample chunks of a font in slices on a few threads,
+ ** while fluidsynth parse the preset tables. It's one big fread of
+ ** the samples then hit the page cache.
+ */
+
+struct Readahead {
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop;
+    std::atomic<size_t> next;
+    std::vector<std::pair<long, size_t> > slices;
+    Readahead() : stop(false), next(0) {}
+    void start(const char *path, const SF2Map& map);
+    void read(const char *path);
+    void join();
+};
+
+void Readahead::start(const char *path, const SF2Map& map) {
+    const long offset[2] = {map.smpl_offset, map.sm24_offset};
+    const size_t size[2] = {map.smpl_size, map.sm24_size};
+    for (int c = 0; c < 2; c++) {
+        for (size_t pos = 0; pos < size[c]; pos += READAHEAD_SLICE) {
+            slices.push_back(std::make_pair(offset[c] + (long)pos,
+                            std::min((size_t)READAHEAD_SLICE, size[c] - pos)));
+        }
+    }
+    const size_t n = std::min((size_t)READAHEAD_THREADS, slices.size());
+    for (size_t i = 0; i < n; i++) {
+        threads.push_back(std::thread(&Readahead::read, this, path));
+    }
+}
+
+void Readahead::read(const char *path) {
+#ifndef _WIN32
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    std::vector<char> buf(1024 * 1024);
+    size_t i;
+    while (!stop.load(std::memory_order_relaxed) &&
+            (i = next.fetch_add(1, std::memory_order_relaxed)) < slices.size()) {
+        const long offset = slices[i].first;
+        const size_t size = slices[i].second;
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+#endif
+        for (size_t done = 0; done < size && !stop.load(std::memory_order_relaxed);) {
+            const ssize_t r = pread(fd, buf.data(), std::min(buf.size(), size - done), offset + done);
+            if (r <= 0) break;
+            done += r;
+        }
+    }
+    close(fd);
+#endif
+}
+
+void Readahead::join() {
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& t : threads) t.join();
+    threads.clear();
+}
+
+// parse a soundfont on a private synth, so that the API mutex of the
+// running synth isn't hold while loading and several fonts could be
+// loaded in parallel
+void XSynth::load_font_detached(SoundFont& font, LoadProgress* track) {
+    if (track && track->cancel.load(std::memory_order_relaxed)) return;
+    font.map.parse(font.path.data());
+    font.blocks.clear();
+    if (track) track->presets.fetch_add(font.map.presets.size(), std::memory_order_relaxed);
+    font.loader_settings = new_fluid_settings();
+    fluid_settings_setint(font.loader_settings, "synth.polyphony", 1);
+    fluid_settings_setint(font.loader_settings, "synth.reverb.active", 0);
+    fluid_settings_setint(font.loader_settings, "synth.chorus.active", 0);
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    // sample memory get locked by our memory policy
+    fluid_settings_setint(font.loader_settings, "synth.lock-memory", 0);
+    // with a sample budget only the samples of the selected presets are loaded
+    font.dynamic = sample_budget > 0;
+    fluid_settings_setint(font.loader_settings, "synth.dynamic-sample-loading", font.dynamic);
+#endif
+    font.loader = new_fluid_synth(font.loader_settings);
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    if (font.loader) {
+        fluid_sfloader_t *sfloader = new_fluid_defsfloader(font.loader_settings);
+        if (sfloader) {
+            fluid_sfloader_set_callbacks(sfloader, sf_open, sf_read, sf_seek, sf_tell, sf_close);
+            fluid_synth_add_sfloader(font.loader, sfloader);
+        }
+    }
+    loading_font = &font;
+    loading_progress = track;
+#endif
+    Readahead ahead;
+    if (readahead && !font.dynamic && font.map.smpl_size) ahead.start(font.path.data(), font.map);
+    int id = font.loader ? fluid_synth_sfload(font.loader, font.path.data(), 0) : -1;
+    ahead.join();
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    loading_font = NULL;
+    loading_progress = NULL;
+#endif
+    if (id == -1) {
+        unload_font(font);
+        return;
+    }
+    font.sfont = fluid_synth_get_sfont_by_id(font.loader, id);
+    fluid_synth_remove_sfont(font.loader, font.sfont);
+}
+
+// with a track the load report it's progress there and could be cancelled
+void XSynth::load_fonts_parallel(std::vector<SoundFont>& stack,
+                                 const std::vector<size_t>& jobs,
+                                 LoadProgress* track) {
+    if (jobs.empty()) return;
+    if (track) {
+        long long total = 0;
+        for (auto j : jobs) total += std::max(0LL, stack[j].id.size);
+        track->bytes.store(0, std::memory_order_relaxed);
+        track->total.store(total, std::memory_order_relaxed);
+        track->presets.store(0, std::memory_order_relaxed);
+        track->active.store(true, std::memory_order_release);
+    }
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        size_t j;
+        while ((j = next.fetch_add(1)) < jobs.size()) {
+            load_font_detached(stack[jobs[j]], track);
+        }
+    };
+    unsigned int threads = std::max(1U, std::min(4U, std::thread::hardware_concurrency()));
+    threads = std::min(threads, (unsigned int)jobs.size());
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threads; i++) {
+        pool.push_back(std::thread(work));
+    }
+    work();
+    for (auto& t : pool) t.join();
+    if (track) track->active.store(false, std::memory_order_release);
+}
+
+// move a detached loaded soundfont into the running synth
+void XSynth::attach_font(SoundFont& font) {
+    font.sf_id = fluid_synth_add_sfont(synth, font.sfont);
+    if (font.sf_id == -1) {
+        unload_font(font);
+        return;
+    }
+    print_soundfont(font);
+}
+
+void XSynth::unload_font(SoundFont& font, fluid_synth_t* owner) {
+#ifndef _WIN32
+    uintptr_t start, end;
+    for (auto& b : font.blocks) {
+        if (b.locked && inner_pages(b, start, end)) munlock((void*)start, end - start);
+    }
+#endif
+    if (font.sf_id != -1) {
+        fluid_synth_sfunload(owner ? owner : synth, font.sf_id, 0);
+        font.sf_id = -1;
+    } else if (font.sfont && font.loader) {
+        // a detached font, give it back to the loader, which free it on delete
+        fluid_synth_add_sfont(font.loader, font.sfont);
+    }
+    font.sfont = NULL;
+    if (font.loader) {
+        delete_fluid_synth(font.loader);
+        font.loader = NULL;
+    }
+    if (font.loader_settings) {
+        delete_fluid_settings(font.loader_settings);
+        font.loader_settings = NULL;
+    }
+    font.instruments.clear();
+    font.blocks.clear();
+    font.map.clear();
+}
+
+// bytes hashed at the head and the tail of a soundfont file
+#define IDENTITY_SPAN 65536
+
+void FontIdentity::identify(const std::string& file, bool content) {
+#ifndef _WIN32
+    char buf[PATH_MAX];
+    path = realpath(file.data(), buf) ? buf : file;
+#else
+    path = file;
+#endif
+    size = -1;
+    mtime = 0;
+    hash = 0;
+    struct stat st;
+    if (stat(path.data(), &st) != 0) return;
+    size = st.st_size;
+#ifdef __linux__
+    mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    mtime = (long long)st.st_mtime * 1000000000LL;
+#endif
+    if (!content) return;
+    FILE *fp = fopen(path.data(), "rb");
+    if (!fp) return;
+    // FNV-1a
+    std::vector<unsigned char> data(IDENTITY_SPAN);
+    hash = 14695981039346656037ULL;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass && size > IDENTITY_SPAN) fseek(fp, -IDENTITY_SPAN, SEEK_END);
+        else if (pass) break;
+        const size_t n = fread(data.data(), 1, data.size(), fp);
+        for (size_t i = 0; i < n; i++) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    fclose(fp);
+}
+
+// load the soundfont stack in the given order, fonts which are already
+// loaded are kept, all others load in parallel. A font count as loaded
+// when the file is the same, not only the path.
+// When nothing changed the stack stays as it is.
+// Channels using a font which is gone fall back to the default instrument
+// from the first font.
+// The new stack is build aside, the audio thread is hold only while
+// it replace the running one.
+int XSynth::load_font_stack(const std::vector<std::string>& paths) {
     if (!synth) return -1;
-    if (sf_id != -1) fluid_synth_sfunload(synth, sf_id, 0);
-    sf_id = fluid_synth_sfload(synth, path, 0);
-    if (sf_id == -1) {
-        return 1;
+    std::vector<SoundFont> stack(paths.size());
+    std::vector<int> remap(sfonts.size(), -1);
+    std::vector<size_t> jobs;
+    bool unchanged = paths.size() == sfonts.size();
+    for (size_t i = 0; i < paths.size(); i++) {
+        FontIdentity id;
+        id.identify(paths[i], font_hash);
+        for (size_t j = 0; j < sfonts.size(); j++) {
+            if (remap[j] == -1 && reusable(sfonts[j], id)) {
+                stack[i] = sfonts[j];
+                stack[i].path = paths[i];
+                remap[j] = i;
+                break;
+            }
+        }
+        for (auto& f : standby) {
+            if (stack[i].sf_id == -1 && !stack[i].sfont && f.sfont && reusable(f, id)) {
+                stack[i] = f;
+                f = SoundFont();
+            }
+        }
+        if (stack[i].sf_id == -1 && !stack[i].sfont) {
+            stack[i].path = paths[i];
+            jobs.push_back(i);
+        }
+        stack[i].id = id;
+        if (i >= remap.size() || remap[i] != (int)i) unchanged = false;
+    }
+    for (auto& f : standby) unload_font(f);
+    standby.clear();
+    if (progress.cancel.load(std::memory_order_acquire)) {
+        for (auto& f : stack) if (f.sf_id == -1) unload_font(f);
+        return LOAD_CANCELLED;
+    }
+    if (unchanged) {
+        for (size_t i = 0; i < paths.size(); i++) sfonts[i].path = paths[i];
+        return paths.empty() ? 1 : 0;
+    }
+    load_fonts_parallel(stack, jobs, &progress);
+    // a newer request is waiting, keep the running stack
+    if (progress.cancel.load(std::memory_order_acquire)) {
+        for (auto& f : stack) if (f.sf_id == -1) unload_font(f);
+        return LOAD_CANCELLED;
+    }
+
+    hold(true);
+    // the partitions play the old stack, they leave the render loop
+    const int count = stop_partitions();
+    for (size_t j = 0; j < sfonts.size(); j++) {
+        if (remap[j] == -1) unload_font(sfonts[j]);
+    }
+
+    std::vector<int> slot(stack.size(), -1);
+    std::vector<SoundFont> loaded;
+    for (size_t i = 0; i < stack.size(); i++) {
+        if (stack[i].sf_id == -1 && stack[i].sfont) attach_font(stack[i]);
+        if (stack[i].sf_id != -1) {
+            slot[i] = loaded.size();
+            loaded.push_back(stack[i]);
+        }
+    }
+    sfonts.swap(loaded);
+    rebuild_instruments();
+
+    for (int i = 0; i < 16; i++) {
+        const int f = channel_font[i];
+        if (f >= 0 && f < (int)remap.size() && remap[f] != -1 && slot[remap[f]] != -1) {
+            channel_font[i] = slot[remap[f]];
+        } else {
+            channel_font[i] = 0;
+            set_default_instrument(i);
+        }
     }
     if (reverb_on) set_reverb_on(reverb_on);
     if (chorus_on) set_chorus_on(chorus_on);
-    print_soundfont();
-    return 0;
+    hold(false);
+    sync_partitions(count);
+    return (paths.empty() || slot[0] == -1) ? 1 : 0;
 }
 
-void XSynth::print_soundfont() {
-    instruments.clear();
-    fluid_sfont_t * sfont = fluid_synth_get_sfont_by_id(synth, sf_id);
-    int offset = fluid_synth_get_bank_offset(synth, sf_id);
+// parse the fonts of a stack which aren't loaded yet on there loader
+// synths, while the running synth keep on playing. The next
+// load_font_stack() take them from there.
+void XSynth::prepare_font_stack(const std::vector<std::string>& paths) {
+    std::vector<size_t> jobs;
+    for (auto& path : paths) {
+        FontIdentity id;
+        id.identify(path, font_hash);
+        bool loaded = false;
+        for (auto& f : sfonts) if (reusable(f, id)) loaded = true;
+        for (auto& f : standby) if (reusable(f, id)) loaded = true;
+        if (loaded) continue;
+        standby.push_back(SoundFont());
+        standby.back().path = path;
+        standby.back().id = id;
+        jobs.push_back(standby.size() - 1);
+    }
+    load_fonts_parallel(standby, jobs, &progress);
+}
+
+// a loaded font could be kept when it's the same file, loaded for the
+// current sample budget mode
+bool XSynth::reusable(const SoundFont& font, const FontIdentity& id) const {
+    return font.dynamic == (sample_budget > 0) && font.id.same(id);
+}
+
+// switching between dynamic sample loading and loading all samples
+// reload the stack, the channels keep there fonts and instruments.
+// With reload false the next load_font_stack() do it, it only keep
+// the fonts loaded in the new mode. Returns 1 when the stack was reloaded.
+int XSynth::set_sample_budget(int mb, bool reload) {
+    sample_budget = std::max(0, mb);
+    budget_refused = 0;
+    late_notes = 0;
+    bool stale = false;
+    for (auto& f : sfonts) {
+        if (f.dynamic != (sample_budget > 0)) stale = true;
+    }
+    if (!reload || !stale) return 0;
+    std::vector<std::string> paths;
+    for (auto& f : sfonts) paths.push_back(f.path);
+    int fonts[16];
+    int instrument[16];
+    for (int i = 0; i < 16; i++) {
+        fonts[i] = channel_font[i];
+        instrument[i] = get_instrument_for_channel(i);
+    }
+    progress.cancel.store(false, std::memory_order_release);
+    if (load_font_stack(paths) != 0) return 1;
+    for (int i = 0; i < 16; i++) {
+        if (fonts[i] < (int)sfonts.size()) channel_font[i] = fonts[i];
+        set_instrument_on_channel(i, instrument[i]);
+    }
+    return 1;
+}
+
+// replace the first soundfont in the stack
+int XSynth::load_soundfont(const char *path) {
+    if (!synth) return -1;
+    std::vector<std::string> paths;
+    for (auto& f : sfonts) paths.push_back(f.path);
+    if (paths.empty()) paths.push_back(path);
+    else paths[0] = path;
+    return load_font_stack(paths);
+}
+
+// use a (new) soundfont on a single channel, the other channels
+// keep there fonts untouched
+int XSynth::load_soundfont_on_channel(int channel, const char *path) {
+    if (!synth) return -1;
+    if (channel < 0 || channel > 15) return 1;
+    std::vector<std::string> paths;
+    for (auto& f : sfonts) paths.push_back(f.path);
+    if (std::find(paths.begin(), paths.end(), path) == paths.end()) {
+        const int old = channel_font[channel];
+        bool shared = (old == 0);
+        for (int i = 0; i < 16; i++) {
+            if (i != channel && channel_font[i] == old) shared = true;
+        }
+        if (!shared && old < (int)paths.size()) paths[old] = path;
+        else paths.push_back(path);
+        load_font_stack(paths);
+    }
+    for (size_t i = 0; i < sfonts.size(); i++) {
+        if (sfonts[i].path == path) {
+            channel_font[channel] = i;
+            set_default_instrument(channel);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void XSynth::print_soundfont(SoundFont& font) {
+    font.instruments.clear();
+    fluid_sfont_t * sfont = fluid_synth_get_sfont_by_id(synth, font.sf_id);
+    int offset = fluid_synth_get_bank_offset(synth, font.sf_id);
 
     if(sfont == NULL) {
         fprintf(stderr, "inst: invalid font number\n");
@@ -359,7 +1220,7 @@ void XSynth::print_soundfont() {
         char inst[100];
         snprintf(inst, 100, "%03d %03d %s", preset.get_banknum(&preset) + offset,
                         preset.get_num(&preset),preset.get_name(&preset));
-        instruments.push_back(inst);
+        font.instruments.push_back(inst);
     }
 #else
     fluid_preset_t *preset;
@@ -369,50 +1230,80 @@ void XSynth::print_soundfont() {
         char inst[100];
         snprintf(inst, 100, "%03d %03d %s", fluid_preset_get_banknum(preset) + offset,
                         fluid_preset_get_num(preset),fluid_preset_get_name(preset));
-        instruments.push_back(inst);
+        font.instruments.push_back(inst);
     }
 #endif
-    set_default_instruments();
+}
+
+// the instrument list is the merged list from all fonts in the stack
+void XSynth::rebuild_instruments() {
+    instruments.clear();
+    instrument_font.clear();
+    for (size_t i = 0; i < sfonts.size(); i++) {
+        sfonts[i].first = instruments.size();
+        instruments.insert(instruments.end(), sfonts[i].instruments.begin(),
+                                                sfonts[i].instruments.end());
+        instrument_font.insert(instrument_font.end(), sfonts[i].instruments.size(), i);
+    }
 }
 
 void XSynth::set_default_instruments() {
-    int bank = 0;
-    int program = 0;
-    for (unsigned int i = 0; i < 16; i++) {
-        if (i >= instruments.size()) break;
-        if ((unsigned int)channel_instrument[i] > instruments.size()) continue;
-        if (i == 9) { // set standard kit on channel 10
-            if (check_instrument(128, 000)) {
-                fluid_synth_program_select (synth, i, sf_id, 128, 000);
-                channel_banks[i] = 128;
-            }
-        } else {
-            std::istringstream buf(instruments[channel_instrument[i]]);
-            buf >> bank;
-            buf >> program;
-            fluid_synth_program_select (synth, i, sf_id, bank, program);
-            channel_banks[i] = bank;
+    for (int i = 0; i < 16; i++) {
+        set_default_instrument(i);
+    }
+}
+
+void XSynth::set_default_instrument(int channel) {
+    if (channel_font[channel] >= (int)sfonts.size()) return;
+    const int font = channel_font[channel];
+    SoundFont& f = sfonts[font];
+    if (channel >= (int)f.instruments.size()) return;
+    if ((unsigned int)channel_instrument[channel] >= f.instruments.size()) return;
+    if (channel == 9) { // set standard kit on channel 10
+        if (check_instrument(font, 128, 000)) {
+            program_select(channel, font, 128, 000);
+            channel_banks[channel] = 128;
         }
+    } else {
+        int bank = 0;
+        int program = 0;
+        std::istringstream buf(f.instruments[channel_instrument[channel]]);
+        buf >> bank;
+        buf >> program;
+        program_select(channel, font, bank, program);
+        channel_banks[channel] = bank;
     }
 }
 
 int XSynth::set_instrument_on_channel(int channel, int i) {
-    if (i >= (int)instruments.size()) return 1;
-    if (channel >15) channel = 0;
+    if (i < 0 || i >= (int)instruments.size()) return 1;
+    if (channel < 0 || channel > 15) return 1;
+    const int font = instrument_font[i];
     int bank = 0;
     int program = 0;
     std::istringstream buf(instruments[i]);
     buf >> bank;
     buf >> program;
     channel_banks[channel] = bank;
-    return fluid_synth_program_select (synth, channel, sf_id, bank, program);
+    channel_font[channel] = font;
+    return program_select(channel, font, bank, program);
 }
 
 int XSynth::get_instrument_for_channel(int channel) {
     if (!synth) return 0;
-    if (channel >15) channel = 0;
+    if (channel < 0 || channel > 15) return 0;
     fluid_preset_t *preset = fluid_synth_get_channel_preset(synth, channel);
     if (!preset) return 0;
+#if FLUIDSYNTH_VERSION_MAJOR < 2
+    const int sf_id = preset->sfont->id;
+#else
+    const int sf_id = fluid_sfont_get_id(fluid_preset_get_sfont(preset));
+#endif
+    int font = -1;
+    for (size_t i = 0; i < sfonts.size(); i++) {
+        if (sfonts[i].sf_id == sf_id) font = i;
+    }
+    if (font == -1) return 0;
     int offset = fluid_synth_get_bank_offset(synth, sf_id);
     char inst[100];
 #if FLUIDSYNTH_VERSION_MAJOR < 2
@@ -422,10 +1313,10 @@ int XSynth::get_instrument_for_channel(int channel) {
     snprintf(inst, 100, "%03d %03d %s", fluid_preset_get_banknum(preset) + offset,
                         fluid_preset_get_num(preset),fluid_preset_get_name(preset));
 #endif
-    std::string name = inst;
-    int ret = 0;
-    for(std::vector<std::string>::const_iterator i = instruments.begin(); i != instruments.end(); ++i) {
-        if ((*i).find(name) != std::string::npos) {
+    int ret = sfonts[font].first;
+    for(std::vector<std::string>::const_iterator i = sfonts[font].instruments.begin();
+                                        i != sfonts[font].instruments.end(); ++i) {
+        if ((*i).find(inst) != std::string::npos) {
             return ret;
         }
         ret++;
@@ -433,25 +1324,522 @@ int XSynth::get_instrument_for_channel(int channel) {
     return 0;
 }
 
+// find font, bank and program for a entry in the instrument list
+bool XSynth::get_preset_ref(int instrument, PresetRef& ref) {
+    if (instrument < 0 || instrument >= (int)instruments.size()) return false;
+    if (instrument >= (int)instrument_font.size()) return false;
+    ref.font = instrument_font[instrument];
+    if (sscanf(instruments[instrument].data(), "%d %d", &ref.bank, &ref.program) != 2)
+        return false;
+    ref.bank -= fluid_synth_get_bank_offset(synth, sfonts[ref.font].sf_id);
+    return true;
+}
+
+// advise the kernel that we need the memory soon and read one byte
+// from each page, so that the audio thread wouldn't hit a page fault
+static size_t touch_memory(const char* data, size_t size) {
+    const uintptr_t page = page_size();
+    const uintptr_t start = (uintptr_t)data & ~(page - 1);
+    const uintptr_t end = ((uintptr_t)data + size + page - 1) & ~(page - 1);
+#ifndef _WIN32
+    madvise((void*)start, end - start, MADV_WILLNEED);
+#endif
+    volatile char sink = data[0];
+    for (uintptr_t p = start + page; p < (uintptr_t)data + size; p += page) {
+        sink = *(const char*)p;
+    }
+    (void)sink;
+    return size;
+}
+
+// prefault the sample data used by a preset, returns the bytes touched
+size_t XSynth::prefault_preset(const PresetRef& ref) {
+    if (ref.font < 0 || ref.font >= (int)sfonts.size()) return 0;
+    const SoundFont& font = sfonts[ref.font];
+    const PresetSamples* preset = font.map.find_preset(ref.bank, ref.program);
+    if (!preset) return 0;
+    std::vector<SampleSpan> spans;
+    font.map.get_spans(*preset, spans);
+    size_t touched = 0;
+    for (auto& span : spans) {
+        for (auto& b : font.blocks) {
+            const long start = std::max(span.offset, b.offset);
+            const long end = std::min(span.offset + (long)span.size, b.offset + (long)b.size);
+            if (start < end) touched += touch_memory(b.data + (start - b.offset), end - start);
+        }
+    }
+    return touched;
+}
+
+// font, bank and program selected on a channel
+bool XSynth::get_channel_preset(int channel, PresetRef& ref) {
+    int sf_id = -1;
+    if (!synth || fluid_synth_get_program(synth, channel, &sf_id, &ref.bank, &ref.program) != FLUID_OK)
+        return false;
+    ref.font = -1;
+    for (size_t i = 0; i < sfonts.size(); i++) {
+        if (sfonts[i].sf_id == sf_id) ref.font = i;
+    }
+    return ref.font >= 0;
+}
+
+// sample data of the presets selected on the channels, with ref
+// selected on channel instead. Samples shared by presets count once.
+size_t XSynth::selected_bytes(int channel, const PresetRef* ref) {
+    if (!synth) return 0;
+    std::vector<PresetRef> refs;
+    PresetRef r;
+    for (int c = 0; c < 16; c++) {
+        if (c == channel && ref) refs.push_back(*ref);
+        else if (get_channel_preset(c, r)) refs.push_back(r);
+    }
+    return presets_bytes(refs);
+}
+
+// part of a sample span in RAM, counted page by page in the blocks
+static size_t span_resident(const SoundFont& font, const SampleSpan& span) {
+    size_t resident = 0;
+#ifndef _WIN32
+    const uintptr_t page = page_size();
+    std::vector<unsigned char> vec;
+    for (auto& b : font.blocks) {
+        const long start = std::max(span.offset, b.offset);
+        const long end = std::min(span.offset + (long)span.size, b.offset + (long)b.size);
+        if (start >= end) continue;
+        const uintptr_t first = (uintptr_t)(b.data + (start - b.offset));
+        const uintptr_t last = (uintptr_t)(b.data + (end - b.offset));
+        const uintptr_t base = first & ~(page - 1);
+        vec.resize((last - base + page - 1) / page);
+        if (mincore((void*)base, last - base, vec.data()) != 0) continue;
+        for (size_t i = 0; i < vec.size(); i++) {
+            if (!(vec[i] & 1)) continue;
+            const uintptr_t p = base + i * page;
+            resident += std::min(p + page, last) - std::max(p, first);
+        }
+    }
+#endif
+    return resident;
+}
+
+// sample data of a list of presets, samples shared by presets count once
+size_t XSynth::presets_bytes(const std::vector<PresetRef>& refs, size_t* resident) {
+    std::set<std::pair<int, long> > seen;
+    std::vector<SampleSpan> spans;
+    size_t bytes = 0;
+    if (resident) *resident = 0;
+    for (auto& r : refs) {
+        if (r.font < 0 || r.font >= (int)sfonts.size()) continue;
+        const SoundFont& font = sfonts[r.font];
+        const PresetSamples* preset = font.map.find_preset(r.bank, r.program);
+        if (!preset) continue;
+        spans.clear();
+        font.map.get_spans(*preset, spans);
+        for (auto& span : spans) {
+            if (!seen.insert(std::make_pair(r.font, span.offset)).second) continue;
+            bytes += span.size;
+            if (resident) *resident += span_resident(font, span);
+        }
+    }
+    return bytes;
+}
+
+// sample bytes per preset of the instrument list, per bank, and of
+// the presets selected on the channels
+void XSynth::get_footprint(Footprint& fp) {
+    fp.presets.assign(instruments.size(), PresetFootprint());
+    fp.banks.clear();
+    fp.total = 0;
+    for (auto& font : sfonts) fp.total += font.map.smpl_size + font.map.sm24_size;
+    std::map<std::pair<int, int>, std::vector<PresetRef> > banks;
+    std::vector<PresetRef> one(1);
+    for (size_t i = 0; i < instruments.size(); i++) {
+        if (!get_preset_ref(i, one[0])) continue;
+        fp.presets[i].bytes = presets_bytes(one, &fp.presets[i].resident);
+        int shown = 0;
+        sscanf(instruments[i].data(), "%d", &shown);
+        banks[std::make_pair(one[0].font, shown)].push_back(one[0]);
+    }
+    for (auto& b : banks) {
+        BankFootprint bank;
+        bank.font = b.first.first;
+        bank.bank = b.first.second;
+        bank.bytes = presets_bytes(b.second, &bank.resident);
+        fp.banks.push_back(bank);
+    }
+    get_assigned_footprint(fp);
+}
+
+// only the presets selected on the channels, they change with every
+// program change while the rest change with the soundfont stack
+void XSynth::get_assigned_footprint(Footprint& fp) {
+    std::vector<PresetRef> assigned;
+    PresetRef r;
+    for (int c = 0; c < 16; c++) {
+        if (get_channel_preset(c, r)) assigned.push_back(r);
+    }
+    fp.assigned = presets_bytes(assigned, &fp.assigned_resident);
+}
+
+// bytes of sample data currently in RAM
+size_t XSynth::resident_bytes() {
+    size_t resident = 0;
+#ifndef _WIN32
+    const uintptr_t page = page_size();
+    std::vector<unsigned char> vec;
+    for (auto& font : sfonts) {
+        for (auto& b : font.blocks) {
+            const uintptr_t start = (uintptr_t)b.data & ~(page - 1);
+            const uintptr_t end = ((uintptr_t)b.data + b.size + page - 1) & ~(page - 1);
+            vec.resize((end - start) / page);
+            if (mincore((void*)start, end - start, vec.data()) != 0) continue;
+            for (auto v : vec) if (v & 1) resident += page;
+        }
+    }
+#endif
+    return resident;
+}
+
+#if !defined(_WIN32) && defined(MADV_PAGEOUT)
+// the sample blocks are anonymous memory, the kernel could only page
+// them out to swap
+static bool swap_available() {
+#ifdef __linux__
+    struct sysinfo info;
+    return sysinfo(&info) == 0 && info.totalswap > 0;
+#else
+    return true;
+#endif
+}
+
+// bytes in RAM of a page aligned range
+static size_t pages_resident(uintptr_t first, uintptr_t last, std::vector<unsigned char>& vec) {
+    const uintptr_t page = page_size();
+    vec.resize((last - first) / page);
+    if (mincore((void*)first, last - first, vec.data()) != 0) return 0;
+    size_t resident = 0;
+    for (auto v : vec) if (v & 1) resident += page;
+    return resident;
+}
+#endif
+
+// give the pages of a sample span back to the kernel. Only whole pages
+// inside the span go, the data stay valid and fault back in from swap
+// when a voice read them again. That fault happen on the audio thread,
+// unless the prefault pass for a newly selected preset was first. The
+// kernel could keep pages it can't reclaim, what left RAM is counted
+// with mincore() afterwards.
+size_t XSynth::release_span(SoundFont& font, const SampleSpan& span) {
+    size_t released = 0;
+#if !defined(_WIN32) && defined(MADV_PAGEOUT)
+    const uintptr_t page = page_size();
+    std::vector<unsigned char> vec;
+    for (auto& b : font.blocks) {
+        const long start = std::max(span.offset, b.offset);
+        const long end = std::min(span.offset + (long)span.size, b.offset + (long)b.size);
+        if (start >= end) continue;
+        const uintptr_t first = ((uintptr_t)(b.data + (start - b.offset)) + page - 1) & ~(page - 1);
+        const uintptr_t last = (uintptr_t)(b.data + (end - b.offset)) & ~(page - 1);
+        if (first >= last) continue;
+        const size_t before = pages_resident(first, last, vec);
+        if (!before || madvise((void*)first, last - first, MADV_PAGEOUT) != 0) continue;
+        const size_t after = pages_resident(first, last, vec);
+        if (before > after) released += before - after;
+    }
+#endif
+    return released;
+}
+
+// release the sample data of presets no channel selected for idle
+// seconds, and no playing voice could still read. The audio thread
+// answer with a snapshot of the playing voices at the next block
+// boundary, wait is false when we run on the audio thread ourself.
+// Locked memory stay as it is, so this do nothing with the default
+// MEMORY_LOCK policy, and without swap nothing could be paged out. With
+// dynamic sample loading there are no blocks, fluidsynth free the
+// samples of unselected presets then.
+size_t XSynth::release_idle_samples(double idle, bool wait) {
+    if (!synth || idle <= 0.0 || (memory_policy.load(std::memory_order_acquire) & MEMORY_LOCK))
+        return 0;
+#if !defined(_WIN32) && defined(MADV_PAGEOUT)
+    if (!swap_available()) return 0;
+#else
+    return 0;
+#endif
+    const double now = std::chrono::duration<double>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    PresetRef cur[16];
+    bool has[16];
+    for (int c = 0; c < 16; c++) has[c] = get_channel_preset(c, cur[c]);
+
+    // the playing voices, taken after the channels were read
+    size_t polyphony = 0;
+    for (int e = 0; e < engines; e++) polyphony += fluid_synth_get_polyphony(parts[e].synth);
+    voice_list.resize(polyphony + 1);
+    snapshot.state.store(SNAPSHOT_WANTED, std::memory_order_release);
+    if (wait) {
+        for (int i = 0; i < 1000; i++) {
+            if (snapshot.state.load(std::memory_order_acquire) == SNAPSHOT_TAKEN) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    } else {
+        snapshot_voices();
+    }
+    int expected = SNAPSHOT_WANTED;
+    if (snapshot.state.compare_exchange_strong(expected, SNAPSHOT_IDLE, std::memory_order_acq_rel))
+        return 0;
+    // the audio thread is just at it
+    while (snapshot.state.load(std::memory_order_acquire) != SNAPSHOT_TAKEN)
+        std::this_thread::yield();
+    snapshot.state.store(SNAPSHOT_IDLE, std::memory_order_release);
+    if (!snapshot.complete) return 0;
+    // a program change since the channels were read, the preset is
+    // assigned even when no voice played it yet
+    PresetRef now_cur[16];
+    bool now_has[16];
+    for (int c = 0; c < 16; c++) now_has[c] = get_channel_preset(c, now_cur[c]);
+
+    std::vector<SampleSpan> spans;
+    size_t released = 0;
+    for (size_t f = 0; f < sfonts.size(); f++) {
+        SoundFont& font = sfonts[f];
+        const std::vector<PresetSamples>& presets = font.map.presets;
+        if (font.use.size() != presets.size()) font.use.assign(presets.size(), PresetUse(now));
+        std::set<long> keep;
+        std::vector<size_t> unused;
+        for (size_t i = 0; i < presets.size(); i++) {
+            PresetUse& u = font.use[i];
+            bool selected = false;
+            for (int c = 0; c < 16; c++) {
+                const bool here = has[c] && cur[c].font == (int)f &&
+                    cur[c].bank == presets[i].bank && cur[c].program == presets[i].program;
+                if (here) {
+                    selected = true;
+                    u.channels |= 1 << c;
+                    u.left[c] = ~0u;
+                    continue;
+                }
+                if (now_has[c] && now_cur[c].font == (int)f &&
+                        now_cur[c].bank == presets[i].bank &&
+                        now_cur[c].program == presets[i].program) selected = true;
+                if (!(u.channels & (1 << c))) continue;
+                if (u.left[c] == ~0u) u.left[c] = snapshot.newest[c];
+                // the voices started before the preset left are gone
+                if (snapshot.oldest[c] > u.left[c]) u.channels &= ~(1 << c);
+            }
+            if (selected) u.last = now;
+            if (selected || u.channels || now - u.last < idle) {
+                spans.clear();
+                font.map.get_spans(presets[i], spans);
+                for (auto& span : spans) {
+                    keep.insert(span.offset);
+                    font.released.erase(span.offset);
+                }
+            } else {
+                unused.push_back(i);
+            }
+        }
+        for (auto i : unused) {
+            spans.clear();
+            font.map.get_spans(presets[i], spans);
+            for (auto& span : spans) {
+                if (keep.count(span.offset) || font.released.count(span.offset)) continue;
+                released += release_span(font, span);
+                font.released.insert(span.offset);
+            }
+        }
+    }
+    return released;
+}
+
+// answer a snapshot request, called by the audio thread at a block boundary
+void XSynth::snapshot_voices() {
+    int expected = SNAPSHOT_WANTED;
+    if (!snapshot.state.compare_exchange_strong(expected, SNAPSHOT_BUSY, std::memory_order_acq_rel))
+        return;
+    for (int c = 0; c < 16; c++) snapshot.oldest[c] = ~0u;
+    snapshot.complete = true;
+#if FLUIDSYNTH_VERSION_MAJOR >= 2
+    const int size = (int)voice_list.size();
+    const int count = part_count.load(std::memory_order_acquire);
+    for (int e = 0; e < count; e++) {
+        fluid_synth_get_voicelist(parts[e].synth, voice_list.data(), size, -1);
+        int n = 0;
+        for (; n < size && voice_list[n]; n++) {
+            const int c = fluid_voice_get_channel(voice_list[n]);
+            if (c < 0 || c > 15) continue;
+            const unsigned int id = fluid_voice_get_id(voice_list[n]);
+            snapshot.oldest[c] = std::min(snapshot.oldest[c], id);
+            snapshot.newest[c] = std::max(snapshot.newest[c], id);
+        }
+        if (n == size) snapshot.complete = false;
+    }
+#else
+    // no voice list before fluidsynth 2, nothing get released
+    snapshot.complete = false;
+#endif
+    snapshot.state.store(SNAPSHOT_TAKEN, std::memory_order_release);
+}
+
+#ifndef _WIN32
+// bytes we could still lock before hitting RLIMIT_MEMLOCK
+static size_t memlock_budget() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) != 0) return 0;
+    if (rl.rlim_cur == RLIM_INFINITY) return (size_t)-1;
+    size_t locked = 0;
+#ifdef __linux__
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (fp) {
+        char line[128];
+        while (fgets(line, sizeof(line), fp)) {
+            unsigned long kb = 0;
+            if (sscanf(line, "VmLck: %lu kB", &kb) == 1) {
+                locked = (size_t)kb * 1024;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+#endif
+    return rl.rlim_cur > locked ? rl.rlim_cur - locked : 0;
+}
+#endif
+
+#if defined(__linux__) && defined(SYS_mbind)
+#define MPOL_DEFAULT_ 0
+#define MPOL_PREFERRED_ 1
+#define MPOL_MF_MOVE_ (1<<1)
+
+// number of the NUMA node the cpu belongs to, -1 when unknown
+int XSynth::get_cpu_node(int cpu) {
+    if (cpu < 0) return -1;
+    // single node systems have nothing to bind to
+    DIR *nodes = opendir("/sys/devices/system/node/node1");
+    if (!nodes) return -1;
+    closedir(nodes);
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%i", cpu);
+    DIR *dir = opendir(path);
+    if (!dir) return -1;
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%i", &node) == 1) break;
+    }
+    closedir(dir);
+    return node;
+}
+
+static bool bind_memory(uintptr_t start, uintptr_t end, int node) {
+    unsigned long mask[16] = {0};
+    int mode = MPOL_DEFAULT_;
+    unsigned long maxnode = 0;
+    if (node >= 0) {
+        if (node >= (int)(sizeof(mask) * 8)) return false;
+        mask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+        mode = MPOL_PREFERRED_;
+        maxnode = sizeof(mask) * 8;
+    }
+    return syscall(SYS_mbind, start, end - start, mode, node >= 0 ? mask : NULL,
+                                        maxnode, MPOL_MF_MOVE_) == 0;
+}
+#else
+int XSynth::get_cpu_node(int cpu) {
+    return -1;
+}
+#endif
+
+// lock, advise huge pages and move the sample data to the given NUMA node,
+// as far as the memory_policy ask for it. Only the whole pages inside
+// a block are touched, a page it share with other heap data keep it's
+// state. Blocks which don't fit in the RLIMIT_MEMLOCK budget stay
+// unlocked.
+void XSynth::apply_memory_policy(int node, MemoryStatus& status) {
+    status.policy = 0;
+    status.total = 0;
+    status.locked = 0;
+    status.huge = 0;
+    status.node = -1;
+#ifndef _WIN32
+    const int policy = memory_policy.load(std::memory_order_acquire);
+    size_t budget = memlock_budget();
+    bool bound = true;
+    for (auto& font : sfonts) {
+        for (auto& b : font.blocks) {
+            status.total += b.size;
+            uintptr_t start, end;
+            if (!inner_pages(b, start, end)) continue;
+            const size_t size = end - start;
+#if defined(__linux__) && defined(SYS_mbind)
+            const int want = (policy & MEMORY_NUMA) ? node : -1;
+            if (b.node != want && bind_memory(start, end, want)) b.node = want;
+            if (b.node != node) bound = false;
+#else
+            bound = false;
+#endif
+#ifdef MADV_HUGEPAGE
+            // only the 2MB aligned part could be backed by huge pages,
+            // khugepaged collapse it in the background
+            const uintptr_t huge = 2 * 1024 * 1024;
+            const uintptr_t huge_start = (start + huge - 1) & ~(huge - 1);
+            const uintptr_t huge_end = end & ~(huge - 1);
+            if (huge_end > huge_start) {
+                const bool want_huge = policy & MEMORY_HUGEPAGE;
+                if (b.huge != want_huge && madvise((void*)huge_start, huge_end - huge_start,
+                        want_huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) == 0) {
+                    b.huge = want_huge;
+                }
+                if (b.huge) status.huge += huge_end - huge_start;
+            }
+#endif
+            if ((policy & MEMORY_LOCK) && !b.locked) {
+                if (size <= budget && mlock((void*)start, size) == 0) {
+                    b.locked = true;
+                    if (budget != (size_t)-1) budget -= size;
+                }
+            } else if (!(policy & MEMORY_LOCK) && b.locked) {
+                if (munlock((void*)start, size) == 0) b.locked = false;
+            }
+            if (b.locked) status.locked += size;
+        }
+    }
+    if (status.locked) status.policy |= MEMORY_LOCK;
+    if (status.huge) status.policy |= MEMORY_HUGEPAGE;
+    if ((policy & MEMORY_NUMA) && node >= 0 && bound && status.total) {
+        status.policy |= MEMORY_NUMA;
+        status.node = node;
+    }
+#endif
+}
+
+// every partition run it's own reverb and chorus with the same settings
 void XSynth::set_reverb_on(int on) {
-    if (synth) {
+    for (int e = 0; e < engines; e++) {
 #if USE_FLUID_API == 1
-        fluid_synth_set_reverb_on(synth, on);
+        fluid_synth_set_reverb_on(parts[e].synth, on);
 #else
-        fluid_synth_reverb_on(synth, -1, on);
+        fluid_synth_reverb_on(parts[e].synth, -1, on);
 #endif
-        set_reverb_levels();
     }
+    set_reverb_levels();
 }
 
 void XSynth::set_reverb_levels() {
-    if (synth) {
+    wake_up();
+    for (int e = 0; e < engines; e++) {
+        fluid_synth_t* synth = parts[e].synth;
+#if !USE_FX_BUFFERS
+        const double level = reverb_level;
+#else
+        // the return level is applied in synth_process()
+        const double level = 1.0;
+#endif
 #if USE_FLUID_API == 1
         fluid_synth_set_reverb (synth, reverb_roomsize, reverb_damp,
-                                        reverb_width, reverb_level);
+                                        reverb_width, level);
 #else
         fluid_synth_set_reverb_group_damp(synth, -1, reverb_damp);
-        fluid_synth_set_reverb_group_level(synth, -1, reverb_level);
+        fluid_synth_set_reverb_group_level(synth, -1, level);
         fluid_synth_set_reverb_group_roomsize(synth, -1, reverb_roomsize);
         fluid_synth_set_reverb_group_width(synth, -1, reverb_width);
 #endif
@@ -459,24 +1847,32 @@ void XSynth::set_reverb_levels() {
 }
 
 void XSynth::set_chorus_on(int on) {
-    if (synth) {
+    for (int e = 0; e < engines; e++) {
 #if USE_FLUID_API == 1
-        fluid_synth_set_chorus_on(synth, on);
+        fluid_synth_set_chorus_on(parts[e].synth, on);
 #else
-        fluid_synth_chorus_on(synth, -1, on);
+        fluid_synth_chorus_on(parts[e].synth, -1, on);
 #endif
-        set_chorus_levels();
     }
+    set_chorus_levels();
 }
 
 void XSynth::set_chorus_levels() {
-    if (synth) {
+    wake_up();
+    for (int e = 0; e < engines; e++) {
+        fluid_synth_t* synth = parts[e].synth;
+#if !USE_FX_BUFFERS
+        const double level = chorus_level;
+#else
+        // the return level is applied in synth_process()
+        const double level = 1.0;
+#endif
 #if USE_FLUID_API == 1
-        fluid_synth_set_chorus (synth, chorus_voices, chorus_level,
+        fluid_synth_set_chorus (synth, chorus_voices, level,
                             chorus_speed, chorus_depth, chorus_type);
 #else
         fluid_synth_set_chorus_group_depth(synth, -1, chorus_depth);
-        fluid_synth_set_chorus_group_level(synth, -1, chorus_level);
+        fluid_synth_set_chorus_group_level(synth, -1, level);
         fluid_synth_set_chorus_group_nr(synth, -1, chorus_voices);
         fluid_synth_set_chorus_group_speed(synth, -1, chorus_speed);
         fluid_synth_set_chorus_group_type(synth, -1, chorus_type);
@@ -486,28 +1882,349 @@ void XSynth::set_chorus_levels() {
 }
 
 void XSynth::set_channel_pressure(int channel) {
-    if (synth) {
-        fluid_synth_channel_pressure(synth, channel, channel_pressure);
+    wake_up();
+    for (int e = 0; e < engines; e++) {
+        fluid_synth_channel_pressure(parts[e].synth, channel, channel_pressure);
     }
 }
 
 void XSynth::set_gain() {
-    if (synth) {
-        fluid_synth_set_gain(synth, volume_level);
+    wake_up();
+    for (int e = 0; e < engines; e++) {
+#if !USE_FX_BUFFERS
+        fluid_synth_set_gain(parts[e].synth, volume_level);
+#else
+        // the gain is applied in synth_process()
+        fluid_synth_set_gain(parts[e].synth, 1.0);
+#endif
     }
 }
 
 void XSynth::panic() {
-    if (synth) {
-        fluid_synth_all_sounds_off(synth, -1);
+    for (int e = 0; e < engines; e++) {
+        fluid_synth_all_sounds_off(parts[e].synth, -1);
     }
+    voices.clear();
 }
 
-void XSynth::unload_synth() {
-    if (sf_id != -1) {
-        fluid_synth_sfunload(synth, sf_id, 0);
-        sf_id = -1;
+// let fluidsynth protect the channels with the highest priority as well
+void XSynth::set_voice_priority() {
+#if FLUIDSYNTH_VERSION_MAJOR > 1
+    if (settings) {
+        char channels[64];
+        voices.important_channels(channels, sizeof(channels));
+        fluid_settings_setstr(settings, "synth.overflow.important-channels", channels);
+        for (int e = 1; e < engines; e++) {
+            fluid_settings_setstr(parts[e].settings,
+                        "synth.overflow.important-channels", channels);
+        }
+    }
+#endif
+}
+
+/****************************************************************
+ ** partitions
+ **
+ ** the channels could be split over several synth engines, channel
+ ** c play on partition c % count, partition 0 is the main synth.
+ ** The main synth get all controller and program changes, so that
+ ** it always hold the state of all channels. The partitions render
+ ** in parallel on the render pool, the output stage sum them up.
+ */
+
+int XSynth::owner(int channel) const {
+    const int n = part_count.load(std::memory_order_acquire);
+    return n > 1 ? (channel & 0x0f) % n : 0;
+}
+
+fluid_synth_t* XSynth::owner_synth(int channel) {
+    return parts[owner(channel)].synth;
+}
+
+// select the program on the main synth and on the partition owning
+// the channel, font is the index in the soundfont stack
+int XSynth::program_select(int channel, int font, int bank, int program) {
+    if (sample_budget > 0 && font < (int)sfonts.size() && sfonts[font].dynamic) {
+        const PresetRef ref = {font, bank, program};
+        if (selected_bytes(channel, &ref) > (size_t)sample_budget * 1024 * 1024) {
+            budget_refused.fetch_add(1, std::memory_order_relaxed);
+            return FLUID_FAILED;
+        }
+    }
+    wake_up();
+    const int p = owner(channel);
+    if (p > 0 && font < (int)parts[p].fonts.size() && parts[p].fonts[font].sf_id != -1) {
+        fluid_synth_program_select(parts[p].synth, channel,
+                        parts[p].fonts[font].sf_id, bank, program);
+    }
+    return fluid_synth_program_select(synth, channel, sfonts[font].sf_id, bank, program);
+}
+
+// create a partition with the settings of the main synth
+void XSynth::init_partition(Partition& part) {
+    part.settings = new_fluid_settings();
+    double rate = sample_rate;
+    int polyphony = 256;
+    fluid_settings_getnum(settings, "synth.sample-rate", &rate);
+    fluid_settings_getint(settings, "synth.polyphony", &polyphony);
+    fluid_settings_setnum(part.settings, "synth.sample-rate", rate);
+    fluid_settings_setint(part.settings, "synth.polyphony", polyphony);
+#if USE_FX_BUFFERS
+    int groups = 1;
+    fluid_settings_getint(settings, "synth.audio-groups", &groups);
+    fluid_settings_setint(part.settings, "synth.audio-channels", groups);
+    fluid_settings_setint(part.settings, "synth.audio-groups", groups);
+    part.channels.assign(32 * block_length, 0.0f);
+#endif
+    part.synth = new_fluid_synth(part.settings);
+    apply_tuning(part.synth);
+    add_envelope(part.synth);
+    for (int chan = 0; chan < 16; chan++) {
+        fluid_synth_set_gen(part.synth, chan, GEN_FINETUNE, finetune_cents);
     }
+    part.buffer.assign(6 * block_length, 0.0f);
+}
+
+// load the soundfont stack of the main synth to partition index, while
+// it's out of the render loop. The fonts load on detached loaders like
+// the main stack, the samples come from the fluidsynth sample cache.
+void XSynth::load_partition(int index) {
+    Partition& part = parts[index];
+    std::vector<SoundFont> stack(sfonts.size());
+    std::vector<bool> keep(part.fonts.size(), false);
+    std::vector<size_t> jobs;
+    for (size_t i = 0; i < sfonts.size(); i++) {
+        for (size_t j = 0; j < part.fonts.size(); j++) {
+            if (!keep[j] && reusable(part.fonts[j], sfonts[i].id)) {
+                stack[i] = part.fonts[j];
+                keep[j] = true;
+                break;
+            }
+        }
+        if (stack[i].sf_id == -1) {
+            stack[i].path = sfonts[i].path;
+            stack[i].id = sfonts[i].id;
+            jobs.push_back(i);
+        }
+    }
+    load_fonts_parallel(stack, jobs);
+    for (size_t j = 0; j < part.fonts.size(); j++) {
+        if (!keep[j]) unload_font(part.fonts[j], part.synth);
+    }
+    for (auto i : jobs) {
+        SoundFont& font = stack[i];
+        // the sample map and blocks belong to the main stack
+        font.map.clear();
+        font.blocks.clear();
+        if (!font.sfont) continue;
+        font.sf_id = fluid_synth_add_sfont(part.synth, font.sfont);
+        if (font.sf_id == -1) unload_font(font, part.synth);
+    }
+    part.fonts.swap(stack);
+}
+
+// copy the state of the channels partition index own from the main synth
+void XSynth::sync_partition(int index, int count) {
+    Partition& part = parts[index];
+    for (int c = index; c < 16; c += count) {
+        for (int num = 0; num < CC_COUNT; num++) {
+            int value = 0;
+            if (fluid_synth_get_cc(synth, c, num, &value) == FLUID_OK)
+                fluid_synth_cc(part.synth, c, num, value);
+        }
+        int bend = 8192;
+        if (fluid_synth_get_pitch_bend(synth, c, &bend) == FLUID_OK)
+            fluid_synth_pitch_bend(part.synth, c, bend);
+        fluid_synth_channel_pressure(part.synth, c, channel_pressure);
+        int sf_id = -1;
+        int bank = 0;
+        int program = 0;
+        if (fluid_synth_get_program(synth, c, &sf_id, &bank, &program) != FLUID_OK) continue;
+        for (size_t i = 0; i < sfonts.size(); i++) {
+            if (sfonts[i].sf_id == sf_id && part.fonts[i].sf_id != -1) {
+                fluid_synth_bank_select(part.synth, c, bank);
+                fluid_synth_program_select(part.synth, c, part.fonts[i].sf_id, bank, program);
+                break;
+            }
+        }
+    }
+}
+
+// take the partitions out of the render loop, there notes are stopped.
+// The audio thread is held meanwhile, so that it's out of the partitions
+// when the fonts, synths and the pool change. Returns the count in use.
+int XSynth::stop_partitions() {
+    const int count = part_count.load(std::memory_order_acquire);
+    if (count < 2) return count;
+    hold(true);
+    part_count.store(1, std::memory_order_release);
+    for (int p = 1; p < count; p++) {
+        fluid_synth_all_sounds_off(parts[p].synth, -1);
+    }
+    hold(false);
+    return count;
+}
+
+// put count partitions into the render loop, with the audio thread held.
+// The channels they take over get there state from the main synth, which
+// release the notes it play on them, as there note off go elsewhere now.
+void XSynth::start_partitions(int count) {
+    if (count < 2) return;
+    pool.start(count - 1, render_job, this);
+    hold(true);
+    for (int p = 1; p < count; p++) sync_partition(p, count);
+    part_count.store(count, std::memory_order_release);
+    for (int c = 0; c < 16; c++) {
+        if (owner(c)) fluid_synth_all_notes_off(synth, c);
+    }
+    hold(false);
+}
+
+// reload count partitions after the soundfont stack changed, the main
+// synth play all channels while they load
+void XSynth::sync_partitions(int count) {
+    if (count < 2) return;
+    for (int p = 1; p < count; p++) load_partition(p);
+    start_partitions(count);
+}
+
+// split the channels over count synth engines, returns the count in use.
+// Sounding notes are stopped, as the channels move to other engines.
+int XSynth::set_partitions(int count) {
+    if (!synth) return 1;
+#if !USE_FX_BUFFERS
+    // fluidsynth < 2.1 can't render the fx returns of a partition apart
+    count = 1;
+#endif
+    count = std::max(1, std::min(count, (int)MAX_PARTITIONS));
+    if (count == part_count.load(std::memory_order_acquire)) return count;
+    hold(true);
+    stop_partitions();
+    panic();
+    // voice ids are counted per engine, start the idle tracking over
+    for (auto& f : sfonts) f.use.clear();
+    for (int c = 0; c < 16; c++) snapshot.newest[c] = 0;
+    hold(false);
+    if (count > engines) {
+        for (int e = engines; e < count; e++) init_partition(parts[e]);
+        engines = count;
+        set_reverb_on(reverb_on);
+        set_chorus_on(chorus_on);
+        set_gain();
+        set_voice_priority();
+    }
+    // unused partitions keep the synth, but free the fonts
+    for (int e = count; e < engines; e++) {
+        for (auto& f : parts[e].fonts) unload_font(f, parts[e].synth);
+        parts[e].fonts.clear();
+    }
+    sync_partitions(count);
+    return count;
+}
+
+// the per channel render need a audio group for each MIDI channel,
+// which cost on every block, so they are only set up while metering.
+// fluidsynth take the groups when a synth is created, so the engines
+// are created again, with the audio thread held. The fonts move over
+// to the new main synth, the channels keep there state, sounding
+// notes stop.
+void XSynth::set_channel_meter(bool on) {
+#if USE_FX_BUFFERS
+    if (!synth || on == channel_meter) return;
+    const int count = part_count.load(std::memory_order_acquire);
+    const int groups = on ? 16 : 1;
+    hold(true);
+    unload_partitions();
+    panic();
+    // voice ids are counted per engine, start the idle tracking over
+    for (auto& f : sfonts) f.use.clear();
+    for (int c = 0; c < 16; c++) snapshot.newest[c] = 0;
+    fluid_settings_setint(settings, "synth.audio-channels", groups);
+    fluid_settings_setint(settings, "synth.audio-groups", groups);
+    fluid_synth_t* s = new_fluid_synth(settings);
+    if (!s) {
+        fluid_settings_setint(settings, "synth.audio-channels", on ? 1 : 16);
+        fluid_settings_setint(settings, "synth.audio-groups", on ? 1 : 16);
+        hold(false);
+        set_partitions(count);
+        return;
+    }
+    apply_tuning(s);
+    add_envelope(s);
+    for (int c = 0; c < 16; c++) {
+        fluid_synth_set_gen(s, c, GEN_FINETUNE, finetune_cents);
+    }
+    // the programs refer to the font ids of the old synth
+    int sf_id[16], bank[16], program[16];
+    for (int c = 0; c < 16; c++) {
+        if (fluid_synth_get_program(synth, c, &sf_id[c], &bank[c], &program[c]) != FLUID_OK)
+            sf_id[c] = -1;
+    }
+    for (auto& font : sfonts) {
+        if (font.sf_id == -1) continue;
+        const int old_id = font.sf_id;
+        fluid_synth_remove_sfont(synth, font.sfont);
+        font.sf_id = fluid_synth_add_sfont(s, font.sfont);
+        for (int c = 0; c < 16; c++) {
+            if (sf_id[c] == old_id) sf_id[c] = font.sf_id;
+        }
+    }
+    for (int c = 0; c < 16; c++) {
+        for (int num = 0; num < CC_COUNT; num++) {
+            int value = 0;
+            if (fluid_synth_get_cc(synth, c, num, &value) == FLUID_OK)
+                fluid_synth_cc(s, c, num, value);
+        }
+        int bend = 8192;
+        if (fluid_synth_get_pitch_bend(synth, c, &bend) == FLUID_OK)
+            fluid_synth_pitch_bend(s, c, bend);
+        fluid_synth_channel_pressure(s, c, channel_pressure);
+        if (sf_id[c] == -1) continue;
+        fluid_synth_bank_select(s, c, bank[c]);
+        fluid_synth_program_select(s, c, sf_id[c], bank[c], program[c]);
+    }
+    delete_fluid_synth(synth);
+    synth = s;
+    parts[0].synth = s;
+    channel_meter = on;
+    if (!on) channel_levels.clear();
+    set_reverb_on(reverb_on);
+    set_chorus_on(chorus_on);
+    set_gain();
+    hold(false);
+    set_partitions(count);
+#else
+    channel_meter = on;
+#endif
+}
+
+void XSynth::unload_partitions() {
+    part_count.store(1, std::memory_order_release);
+    pool.stop();
+    for (int e = 1; e < engines; e++) {
+        Partition& part = parts[e];
+        for (auto& f : part.fonts) unload_font(f, part.synth);
+        part.fonts.clear();
+        if (part.synth) {
+            delete_fluid_synth(part.synth);
+            part.synth = NULL;
+        }
+        if (part.settings) {
+            delete_fluid_settings(part.settings);
+            part.settings = NULL;
+        }
+    }
+    engines = synth ? 1 : 0;
+}
+
+void XSynth::unload_synth() {
+    unload_partitions();
+    for (auto& f : sfonts) unload_font(f);
+    sfonts.clear();
+    for (auto& f : standby) unload_font(f);
+    standby.clear();
+    instruments.clear();
+    instrument_font.clear();
     if (mdriver) {
         //delete_fluid_midi_driver(mdriver);
         mdriver = NULL;
@@ -520,6 +2237,8 @@ void XSynth::unload_synth() {
         delete_fluid_synth(synth);
         synth = NULL;
     }
+    parts[0].synth = NULL;
+    engines = 0;
     if (settings) {
         delete_fluid_settings(settings);
         settings = NULL;
@@ -22,16 +22,295 @@
 #include <vector>
 #include <string>
 #include <cmath>
+#include <atomic>
+#include <set>
+
+#include "SF2Map.h"
+#include "VoiceBudget.h"
+#include "RenderPool.h"
+#include "LevelMeter.h"
 
 #pragma once
 
 #ifndef XSYNTH_H
 #define XSYNTH_H
 
+// fluid_synth_process() render the fx returns to there own buffers since 2.1,
+// the gain and the fx return levels are applied in the output stage then
+#if FLUIDSYNTH_VERSION_MAJOR > 2 || (FLUIDSYNTH_VERSION_MAJOR == 2 && FLUIDSYNTH_VERSION_MINOR >= 1)
+#define USE_FX_BUFFERS 1
+#else
+#define USE_FX_BUFFERS 0
+#endif
+
+// max number of synth engines the channels could be split to
+#define MAX_PARTITIONS 8
+
 
 namespace xsynth {
 
 
+/****************************************************************
+ ** struct SampleBlock
+ **
+ ** sample data read by fluidsynth, offset and size in the file
+ ** and the memory it was read to
+ */
+
+struct SampleBlock {
+    long offset;
+    size_t size;
+    const char* data;
+    bool locked;
+    bool huge;
+    int node;
+    SampleBlock(long o, size_t s, const char* d) : offset(o), size(s), data(d),
+        locked(false), huge(false), node(-1) {}
+};
+
+/****************************************************************
+ ** memory residency policy for the sample data
+ */
+
+enum {
+    MEMORY_LOCK            = 1<<0,
+    MEMORY_HUGEPAGE        = 1<<1,
+    MEMORY_NUMA            = 1<<2,
+};
+
+/****************************************************************
+ ** AudioHold
+ **
+ ** stop the audio thread at a block boundary (hold == true) and let
+ ** it go again. XSynth call it around changes the audio thread must
+ ** not see half done. The owner of the audio thread implement it.
+ */
+
+typedef void (*AudioHold)(void* data, bool hold);
+
+/****************************************************************
+ ** struct MemoryStatus
+ **
+ ** the result of the memory policy, sizes in bytes
+ */
+
+struct MemoryStatus {
+    int policy;
+    size_t total;
+    size_t locked;
+    size_t huge;
+    int node;
+};
+
+/****************************************************************
+ ** struct LoadProgress
+ **
+ ** the soundfont loads in flight, counted by the file callbacks.
+ ** Setting cancel make them fail, the fonts are thrown away.
+ */
+
+// load_font_stack() result when the load was cancelled
+enum {
+    LOAD_CANCELLED         = -2,
+};
+
+struct LoadProgress {
+    std::atomic<long long> bytes;
+    std::atomic<long long> total;
+    std::atomic<int> presets;
+    std::atomic<bool> active;
+    std::atomic<bool> cancel;
+    LoadProgress() : bytes(0), total(0), presets(0), active(false), cancel(false) {}
+};
+
+/****************************************************************
+ ** struct Ramp
+ **
+ ** smooth a gain value to it's target. The value is computed at
+ ** the block boundaries, linear or exponential, the output stage
+ ** interpolate linear within the block.
+ */
+
+enum {
+    RAMP_LINEAR            = 0,
+    RAMP_EXPONENTIAL       = 1,
+};
+
+struct Ramp {
+    float current;
+    float target;
+    float step;
+    int remaining;
+    void reset(float v) { current = target = v; step = 0.0f; remaining = 0; }
+    float next(float value, int n, int time, int mode);
+};
+
+/****************************************************************
+ ** mix_fx, mix_fx16
+ **
+ ** out = gain * (out + reverb * rev + chorus * chorus_fx), the three
+ ** levels ramp linear over the n frames from g, r, c by dg, dr, dc
+ ** per frame. mix_fx16 need n to be a multiple of MIX_LANES.
+ */
+
+#define MIX_LANES 16
+
+void mix_fx(float* __restrict out, const float* __restrict rev,
+            const float* __restrict chorus, int n,
+            float g, float dg, float r, float dr, float c, float dc);
+void mix_fx16(float* __restrict out, const float* __restrict rev,
+              const float* __restrict chorus, int n,
+              float g, float dg, float r, float dr, float c, float dc);
+
+/****************************************************************
+ ** struct PresetRef
+ **
+ ** a preset in the soundfont stack
+ */
+
+struct PresetRef {
+    int font;
+    int bank;
+    int program;
+};
+
+/****************************************************************
+ ** struct Footprint
+ **
+ ** sample bytes used by the presets of the instrument list, by
+ ** the banks and by the presets selected on the channels. Samples
+ ** shared by presets count once in the bank and channel sums.
+ ** resident is the part of it in RAM, it's 0 with dynamic sample
+ ** loading, where fluidsynth read the samples on it's own.
+ */
+
+struct PresetFootprint {
+    size_t bytes;
+    size_t resident;
+};
+
+struct BankFootprint {
+    int font;
+    int bank;  // as shown in the instrument list
+    size_t bytes;
+    size_t resident;
+};
+
+struct Footprint {
+    std::vector<PresetFootprint> presets;  // index in the instrument list
+    std::vector<BankFootprint> banks;
+    size_t total;
+    size_t assigned;
+    size_t assigned_resident;
+    Footprint() : total(0), assigned(0), assigned_resident(0) {}
+};
+
+/****************************************************************
+ ** struct FontIdentity
+ **
+ ** tell if a soundfont file is the one already loaded: canonical
+ ** path, size, modification time and a hash over the head and the
+ ** tail of the file, which catch files rewritten in the same second
+ */
+
+struct FontIdentity {
+    std::string path;
+    long long size;
+    long long mtime;
+    unsigned long long hash;
+    FontIdentity() : size(-1), mtime(0), hash(0) {}
+    bool same(const FontIdentity& o) const {
+        return size >= 0 && size == o.size && mtime == o.mtime &&
+               hash == o.hash && path == o.path;
+    }
+    void identify(const std::string& file, bool content);
+};
+
+/****************************************************************
+ ** struct PresetUse
+ **
+ ** when a preset was last seen selected, the channels it was on,
+ ** and per channel the newest voice id at the time it left it.
+ ** Voices started later belong to a other preset.
+ */
+
+struct PresetUse {
+    double last;
+    uint16_t channels;
+    unsigned int left[16];
+    PresetUse(double t = 0.0) : last(t), channels(0) {
+        for (int i = 0; i < 16; i++) left[i] = ~0u;
+    }
+};
+
+/****************************************************************
+ ** struct VoiceSnapshot
+ **
+ ** the voices playing per channel, taken by the audio thread at
+ ** a block boundary when the worker ask for it: the oldest voice
+ ** id (~0u for none) and the newest id seen so far
+ */
+
+enum {
+    SNAPSHOT_IDLE          = 0,
+    SNAPSHOT_WANTED        = 1,
+    SNAPSHOT_TAKEN         = 2,
+    SNAPSHOT_BUSY          = 3,
+};
+
+struct VoiceSnapshot {
+    std::atomic<int> state;
+    unsigned int oldest[16];
+    unsigned int newest[16];
+    bool complete;
+    VoiceSnapshot() : state(SNAPSHOT_IDLE), complete(false) {
+        for (int i = 0; i < 16; i++) oldest[i] = newest[i] = 0;
+    }
+};
+
+/****************************************************************
+ ** struct SoundFont
+ **
+ ** a entry in the soundfont stack, parsed on it's own loader synth
+ */
+
+struct SoundFont {
+    std::string path;
+    FontIdentity id;
+    int sf_id;
+    int first;
+    bool dynamic;
+    fluid_sfont_t* sfont;
+    fluid_settings_t* loader_settings;
+    fluid_synth_t* loader;
+    std::vector<std::string> instruments;
+    SF2Map map;
+    std::vector<SampleBlock> blocks;
+    std::vector<PresetUse> use;
+    std::set<long> released;
+    SoundFont() : sf_id(-1), first(0), dynamic(false), sfont(NULL),
+        loader_settings(NULL), loader(NULL) {}
+};
+
+/****************************************************************
+ ** struct Partition
+ **
+ ** a synth engine rendering a part of the channels. The fonts
+ ** are loaded a second time, fluidsynth share the sample data
+ ** between them in it's sample cache. With channel metering the
+ ** MIDI channels render to there own buffers in channels.
+ */
+
+struct Partition {
+    fluid_settings_t* settings;
+    fluid_synth_t* synth;
+    std::vector<SoundFont> fonts;
+    std::vector<float> buffer;
+    std::vector<float> channels;
+    int ret;
+    Partition() : settings(NULL), synth(NULL), ret(0) {}
+};
+
 /****************************************************************
  ** class XSynth
  **
@@ -44,9 +323,7 @@ private:
     fluid_synth_t* synth;
     fluid_audio_driver_t* adriver;
     fluid_midi_driver_t* mdriver;
-    int sf_id;
     double cents[128];
-    void activate_tunning_for_all_channel(int set);
     fluid_mod_t *amod;
     fluid_mod_t *dmod;
     fluid_mod_t *smod;
@@ -55,12 +332,68 @@ private:
     fluid_mod_t *fmod;
     void setup_envelope();
     void delete_envelope();
+    void load_font_detached(SoundFont& font, LoadProgress* track);
+    void load_fonts_parallel(std::vector<SoundFont>& stack,
+                             const std::vector<size_t>& jobs,
+                             LoadProgress* track = NULL);
+    void attach_font(SoundFont& font);
+    void unload_font(SoundFont& font, fluid_synth_t* owner = NULL);
+    void rebuild_instruments();
+    unsigned int sample_rate;
+    unsigned int block_length;
+    bool block_pow2;
+    std::vector<float> fx_buffer;
+    Ramp gain_ramp;
+    Ramp reverb_ramp;
+    Ramp chorus_ramp;
+    void release_oldest(int channel);
+    bool silent;
+    // frames rendered below the silence level with no voice active
+    unsigned int quiet_frames;
+    // set on any thread when a controller, program, effect or the
+    // gain changed, the audio thread leave the silent state then
+    std::atomic<bool> wake;
+    void wake_up() { wake.store(true, std::memory_order_release); }
+    int render(int count, float *outl, float *outr);
+    Partition parts[MAX_PARTITIONS];
+    int engines;
+    std::atomic<int> part_count;
+    RenderPool pool;
+    int job_frames;
+    float *job_out[2];
+    double finetune_cents;
+    int tuning_program;
+    static void render_job(void* data, int index);
+    void render_partition(int index);
+    int owner(int channel) const;
+    fluid_synth_t* owner_synth(int channel);
+    int program_select(int channel, int font, int bank, int program);
+    void add_envelope(fluid_synth_t* s);
+    void apply_tuning(fluid_synth_t* s);
+    void init_partition(Partition& part);
+    void load_partition(int index);
+    void sync_partition(int index, int count);
+    int stop_partitions();
+    void start_partitions(int count);
+    void sync_partitions(int count);
+    void unload_partitions();
+    std::vector<SoundFont> standby;
+    bool reusable(const SoundFont& font, const FontIdentity& id) const;
+    VoiceSnapshot snapshot;
+    std::vector<fluid_voice_t*> voice_list;
+    // audio thread only, the voices a taken note may still play
+    std::vector<fluid_voice_t*> note_voices;
+    size_t release_span(SoundFont& font, const SampleSpan& span);
+    void hold(bool on) { if (hold_audio) hold_audio(hold_data, on); }
 
 public:
     XSynth();
     ~XSynth();
 
+    std::vector<SoundFont> sfonts;
     std::vector<std::string> instruments;
+    std::vector<int> instrument_font;
+    int channel_font[16];
     int channel_instrument[16];
     int channel_banks[16];
     int reverb_on;
@@ -76,8 +409,27 @@ public:
     int chorus_voices;
     int channel_pressure;
     double volume_level;
+    double smooth_time;
+    int smooth_mode;
+    // set from the audio thread, read on the worker
+    std::atomic<int> memory_policy;
+    bool font_hash;
+    bool readahead;
+    // set on the worker, the audio thread check it on program changes
+    std::atomic<int> sample_budget;
+    std::atomic<int> budget_refused;
+    // notes started while the program of there channel wait for the
+    // worker to load it's samples, counted by the host
+    std::atomic<int> late_notes;
+    LoadProgress progress;
+    VoiceBudget voices;
+    // read by the render, set with set_channel_meter()
+    bool channel_meter;
+    LevelMeter channel_levels;
+    AudioHold hold_audio;
+    void* hold_data;
 
-    void setup(unsigned int SampleRate);
+    void setup(unsigned int SampleRate, unsigned int BlockLength = 0, bool Pow2 = false);
     void finetune(float A4);
     void setup_scala_tuning();
     void setup_12edo_tuning(double cent);
@@ -90,13 +442,31 @@ public:
     int synth_pgm_changed(int channel, int num);
     int synth_bank_changed(int channel, int num);
     int synth_process(int count, float *outl, float *outr);
+    bool is_silent() const {return silent;}
     int synth_is_active() {return synth ? 1 : 0;}
     int load_soundfont(const char *path);
-    void print_soundfont();
+    int load_soundfont_on_channel(int channel, const char *path);
+    int load_font_stack(const std::vector<std::string>& paths);
+    void prepare_font_stack(const std::vector<std::string>& paths);
+    void print_soundfont(SoundFont& font);
     void set_default_instruments();
-    bool check_instrument(int bank, int instrument);
+    void set_default_instrument(int channel);
+    bool check_instrument(int font, int bank, int instrument);
     int set_instrument_on_channel(int channel, int instrument);
     int get_instrument_for_channel(int channel);
+    bool get_preset_ref(int instrument, PresetRef& ref);
+    bool get_channel_preset(int channel, PresetRef& ref);
+    size_t prefault_preset(const PresetRef& ref);
+    size_t resident_bytes();
+    size_t selected_bytes(int channel = -1, const PresetRef* ref = NULL);
+    size_t presets_bytes(const std::vector<PresetRef>& refs, size_t* resident = NULL);
+    void get_footprint(Footprint& fp);
+    void get_assigned_footprint(Footprint& fp);
+    size_t release_idle_samples(double idle, bool wait);
+    void snapshot_voices();
+    int set_sample_budget(int mb, bool reload = true);
+    void apply_memory_policy(int node, MemoryStatus& status);
+    static int get_cpu_node(int cpu);
 
     std::vector<double> scala_ratios;
     unsigned int scala_size;
@@ -110,6 +480,10 @@ public:
     void set_channel_pressure(int channel);
 
     void set_gain();
+    void set_voice_priority();
+    int set_partitions(int count);
+    void set_channel_meter(bool on);
+    int get_partitions() const {return part_count.load(std::memory_order_relaxed);}
 
     void panic();
     void unload_synth();
@@ -25,9 +25,14 @@
 #include <cmath>
 #include <iostream>
 #include <cstring>
+#include <climits>
+#include <sstream>
+#include <algorithm>
 #include <unistd.h>
+#include <sched.h>
 #include <atomic>
 #include <thread>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 
@@ -62,6 +67,10 @@
 
 #include "fluida.h"        // define struct PortIndex
 #include "XSynth.h"
+#include "MasterBus.h"
+#include "MidiFile.h"
+#include "TextSlot.h"
+#include "rtcheck.h"
 
 ////////////////////////////// PLUG-IN CLASS ///////////////////////////
 
@@ -69,6 +78,15 @@ namespace fluida {
 
 #define FLOAT_EQUAL(x, y) (fabs(x - y) > 0.000001) ? 0 : 1
 
+// seconds between two idle sample release passes
+#define IDLE_PASS_SECONDS 2
+// level meter updates per second
+#define METER_RATE 20
+// channel messages kept while the audio thread hold
+#define HELD_EVENTS 256
+// a queued instrument index is marked with this bit, a program is not
+#define PENDING_INSTRUMENT (1<<30)
+
 class DenormalProtection {
 private:
 #ifdef __SSE__
@@ -108,27 +126,15 @@ public:
     inline ~DenormalProtection() {};
 };
 
+// messages to the UI which are not part of the controller snapshot,
+// the controller values themself are tracked per field (CTL_* in fluida.h)
 enum {
     SEND_SOUNDFONT         = 1<<0,
     SEND_INSTRUMENTS       = 1<<1,
     SET_INSTRUMENT         = 1<<2,
-    SET_REV_LEV            = 1<<3,
-    SET_REV_WIDTH          = 1<<4,
-    SET_REV_DAMP           = 1<<5,
-    SET_REV_SIZE           = 1<<6,
-    SET_REV_ON             = 1<<7,
-    SET_CHORUS_TYPE        = 1<<8,
-    SET_CHORUS_DEPTH       = 1<<9,
-    SET_CHORUS_SPEED       = 1<<10,
-    SET_CHORUS_LEV         = 1<<11,
-    SET_CHORUS_VOICES      = 1<<12,
-    SET_CHORUS_ON          = 1<<13,
-    SET_CHANNEL_PRES       = 1<<14,
-    SET_GAIN               = 1<<15,
-    SEND_SCL_NAME          = 1<<16,
-    SEND_CHANNEL_LIST      = 1<<17,
-    SET_VELOCITY           = 1<<18,
-    SET_FINETUNING         = 1<<19,
+    SEND_SCL_NAME          = 1<<3,
+    SEND_CHANNEL_LIST      = 1<<4,
+    SET_PLAYER             = 1<<5,
 };
 
 enum {
@@ -145,6 +151,95 @@ enum {
     GET_CHANNEL_LIST       = 1<<10,
     GET_VELOCITY           = 1<<11,
     GET_FINETUNING         = 1<<12,
+    GET_FONT_STACK         = 1<<13,
+    GET_CHANNEL_FONT       = 1<<14,
+    GET_PREFAULT           = 1<<15,
+    GET_MEMORY_POLICY      = 1<<16,
+    GET_VOICE_POLICY       = 1<<17,
+    GET_PARTITIONS         = 1<<18,
+    GET_MIDI_FILE          = 1<<19,
+    GET_INSTRUMENT         = 1<<20,
+    GET_SAMPLE_BUDGET      = 1<<21,
+    GET_IDLE_UNLOAD        = 1<<22,
+    GET_CHANNEL_METER      = 1<<23,
+};
+
+// a restored session on it's way from restore_state() to the audio thread,
+// restore_state() fill the image, the worker apply it
+enum {
+    SESSION_IDLE           = 0,
+    SESSION_FILLING        = 1,
+    SESSION_READY          = 2,
+    SESSION_APPLYING       = 3,
+    SESSION_APPLIED        = 4,
+};
+
+// the audio thread hold at a block boundary while the worker swap
+// what it read, the font stack or a restored session
+enum {
+    HOLD_NONE              = 0,
+    HOLD_REQUEST           = 1,
+    HOLD_ACTIVE            = 2,
+};
+
+/****************************************************************
+ ** struct SessionImage
+ **
+ ** the plugin state as restored from a session. restore_state()
+ ** take a copy of the running values and overwrite it with the
+ ** stored ones, the worker apply the image in one pass.
+ ** what hold the GET_* bits of the work to do, changed the
+ ** snapshot fields (1 << CTL_*) to send to the UI once applied.
+ ** channel_font is the saved channel routing, it refer to the
+ ** restored font stack. started is when restore_state() begun to
+ ** fill the image, the worker log the time until it's applied.
+ */
+
+struct SessionImage {
+    std::string soundfont;
+    std::string font_stack;
+    std::string scl_file;
+    std::string midi_file;
+    std::string hot_list;
+    int channel;
+    int current_instrument;
+    int instrument_list[16];
+    int voices[3][16];
+    int vel;
+    int partitions;
+    int sample_budget;
+    int idle_unload;
+    bool player_on;
+    float tuning;
+    float finetuning;
+    float scala_vec[128];
+    bool scala;
+    int midi_cc[4];
+    int reverb_on;
+    double reverb_level;
+    double reverb_width;
+    double reverb_damp;
+    double reverb_roomsize;
+    int chorus_on;
+    int chorus_type;
+    double chorus_depth;
+    double chorus_speed;
+    double chorus_level;
+    int chorus_voices;
+    int channel_pressure;
+    double volume_level;
+    double smooth_time;
+    int smooth_mode;
+    int memory_policy;
+    int master_mode;
+    double master_ceiling;
+    double master_release;
+    int dither_bits;
+    int channel_font[16];
+    bool restore_channel_font;
+    std::chrono::steady_clock::time_point started;
+    unsigned long what;
+    uint32_t changed;
 };
 
 typedef struct {
@@ -204,9 +299,43 @@ private:
     LV2_Atom_Forge forge;
     LV2_Atom_Forge_Frame notify_frame;
     FluidaLV2URIs uris;
-    std::string soundfont;
+    // set on the audio thread, the worker load it, font_path is the
+    // copy the audio thread compare and send
+    xsynth::TextSlot soundfont;
+    char font_path[TEXT_SLOT_SIZE];
+    std::atomic<int> font_request;
+    std::atomic<int> font_failed;
+    std::string font_stack;
+    std::string channel_font_path;
     std::string scl_file;
     int channel;
+    int font_channel;
+    // read by the worker and the host while the audio thread set it
+    xsynth::TextSlot hot_list;
+    std::atomic<int> prefault_status[3];
+    std::atomic<bool> prefault_send;
+    std::atomic<int> memory_status[5];
+    std::atomic<bool> memory_send;
+    std::atomic<int> sample_status[4];
+    std::atomic<bool> sample_send;
+    std::atomic<int> footprint[FOOTPRINT_SIZE];
+    std::atomic<bool> footprint_send;
+    // program or marked instrument per channel, -1 when none is queued
+    std::atomic<int> pending_program[16];
+    std::atomic<int> dsp_cpu;
+    uint32_t sample_rate;
+    uint32_t block_length;
+    bool block_pow2;
+    uint32_t gr_frames;
+    uint32_t load_frames;
+    uint32_t meter_frames;
+    bool meter_shown;
+    // the channel metering the UI asked for, the worker set it up
+    std::atomic<bool> meter_on;
+    xsynth::LevelMeter out_levels;
+    bool load_shown;
+    float gain_reduction;
+    bool silent;
     int doit;
     int sflist_counter;
     int current_instrument;
@@ -214,6 +343,26 @@ private:
     float scala_vec[128];
     int midi_cc[4];
     int vel;
+    int partitions;
+    int sample_budget;
+    int idle_unload;
+    uint32_t idle_frames;
+    // the path the player should play, set by the audio thread and the
+    // session restore, player_path is the copy the audio thread send
+    xsynth::TextSlot midi_file;
+    char player_path[TEXT_SLOT_SIZE];
+    std::atomic<int> midi_request;
+    std::atomic<int> midi_failed;
+    bool player_on;
+    bool player_pgm;
+    xsynth::MidiFile midi_files[2];
+    std::atomic<int> midi_slot;
+    std::atomic<int> midi_in_use;
+    xsynth::MidiPlayer player;
+    double host_quarters;
+    double host_bpm;
+    double host_speed;
+    double host_beat_unit;
     float tuning;
     float finetuning;
     std::atomic<bool> restore_send;
@@ -227,14 +376,36 @@ private:
 
     //bool restore_send;
     //bool re_send;
-    unsigned long flags;
+    std::atomic<unsigned long> flags;
     unsigned long get_flags;
+    // generation of each snapshot field, bumped from any thread on change
+    std::atomic<int> ctl_counter;
+    std::atomic<int> ctl_gen[CTL_FIELDS];
+    // last snapshot generation the UI applied, audio thread only
+    int snapshot_acked;
+    // newest generation the host got as patch:Set, audio thread only
+    int host_sent;
+    SessionImage image;
+    std::atomic<int> session_state;
+    std::atomic<int> hold_state;
+    // between activate() and deactivate(), a hold is only waited for then
+    std::atomic<bool> dsp_running;
+    // nested holds on the worker
+    int hold_depth;
+    // audio thread only: the gain the last block ended with, faded to 0
+    // into a hold and back after it, and the input which came meanwhile
+    float fade_gain;
+    uint8_t held_midi[HELD_EVENTS][3];
+    int held_count;
+    bool held_lost;
 
     DenormalProtection MXCSR;
     // pointer to buffer
     float*          output;
     float*          output1;
+    float*          latency;
     xsynth::XSynth xsynth;
+    xsynth::MasterBus master;
     FluidaWorker flworker;
 
     // private functions
@@ -247,12 +418,18 @@ private:
     inline void deactivate_f();
     inline void get_ctrl_states(const LV2_Atom_Object* obj);
     inline void retrieve_ctrl_values(const LV2_Atom_Object* obj);
+    inline void apply_ctrl_value(LV2_URID property, const LV2_Atom* value);
     inline void send_filebrowser_state();
     inline void send_controller_state();
     inline void send_all_controller_state();
+    inline void touch_controller(int field);
+    inline void send_snapshot();
     inline void send_instrument_state();
     inline void send_next_instrument_state();
     inline void do_non_rt_work_f();
+    inline void prefault_presets();
+    inline void apply_memory_policy();
+    int* voice_vector(LV2_URID urid);
     inline void non_rt_finish_f();
     inline void store_ctrl_values(LV2_State_Store_Function store, 
         LV2_State_Handle handle,LV2_URID urid, float value);
@@ -276,6 +453,24 @@ private:
     inline void send_midi_data(int count, uint8_t controller,
                              uint8_t note, uint8_t velocity);
     inline void send_midi_cc();
+    inline void schedule_prefault();
+    inline void handle_midi(const uint8_t* msg, bool from_player);
+    inline void update_position(const LV2_Atom_Object* obj);
+    inline void write_path_value(LV2_URID urid, const char* value);
+    void load_midi_file();
+    void queue_program(int channel, int pgm, int inst);
+    void apply_pending_programs();
+    void update_sample_status();
+    void update_footprint(bool full);
+    inline bool set_channel_meter(bool on);
+    void release_idle_samples();
+    void capture_session_image();
+    void prepare_session_image();
+    void apply_session_image();
+    void hold_audio();
+    void release_audio();
+    static void audio_hold(void* data, bool hold);
+    static void player_event(void* data, const uint8_t* msg);
 public:
     // LV2 Descriptor
     static const LV2_Descriptor descriptor;
@@ -316,15 +511,60 @@ public:
 Fluida_::Fluida_() :
     output(NULL),
     output1(NULL),
+    latency(NULL),
     xsynth(),
+    master(),
     flworker() {
+    // paths are copied on the audio thread, make sure that never allocate
+    channel_font_path.reserve(PATH_MAX);
+    scl_file.reserve(PATH_MAX);
     channel = 0;
+    font_channel = 0;
+    for (int i=0;i<3;i++) prefault_status[i] = 0;
+    prefault_send = false;
+    for (int i=0;i<5;i++) memory_status[i] = 0;
+    memory_send = false;
+    for (int i=0;i<4;i++) sample_status[i] = 0;
+    sample_send = false;
+    for (int i=0;i<FOOTPRINT_SIZE;i++) footprint[i] = 0;
+    footprint_send = false;
+    for (int i=0;i<16;i++) pending_program[i] = -1;
+    dsp_cpu = -1;
+    sample_rate = 48000;
+    block_length = 0;
+    block_pow2 = false;
+    gr_frames = 0;
+    load_frames = 0;
+    meter_frames = 0;
+    meter_shown = false;
+    meter_on = false;
+    load_shown = false;
+    gain_reduction = 0.0;
+    silent = false;
     doit = 0;
     sflist_counter = 0;
     current_instrument = 0;
     for (int i=0;i<16;i++) instrument_list[i] = 0;
     for (int i=0;i<4;i++) midi_cc[i] = 0;
     vel = 64;
+    partitions = 1;
+    sample_budget = 0;
+    idle_unload = 0;
+    idle_frames = 0;
+    player_on = true;
+    player_pgm = false;
+    player_path[0] = 0;
+    font_path[0] = 0;
+    font_request = 0;
+    font_failed = -1;
+    midi_request = 0;
+    midi_failed = -1;
+    midi_slot = -1;
+    midi_in_use = -1;
+    host_quarters = 0.0;
+    host_bpm = 120.0;
+    host_speed = 0.0;
+    host_beat_unit = 4.0;
     tuning = 0.0;
     finetuning = 440.0;
     restore_send.store(false, std::memory_order_release);
@@ -335,6 +575,19 @@ Fluida_::Fluida_() :
     send_once = false;
     flags = 0;
     get_flags = 0;
+    ctl_counter.store(1, std::memory_order_relaxed);
+    for (int i = 0; i < CTL_FIELDS; i++) ctl_gen[i].store(1, std::memory_order_relaxed);
+    snapshot_acked = 0;
+    host_sent = 0;
+    session_state = SESSION_IDLE;
+    hold_state = HOLD_NONE;
+    dsp_running = false;
+    hold_depth = 0;
+    fade_gain = 1.0f;
+    held_count = 0;
+    held_lost = false;
+    xsynth.hold_audio = audio_hold;
+    xsynth.hold_data = this;
     for (int i=0;i<128;i++) scala_vec[i] = 0;
     flworker.start(this);
 };
@@ -396,7 +649,9 @@ bool FluidaWorker::is_running() const noexcept {
 ///////////////////////// PRIVATE CLASS  FUNCTIONS /////////////////////
 
 void Fluida_::init_dsp_(uint32_t rate) {
-    xsynth.setup(rate);
+    xsynth.setup(rate, block_length, block_pow2);
+    master.init(rate, block_length);
+    sample_rate = rate;
     xsynth.init_synth();
     //xsynth.load_soundfont("/usr/share/sounds/sf2/FluidR3_GM.sf2");
 }
@@ -417,18 +672,26 @@ void Fluida_::connect_(uint32_t port,void* data) {
     case NOTIFY:
         notify = (LV2_Atom_Sequence*)data;
         break;
+    case LATENCY:
+        latency = static_cast<float*>(data);
+        break;
     default:
         break;
     }
 }
 
 void Fluida_::activate_f() {
+    dsp_running.store(true);
 }
 
 void Fluida_::clean_up() {
 }
 
+// no block follow, so a requested hold is acknowledged here
 void Fluida_::deactivate_f() {
+    dsp_running.store(false);
+    int expected = HOLD_REQUEST;
+    hold_state.compare_exchange_strong(expected, HOLD_ACTIVE);
 }
 
 // send midi data to the UI 
@@ -505,10 +768,25 @@ void Fluida_::write_string_value(LV2_URID urid, const char* value) {
     lv2_atom_forge_pop(&forge, &frame);
 }
 
+void Fluida_::write_path_value(LV2_URID urid, const char* value) {
+    FluidaLV2URIs* uris = &this->uris;
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(&forge, 0);
+    lv2_atom_forge_object(&forge, &frame, 0, uris->patch_Set);
+    lv2_atom_forge_key(&forge, uris->patch_property);
+    lv2_atom_forge_urid(&forge, urid);
+    lv2_atom_forge_key(&forge, uris->patch_value);
+    lv2_atom_forge_path(&forge, value, strlen(value)+1);
+    lv2_atom_forge_pop(&forge, &frame);
+}
+
 void Fluida_::send_filebrowser_state() {
-    if (flags & SEND_SOUNDFONT && !soundfont.empty()) {
-        lv2_atom_forge_frame_time(&forge, 0);
-        write_set_file(&forge, &this->uris, soundfont.data());
+    if (flags & SEND_SOUNDFONT) {
+        soundfont.read(font_path);
+        if (font_path[0]) {
+            lv2_atom_forge_frame_time(&forge, 0);
+            write_set_file(&forge, &this->uris, font_path);
+        }
         flags &= ~SEND_SOUNDFONT;
     }
 }
@@ -568,61 +846,115 @@ void Fluida_::send_next_instrument_state() {
     }
 }
 
-void Fluida_::send_controller_state() {
-    FluidaLV2URIs* uris = &this->uris;
-    if (flags & SET_REV_LEV) {
-        write_float_value(uris->fluida_rev_lev,(float)xsynth.reverb_level);
-        flags &= ~SET_REV_LEV;
-    }
-    if (flags & SET_REV_WIDTH) {
-        write_float_value(uris->fluida_rev_width, (float)xsynth.reverb_width);
-        flags &= ~SET_REV_WIDTH;
-    }
-    if (flags & SET_REV_DAMP) {
-        write_float_value(uris->fluida_rev_damp, (float)xsynth.reverb_damp);
-        flags &= ~SET_REV_DAMP;
-    }
-    if (flags & SET_REV_SIZE) {
-        write_float_value(uris->fluida_rev_size, (float)xsynth.reverb_roomsize);
-        flags &= ~SET_REV_SIZE;
-    }
-    if (flags & SET_REV_ON) {
-        write_bool_value(uris->fluida_rev_on, (float)xsynth.reverb_on);
-        flags &= ~SET_REV_ON;
+// mark a controller value as changed, call after the value is set.
+// The worker and the audio thread both touch fields, a generation
+// never go back when the older one is stored last.
+void Fluida_::touch_controller(int field) {
+    const int g = ctl_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    int old = ctl_gen[field].load(std::memory_order_relaxed);
+    while (old < g && !ctl_gen[field].compare_exchange_weak(old, g,
+                            std::memory_order_release, std::memory_order_relaxed)) {
     }
+}
 
-    if (flags & SET_CHORUS_TYPE) {
-        write_int_value(uris->fluida_chorus_type, (float)xsynth.chorus_type);
-        flags &= ~SET_CHORUS_TYPE;
-    }
-    if (flags & SET_CHORUS_DEPTH) {
-        write_float_value(uris->fluida_chorus_depth, (float)xsynth.chorus_depth);
-        flags &= ~SET_CHORUS_DEPTH;
-    }
-    if (flags & SET_CHORUS_SPEED) {
-        write_float_value(uris->fluida_chorus_speed, (float)xsynth.chorus_speed);
-        flags &= ~SET_CHORUS_SPEED;
-    }
-    if (flags & SET_CHORUS_LEV) {
-        write_float_value(uris->fluida_chorus_lev, (float)xsynth.chorus_level);
-        flags &= ~SET_CHORUS_LEV;
-    }
-    if (flags & SET_CHORUS_VOICES) {
-        write_int_value(uris->fluida_chorus_voices, (float)xsynth.chorus_voices);
-        flags &= ~SET_CHORUS_VOICES;
-    }
-    if (flags & SET_CHORUS_ON) {
-        write_bool_value(uris->fluida_chorus_on, (float)xsynth.chorus_on);
-        flags &= ~SET_CHORUS_ON;
-    }
-    if (flags & SET_CHANNEL_PRES) {
-        write_int_value(uris->fluida_channel_pressure, (float)xsynth.channel_pressure);
-        flags &= ~SET_CHANNEL_PRES;
-    }
-    if (flags & SET_GAIN) {
-        write_float_value(uris->fluida_gain, (float)xsynth.volume_level);
-        flags &= ~SET_GAIN;
-    }
+// the atom type of the patch:readable fields, as the host get them
+enum {
+    FIELD_FLOAT,
+    FIELD_INT,
+    FIELD_BOOL,
+    FIELD_UI_ONLY,
+};
+
+static const int field_type[CTL_FIELDS] = {
+    FIELD_FLOAT,    // CTL_REV_LEV
+    FIELD_FLOAT,    // CTL_REV_WIDTH
+    FIELD_FLOAT,    // CTL_REV_DAMP
+    FIELD_FLOAT,    // CTL_REV_SIZE
+    FIELD_BOOL,     // CTL_REV_ON
+    FIELD_INT,      // CTL_CHORUS_TYPE
+    FIELD_FLOAT,    // CTL_CHORUS_DEPTH
+    FIELD_FLOAT,    // CTL_CHORUS_SPEED
+    FIELD_FLOAT,    // CTL_CHORUS_LEV
+    FIELD_INT,      // CTL_CHORUS_VOICES
+    FIELD_BOOL,     // CTL_CHORUS_ON
+    FIELD_INT,      // CTL_CHANNEL_PRES
+    FIELD_FLOAT,    // CTL_GAIN
+    FIELD_UI_ONLY,  // CTL_VELOCITY
+    FIELD_FLOAT,    // CTL_FINETUNING
+    FIELD_UI_ONLY,  // CTL_TUNING
+    FIELD_INT,      // CTL_MEMORY_POLICY
+    FIELD_FLOAT,    // CTL_SMOOTH_TIME
+    FIELD_INT,      // CTL_SMOOTH_MODE
+    FIELD_INT,      // CTL_MASTER_MODE
+    FIELD_FLOAT,    // CTL_MASTER_CEILING
+    FIELD_FLOAT,    // CTL_MASTER_RELEASE
+    FIELD_INT,      // CTL_DITHER_BITS
+    FIELD_INT,      // CTL_PARTITIONS
+    FIELD_INT,      // CTL_SAMPLE_BUDGET
+    FIELD_INT,      // CTL_IDLE_UNLOAD
+    FIELD_BOOL,     // CTL_PLAYER_ON
+};
+
+// one snapshot atom with the controller values changed since the
+// last snapshot the UI acknowledged, nothing when all are known.
+// The host get a patch:Set for each changed patch:readable field,
+// whether a UI is open or not.
+void Fluida_::send_snapshot() {
+    int generations[CTL_FIELDS + 1];
+    float values[CTL_FIELDS];
+    int newest = 0;
+    for (int i = 0; i < CTL_FIELDS; i++) {
+        const int g = ctl_gen[i].load(std::memory_order_acquire);
+        generations[i + 1] = g;
+        if (g > newest) newest = g;
+    }
+    if (newest <= snapshot_acked && newest <= host_sent) return;
+    generations[0] = newest;
+
+    values[CTL_REV_LEV] = (float)xsynth.reverb_level;
+    values[CTL_REV_WIDTH] = (float)xsynth.reverb_width;
+    values[CTL_REV_DAMP] = (float)xsynth.reverb_damp;
+    values[CTL_REV_SIZE] = (float)xsynth.reverb_roomsize;
+    values[CTL_REV_ON] = (float)xsynth.reverb_on;
+    values[CTL_CHORUS_TYPE] = (float)xsynth.chorus_type;
+    values[CTL_CHORUS_DEPTH] = (float)xsynth.chorus_depth;
+    values[CTL_CHORUS_SPEED] = (float)xsynth.chorus_speed;
+    values[CTL_CHORUS_LEV] = (float)xsynth.chorus_level;
+    values[CTL_CHORUS_VOICES] = (float)xsynth.chorus_voices;
+    values[CTL_CHORUS_ON] = (float)xsynth.chorus_on;
+    values[CTL_CHANNEL_PRES] = (float)xsynth.channel_pressure;
+    values[CTL_GAIN] = (float)xsynth.volume_level;
+    values[CTL_VELOCITY] = (float)vel;
+    values[CTL_FINETUNING] = (float)finetuning;
+    values[CTL_TUNING] = (float)tuning;
+    values[CTL_MEMORY_POLICY] = (float)xsynth.memory_policy;
+    values[CTL_SMOOTH_TIME] = (float)xsynth.smooth_time;
+    values[CTL_SMOOTH_MODE] = (float)xsynth.smooth_mode;
+    values[CTL_MASTER_MODE] = (float)master.mode;
+    values[CTL_MASTER_CEILING] = (float)master.ceiling;
+    values[CTL_MASTER_RELEASE] = (float)master.release;
+    values[CTL_DITHER_BITS] = (float)master.dither_bits;
+    values[CTL_PARTITIONS] = (float)partitions;
+    values[CTL_SAMPLE_BUDGET] = (float)sample_budget;
+    values[CTL_IDLE_UNLOAD] = (float)idle_unload;
+    values[CTL_PLAYER_ON] = (float)player_on;
+    for (int i = 0; i < CTL_FIELDS && newest > host_sent; i++) {
+        if (generations[i + 1] <= host_sent) continue;
+        const LV2_URID urid = snapshot_field_urid(&uris, i);
+        if (field_type[i] == FIELD_FLOAT) write_float_value(urid, values[i]);
+        else if (field_type[i] == FIELD_INT) write_int_value(urid, values[i]);
+        else if (field_type[i] == FIELD_BOOL) write_bool_value(urid, values[i]);
+    }
+    if (newest > host_sent) host_sent = newest;
+    if (newest <= snapshot_acked) return;
+    for (int i = 0; i < CTL_FIELDS; i++) {
+        if (generations[i + 1] <= snapshot_acked) generations[i + 1] = 0;
+    }
+    write_set_snapshot(&forge, &uris, generations, values);
+}
+
+void Fluida_::send_controller_state() {
+    FluidaLV2URIs* uris = &this->uris;
     if (flags & SET_INSTRUMENT) {
         lv2_atom_forge_frame_time(&forge, 0);
         write_set_instrument(&forge, uris, current_instrument);
@@ -637,41 +969,26 @@ void Fluida_::send_controller_state() {
         write_set_channel_list(&forge, uris, instrument_list);
         flags &= ~SEND_CHANNEL_LIST;
     }
-    if (flags & SET_VELOCITY) {
-        write_int_value(uris->fluida_velocity, (float)vel);
-        flags &= ~SET_VELOCITY;
-    }
-    if (flags & SET_FINETUNING) {
-        write_float_value(uris->fluida_finetuning, (float)finetuning);
-        flags &= ~SET_FINETUNING;
+    if (flags & SET_PLAYER) {
+        midi_file.read(player_path);
+        write_path_value(uris->fluida_midi_file, player_path);
+        flags &= ~SET_PLAYER;
     }
+    send_snapshot();
 }
 
+// a new UI, send everything
 void Fluida_::send_all_controller_state() {
     FluidaLV2URIs* uris = &this->uris;
-    write_float_value(uris->fluida_rev_lev,(float)xsynth.reverb_level);
-    write_float_value(uris->fluida_rev_width, (float)xsynth.reverb_width);
-    write_float_value(uris->fluida_rev_damp, (float)xsynth.reverb_damp);
-    write_float_value(uris->fluida_rev_size, (float)xsynth.reverb_roomsize);
-    write_bool_value(uris->fluida_rev_on, (float)xsynth.reverb_on);
-
-    write_int_value(uris->fluida_chorus_type, (float)xsynth.chorus_type);
-    write_float_value(uris->fluida_chorus_depth, (float)xsynth.chorus_depth);
-    write_float_value(uris->fluida_chorus_speed, (float)xsynth.chorus_speed);
-    write_float_value(uris->fluida_chorus_lev, (float)xsynth.chorus_level);
-    write_int_value(uris->fluida_chorus_voices, (float)xsynth.chorus_voices);
-    write_bool_value(uris->fluida_chorus_on, (float)xsynth.chorus_on);
-
-    write_int_value(uris->fluida_channel_pressure, (float)xsynth.channel_pressure);
-    write_float_value(uris->fluida_gain, (float)xsynth.volume_level);
-    write_int_value(uris->fluida_velocity, (float)vel);
-    write_float_value(uris->fluida_finetuning, (float)finetuning);
+    snapshot_acked = 0;
+    send_snapshot();
+    midi_file.read(player_path);
+    write_path_value(uris->fluida_midi_file, player_path);
 
     if (!scl_file.empty()) {
         const char* label = scl_file.data();
         write_string_value(uris->fluida_scl, label);
     }
-    write_float_value(uris->fluida_tuning, (float)tuning);
 
     lv2_atom_forge_frame_time(&forge, 0);
     write_set_instrument(&forge, uris, current_instrument);
@@ -685,81 +1002,188 @@ void Fluida_::retrieve_ctrl_values(const LV2_Atom_Object* obj) {
                     uris->patch_property, &property, 0);
     if (value == NULL) return;
     if (property == NULL) return;
-    if (((LV2_Atom_URID*)property)->body == uris->fluida_rev_on) {
+    apply_ctrl_value(((LV2_Atom_URID*)property)->body, value);
+}
+
+// set one parameter, the worker pick up the get_flags and the
+// snapshot carry the new generation to the UI and the host
+void Fluida_::apply_ctrl_value(LV2_URID property, const LV2_Atom* value) {
+    FluidaLV2URIs* uris = &this->uris;
+    if (property == uris->fluida_rev_on) {
         int* val = (int*)LV2_ATOM_BODY(value);
         xsynth.reverb_on = (int)(*val);
         get_flags |= GET_REVERB_ON | GET_REVERB_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_rev_lev) {
+        touch_controller(CTL_REV_ON);
+    } else if (property == uris->fluida_rev_lev) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.reverb_level = (*val);
+#if !USE_FX_BUFFERS
         get_flags |= GET_REVERB_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_rev_width) {
+#endif
+        touch_controller(CTL_REV_LEV);
+    } else if (property == uris->fluida_rev_width) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.reverb_width = (*val);
         get_flags |= GET_REVERB_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_rev_damp) {
+        touch_controller(CTL_REV_WIDTH);
+    } else if (property == uris->fluida_rev_damp) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.reverb_damp = (*val);
         get_flags |= GET_REVERB_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_rev_size) {
+        touch_controller(CTL_REV_DAMP);
+    } else if (property == uris->fluida_rev_size) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.reverb_roomsize = (*val);
         get_flags |= GET_REVERB_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_chorus_on) {
+        touch_controller(CTL_REV_SIZE);
+    } else if (property == uris->fluida_chorus_on) {
         int* val = (int*)LV2_ATOM_BODY(value);
         xsynth.chorus_on = (int)(*val);
         get_flags |= GET_CHORUS_ON | GET_CHORUS_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_chorus_type) {
+        touch_controller(CTL_CHORUS_ON);
+    } else if (property == uris->fluida_chorus_type) {
         int* val = (int*)LV2_ATOM_BODY(value);
         xsynth.chorus_type = (int)(*val);
         get_flags |= GET_CHORUS_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_chorus_depth) {
+        touch_controller(CTL_CHORUS_TYPE);
+    } else if (property == uris->fluida_chorus_depth) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.chorus_depth = (*val);
         get_flags |= GET_CHORUS_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_chorus_speed) {
+        touch_controller(CTL_CHORUS_DEPTH);
+    } else if (property == uris->fluida_chorus_speed) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.chorus_speed = (*val);
         get_flags |= GET_CHORUS_LEVELS;
-    } else if ((((LV2_Atom_URID*)property)->body == uris->fluida_chorus_lev)) {
+        touch_controller(CTL_CHORUS_SPEED);
+    } else if (property == uris->fluida_chorus_lev) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.chorus_level = (*val);
+#if !USE_FX_BUFFERS
         get_flags |= GET_CHORUS_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_chorus_voices) {
+#endif
+        touch_controller(CTL_CHORUS_LEV);
+    } else if (property == uris->fluida_chorus_voices) {
         int* val = (int*)LV2_ATOM_BODY(value);
         xsynth.chorus_voices = (*val);
         get_flags |= GET_CHORUS_LEVELS;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_channel_pressure) {
+        touch_controller(CTL_CHORUS_VOICES);
+    } else if (property == uris->fluida_channel_pressure) {
         int* val = (int*)LV2_ATOM_BODY(value);
         xsynth.channel_pressure = (*val);
         get_flags |= GET_CHANNEL_PRESSURE;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_gain) {
+        touch_controller(CTL_CHANNEL_PRES);
+    } else if (property == uris->fluida_gain) {
         float* val = (float*)LV2_ATOM_BODY(value);
         xsynth.volume_level = (*val);
+#if !USE_FX_BUFFERS
         get_flags |= GET_GAIN;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_tuning) {
+#endif
+        touch_controller(CTL_GAIN);
+    } else if (property == uris->fluida_smooth_time) {
+        float* val = (float*)LV2_ATOM_BODY(value);
+        xsynth.smooth_time = (*val);
+        touch_controller(CTL_SMOOTH_TIME);
+    } else if (property == uris->fluida_smooth_mode) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        xsynth.smooth_mode = (*val);
+        touch_controller(CTL_SMOOTH_MODE);
+    } else if (property == uris->fluida_master_mode) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        master.mode = (*val);
+        touch_controller(CTL_MASTER_MODE);
+    } else if (property == uris->fluida_master_ceiling) {
+        float* val = (float*)LV2_ATOM_BODY(value);
+        master.ceiling = (*val);
+        touch_controller(CTL_MASTER_CEILING);
+    } else if (property == uris->fluida_master_release) {
+        float* val = (float*)LV2_ATOM_BODY(value);
+        master.release = (*val);
+        touch_controller(CTL_MASTER_RELEASE);
+    } else if (property == uris->fluida_dither_bits) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        master.dither_bits = (*val);
+        touch_controller(CTL_DITHER_BITS);
+    } else if (property == uris->fluida_tuning) {
         float* val = (float*)LV2_ATOM_BODY(value);
         tuning = (*val);
         get_flags |= GET_TUNING;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_velocity) {
+        touch_controller(CTL_TUNING);
+    } else if (property == uris->fluida_velocity) {
         int* val = (int*)LV2_ATOM_BODY(value);
         vel = (*val);
         get_flags |= GET_VELOCITY;
-    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_finetuning) {
+        touch_controller(CTL_VELOCITY);
+    } else if (property == uris->fluida_finetuning) {
         float* val = (float*)LV2_ATOM_BODY(value);
         finetuning = (*val);
         get_flags |= GET_FINETUNING;
+        touch_controller(CTL_FINETUNING);
+    } else if (property == uris->fluida_memory_policy) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        xsynth.memory_policy = (*val);
+        get_flags |= GET_MEMORY_POLICY;
+        touch_controller(CTL_MEMORY_POLICY);
+    } else if (property == uris->fluida_partitions) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        partitions = (*val);
+        get_flags |= GET_PARTITIONS;
+        touch_controller(CTL_PARTITIONS);
+    } else if (property == uris->fluida_sample_budget) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        sample_budget = (*val);
+        get_flags |= GET_SAMPLE_BUDGET;
+        touch_controller(CTL_SAMPLE_BUDGET);
+    } else if (property == uris->fluida_idle_unload) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        idle_unload = (*val);
+        get_flags |= GET_IDLE_UNLOAD;
+        touch_controller(CTL_IDLE_UNLOAD);
+    } else if (property == uris->fluida_midi_file) {
+        if (value->type == uris->atom_Path) {
+            // a path the worker still read is published by run_dsp_()
+            if (midi_file.set((const char*)LV2_ATOM_BODY(value))) get_flags |= GET_MIDI_FILE;
+            midi_request.fetch_add(1, std::memory_order_release);
+        }
+    } else if (property == uris->fluida_player_on) {
+        int* val = (int*)LV2_ATOM_BODY(value);
+        player_on = (*val);
+        touch_controller(CTL_PLAYER_ON);
+    } else if (property == uris->fluida_hot_list) {
+        if (value->type == uris->atom_String) {
+            // a string the worker still read is published by run_dsp_()
+            hot_list.set((const char*)LV2_ATOM_BODY(value));
+            get_flags |= GET_PREFAULT;
+        }
+    } else if (int* dst = voice_vector(property)) {
+        // one int for each channel
+        const LV2_Atom_Vector* vec = (const LV2_Atom_Vector*)value;
+        if (value->type == uris->atom_Vector && vec->body.child_type == uris->atom_Int &&
+                value->size == sizeof(LV2_Atom_Vector_Body) + 16 * sizeof(int)) {
+            memcpy(dst, vec + 1, 16 * sizeof(int));
+            get_flags |= GET_VOICE_POLICY;
+        }
     }
 }
 
+int* Fluida_::voice_vector(LV2_URID urid) {
+    if (urid == uris.fluida_voice_min) return xsynth.voices.min_voices;
+    if (urid == uris.fluida_voice_max) return xsynth.voices.max_voices;
+    if (urid == uris.fluida_voice_priority) return xsynth.voices.priority;
+    return NULL;
+}
+
 void Fluida_::get_ctrl_states(const LV2_Atom_Object* obj) {
     FluidaLV2URIs* uris = &this->uris;
     if (obj->body.otype == uris->patch_Set) {
         const LV2_Atom* file_path = read_set_file(uris, obj);
         if (file_path) {
-            if (strcmp(soundfont.data(),(const char*)(file_path+1)) != 0) {
-                soundfont = (const char*)(file_path+1);
-                get_flags |= GET_SOUNDFONT;
+            soundfont.read(font_path);
+            if (strcmp(font_path,(const char*)(file_path+1)) != 0) {
+                if (soundfont.set((const char*)(file_path+1))) get_flags |= GET_SOUNDFONT;
+                font_request.fetch_add(1, std::memory_order_release);
+                // drop a load in flight, the worker pick up this one
+                xsynth.progress.cancel.store(true, std::memory_order_release);
             }
         } else {
             retrieve_ctrl_values(obj);
@@ -774,6 +1198,106 @@ void Fluida_::store_midi_cc(uint8_t cc, uint8_t value) {
     else if (cc == 74) midi_cc[3] = value;
 }
 
+// play a midi message on the synth. Program changes from the player
+// are collected and reported once per block.
+void Fluida_::handle_midi(const uint8_t* msg, bool from_player) {
+    FluidaLV2URIs* uris = &this->uris;
+    const int ch = msg[0]&0x0f;
+    switch (lv2_midi_message_type(msg)) {
+    case LV2_MIDI_MSG_NOTE_ON:
+        // the note play the old program, the samples of the new one aren't there yet
+        if (msg[2] && pending_program[ch].load(std::memory_order_relaxed) >= 0) {
+            sample_status[3] = xsynth.late_notes.fetch_add(1, std::memory_order_relaxed) + 1;
+            sample_send.store(true, std::memory_order_release);
+        }
+        xsynth.synth_note_on(ch,msg[1],msg[2]);
+        break;
+    case LV2_MIDI_MSG_NOTE_OFF:
+        xsynth.synth_note_off(ch,msg[1]);
+        break;
+    case LV2_MIDI_MSG_CONTROLLER:
+        switch (msg[1]) {
+        case LV2_MIDI_CTL_ALL_SOUNDS_OFF:
+        case LV2_MIDI_CTL_ALL_NOTES_OFF:
+            xsynth.panic();
+            break;
+        case LV2_MIDI_CTL_MSB_BANK:
+        case LV2_MIDI_CTL_LSB_BANK:
+            xsynth.synth_bank_changed(ch,msg[2]);
+            break;
+        case LV2_MIDI_CTL_RESET_CONTROLLERS:
+            break;
+        default:
+            xsynth.synth_send_cc(ch,msg[1],msg[2]);
+            store_midi_cc(msg[1],msg[2]);
+            break;
+        }
+        break;
+    case LV2_MIDI_MSG_BENDER:
+        xsynth.synth_send_pitch_bend(ch,(msg[2] << 7 | msg[1]));
+        break;
+    case LV2_MIDI_MSG_PGM_CHANGE:
+    {
+        if (xsynth.sample_budget > 0) {
+            queue_program(ch, msg[1], -1);
+            break;
+        }
+        xsynth.synth_pgm_changed(ch,msg[1]);
+        if (ch == 0) {
+            current_instrument = msg[1];
+        }
+        instrument_list[ch] = xsynth.get_instrument_for_channel(ch);
+        if (from_player) {
+            player_pgm = true;
+            break;
+        }
+        write_set_channel_list(&forge, uris, instrument_list);
+        schedule_prefault();
+    }
+
+    break;
+    default:
+        break;
+    }
+}
+
+void Fluida_::player_event(void* data, const uint8_t* msg) {
+    static_cast<Fluida_*>(data)->handle_midi(msg, true);
+}
+
+static inline double atom_number(const FluidaLV2URIs* uris, const LV2_Atom* a) {
+    if (a->type == uris->atom_Double) return ((const LV2_Atom_Double*)a)->body;
+    if (a->type == uris->atom_Float) return ((const LV2_Atom_Float*)a)->body;
+    if (a->type == uris->atom_Long) return (double)((const LV2_Atom_Long*)a)->body;
+    if (a->type == uris->atom_Int) return (double)((const LV2_Atom_Int*)a)->body;
+    return 0.0;
+}
+
+// host transport, the song position is kept in quarter notes
+void Fluida_::update_position(const LV2_Atom_Object* obj) {
+    FluidaLV2URIs* uris = &this->uris;
+    const LV2_Atom* bar = NULL;
+    const LV2_Atom* bar_beat = NULL;
+    const LV2_Atom* beat_unit = NULL;
+    const LV2_Atom* beats_per_bar = NULL;
+    const LV2_Atom* bpm = NULL;
+    const LV2_Atom* speed = NULL;
+    lv2_atom_object_get(obj, uris->time_bar, &bar,
+                        uris->time_barBeat, &bar_beat,
+                        uris->time_beatUnit, &beat_unit,
+                        uris->time_beatsPerBar, &beats_per_bar,
+                        uris->time_beatsPerMinute, &bpm,
+                        uris->time_speed, &speed, 0);
+    if (bpm) host_bpm = atom_number(uris, bpm);
+    if (speed) host_speed = atom_number(uris, speed);
+    if (beat_unit && atom_number(uris, beat_unit) > 0.0) host_beat_unit = atom_number(uris, beat_unit);
+    if (bar_beat) {
+        double beats = atom_number(uris, bar_beat);
+        if (bar && beats_per_bar) beats += atom_number(uris, bar) * atom_number(uris, beats_per_bar);
+        host_quarters = beats * 4.0 / host_beat_unit;
+    }
+}
+
 void Fluida_::run_dsp_(uint32_t n_samples) {
     if(n_samples<1) return;
     MXCSR.set_();
@@ -782,6 +1306,13 @@ void Fluida_::run_dsp_(uint32_t n_samples) {
     lv2_atom_forge_set_buffer(&forge, (uint8_t*)notify, notify_capacity);
     lv2_atom_forge_sequence_head(&forge, &notify_frame, 0);
 
+#ifdef __linux__
+    // remember where the audio thread runs, for the NUMA policy
+    if (dsp_cpu.load(std::memory_order_relaxed) < 0) {
+        dsp_cpu.store(sched_getcpu(), std::memory_order_relaxed);
+    }
+#endif
+
     if (first_check && use_worker.load(std::memory_order_acquire)) {
         first_check = false;
         doit = 3;
@@ -789,20 +1320,49 @@ void Fluida_::run_dsp_(uint32_t n_samples) {
         schedule->schedule_work(schedule->handle, sizeof(int), &doit);
     }
 
+    // the worker swap the font stack or apply a restored session at a
+    // block boundary, the synth isn't touched while it hold. A requested
+    // hold fade this block out and is acknowledged at it's end.
+    const int hold_now = hold_state.load(std::memory_order_acquire);
+    const bool hold = hold_now == HOLD_ACTIVE;
+    const bool fade_out = hold_now == HOLD_REQUEST;
+    int session = SESSION_APPLIED;
+    if (!hold && session_state.compare_exchange_strong(session, SESSION_IDLE,
+                                                       std::memory_order_acq_rel)) {
+        send_midi_cc();
+    }
+    // the channel messages which came in while the audio thread hold
+    if (!hold && held_count) {
+        for (int i = 0; i < held_count; i++) handle_midi(held_midi[i], false);
+        held_count = 0;
+        // some got lost, don't leave notes hanging
+        if (held_lost) xsynth.panic();
+        held_lost = false;
+    }
+    // parameter changes of this cycle, handed to the worker as one job
+    bool ctrl_changed = false;
+
     LV2_ATOM_SEQUENCE_FOREACH(midi_in, ev) {
         if (lv2_atom_forge_is_object_type(&forge, ev->body.type)) {
             const LV2_Atom_Object* obj = (LV2_Atom_Object*)&ev->body;
-            if (obj->body.otype == uris->patch_Get) {
+            if (obj->body.otype == uris->time_Position) {
+                update_position(obj);
+            } else if (obj->body.otype == uris->patch_Get) {
                 flags |= SEND_SOUNDFONT;
                 send_filebrowser_state();
                 send_controller_state();
             } else if (obj->body.otype == uris->patch_Set) {
                 get_ctrl_states(obj);
-                doit = 1;
-                if (use_worker.load(std::memory_order_acquire)) {
-                    schedule->schedule_work(schedule->handle, sizeof(int), &doit);
-                } else {
-                    flworker.cv.notify_one();
+                ctrl_changed = true;
+            } else if (obj->body.otype == uris->patch_Put) {
+                // a batch from the UI, the latest value of each changed parameter
+                const LV2_Atom* body = NULL;
+                lv2_atom_object_get(obj, uris->patch_body, &body, 0);
+                if (body && body->type == uris->atom_Object) {
+                    LV2_ATOM_OBJECT_FOREACH((const LV2_Atom_Object*)body, prop) {
+                        apply_ctrl_value(prop->key, &prop->value);
+                    }
+                    ctrl_changed = true;
                 }
             } else if (obj->body.otype == uris->fluida_scl) {
                 const LV2_Atom* file_path = read_set_scl(uris, obj);
@@ -821,36 +1381,70 @@ void Fluida_::run_dsp_(uint32_t n_samples) {
                 if (value) {
                     int* uri = (int*)LV2_ATOM_BODY(value);
                     current_instrument = (*uri);
-                    xsynth.synth_pgm_changed(0,(*uri));
-                    for (int i=0;i<16;i++) {
+                    // while the audio thread hold the worker select it
+                    if (hold || xsynth.sample_budget > 0) queue_program(0, (*uri), -1);
+                    else xsynth.synth_pgm_changed(0,(*uri));
+                    for (int i=0;!hold && i<16;i++) {
                         instrument_list[i] = xsynth.get_instrument_for_channel(i);
                         //fprintf(stderr, "channel %i instrument %i\n", i, instrument_list[i]);
                     }
                     flags |= SEND_CHANNEL_LIST;
                     send_controller_state();
+                    schedule_prefault();
                 }
             } else if (obj->body.otype == uris->fluida_state) {
                 const LV2_Atom*  value = read_set_gui(uris, obj);
                 if (value) {
                     //flags = ~(-1 << 15);
                     flags |= SEND_SOUNDFONT | SEND_INSTRUMENTS;
+                    // a new UI open with the channel matrix hidden
+                    if (set_channel_meter(false)) ctrl_changed = true;
                     send_filebrowser_state();
-                    send_instrument_state();
+                    // the instrument list is send once the worker is done
+                    if (!hold) send_instrument_state();
                     send_all_controller_state();
+                    if (footprint[2].load(std::memory_order_relaxed))
+                        footprint_send.store(true, std::memory_order_release);
+                }
+            } else if (obj->body.otype == uris->fluida_meter_request) {
+                const LV2_Atom* value = read_set_meter_request(uris, obj);
+                if (value && set_channel_meter(((LV2_Atom_Int*)value)->body != 0))
+                    ctrl_changed = true;
+            } else if (obj->body.otype == uris->fluida_snapshot_ack) {
+                const LV2_Atom* value = read_set_snapshot_ack(uris, obj);
+                if (value) {
+                    const int g = ((LV2_Atom_Int*)value)->body;
+                    if (g > snapshot_acked) snapshot_acked = g;
                 }
             } else if (obj->body.otype == uris->fluida_sflist_next) {
-                send_next_instrument_state();
+                if (!hold) send_next_instrument_state();
             } else if (obj->body.otype == uris->fluida_channel_inst) {
                 const LV2_Atom_Vector* vec = read_set_channel_inst(uris, obj);
+                if (!vec) continue;
                 int *ci = (int*) LV2_ATOM_BODY(&vec->atom);
-                xsynth.set_instrument_on_channel(ci[0], ci[1]);
+                if (ci[0] < 0 || ci[0] > 15) continue;
+                if (hold || xsynth.sample_budget > 0) queue_program(ci[0], -1, ci[1]);
+                else xsynth.set_instrument_on_channel(ci[0], ci[1]);
                 instrument_list[ci[0]] = ci[1];
                 if (ci[0] == 0) {
                     current_instrument = ci[1];
                     write_set_instrument(&forge, uris,ci[1]);
                 }
+                schedule_prefault();
             } else if (obj->body.otype == uris->fluida_channel_list) {
                 write_set_channel_list(&forge, uris, instrument_list);
+            } else if (obj->body.otype == uris->fluida_channel_font) {
+                const LV2_Atom* file_path = read_set_channel_font(uris, obj, &font_channel);
+                if (file_path) {
+                    channel_font_path = (const char*)(file_path+1);
+                    doit = 1;
+                    get_flags |= GET_CHANNEL_FONT;
+                    if (use_worker.load(std::memory_order_acquire)) {
+                        schedule->schedule_work(schedule->handle, sizeof(int), &doit);
+                    } else {
+                        flworker.cv.notify_one();
+                    }
+                }
             } else {
                 get_ctrl_states(obj);
                 doit = 2;
@@ -869,55 +1463,103 @@ void Fluida_::run_dsp_(uint32_t n_samples) {
                 send_once = true;
                 continue;
             }
-
-            switch (lv2_midi_message_type(msg)) {
-            case LV2_MIDI_MSG_NOTE_ON:
-                xsynth.synth_note_on(channel,msg[1],msg[2]);
-                break;
-            case LV2_MIDI_MSG_NOTE_OFF:
-                xsynth.synth_note_off(channel,msg[1]);
-                break;
-            case LV2_MIDI_MSG_CONTROLLER:
-                switch (msg[1]) {
-                case LV2_MIDI_CTL_ALL_SOUNDS_OFF:
-                case LV2_MIDI_CTL_ALL_NOTES_OFF:
-                    xsynth.panic();
-                    break;
-                case LV2_MIDI_CTL_MSB_BANK:
-                case LV2_MIDI_CTL_LSB_BANK:
-                    xsynth.synth_bank_changed(channel,msg[2]);
-                    break;
-                case LV2_MIDI_CTL_RESET_CONTROLLERS:
-                    break;
-                default:
-                    xsynth.synth_send_cc(channel,msg[1],msg[2]);
-                    store_midi_cc(msg[1],msg[2]);
-                    break;
-                }
-                break;
-            case LV2_MIDI_MSG_BENDER:
-                xsynth.synth_send_pitch_bend(channel,(msg[2] << 7 | msg[1]));
-                break;
-            case LV2_MIDI_MSG_PGM_CHANGE:
-            {
-                xsynth.synth_pgm_changed(channel,msg[1]);
-                if (channel == 0) {
-                    current_instrument = msg[1];
+            if (!hold) {
+                handle_midi(msg, false);
+            } else if (lv2_midi_is_voice_message(msg)) {
+                if (held_count < HELD_EVENTS) {
+                    memset(held_midi[held_count], 0, 3);
+                    memcpy(held_midi[held_count], msg, std::min(ev->body.size, (uint32_t)3));
+                    held_count++;
+                } else {
+                    held_lost = true;
                 }
-                instrument_list[channel] = xsynth.get_instrument_for_channel(channel);
-                write_set_channel_list(&forge, uris, instrument_list);
             }
+        }
+    }
+    // a hot list which found both buffers in use
+    if (hot_list.flush()) schedule_prefault();
+    // a midi file the worker couldn't load is cleared, unless a newer one came
+    const int failed = midi_failed.exchange(-1, std::memory_order_acq_rel);
+    if (failed >= 0 && failed == midi_request.load(std::memory_order_acquire)) {
+        midi_file.set("");
+    }
+    if (midi_file.flush()) {
+        get_flags |= GET_MIDI_FILE;
+        ctrl_changed = true;
+    }
+    // the same for a soundfont
+    const int font_fail = font_failed.exchange(-1, std::memory_order_acq_rel);
+    if (font_fail >= 0 && font_fail == font_request.load(std::memory_order_acquire)) {
+        soundfont.set("");
+    }
+    if (soundfont.flush()) {
+        get_flags |= GET_SOUNDFONT;
+        ctrl_changed = true;
+    }
+    if (ctrl_changed) {
+        doit = 1;
+        if (use_worker.load(std::memory_order_acquire)) {
+            schedule->schedule_work(schedule->handle, sizeof(int), &doit);
+        } else {
+            flworker.cv.notify_one();
+        }
+    }
+
+    // the midi file player, merged with the live input
+    const int slot = midi_slot.load(std::memory_order_acquire);
+    const xsynth::MidiFile* mf = slot >= 0 ? &midi_files[slot] : NULL;
+    if (mf != player.get_file()) {
+        player.set_file(mf);
+        midi_in_use.store(slot, std::memory_order_release);
+    }
+    const double quarters = (double)n_samples * host_bpm * host_speed * 4.0 /
+                                    (60.0 * sample_rate * host_beat_unit);
+    if (!hold) player.process(host_quarters, host_quarters + quarters,
+                        player_on && host_speed > 0.0, player_event, this);
+    host_quarters += quarters;
+    if (player_pgm) {
+        player_pgm = false;
+        write_set_channel_list(&forge, uris, instrument_list);
+        schedule_prefault();
+    }
+
+    // idle sample release pass on the worker, it ask for a voice snapshot
+    if (idle_unload > 0) {
+        idle_frames += n_samples;
+        if (idle_frames >= sample_rate * IDLE_PASS_SECONDS) {
+            idle_frames = 0;
+            doit = 1;
+            get_flags |= GET_IDLE_UNLOAD;
+            if (use_worker.load(std::memory_order_acquire)) {
+                schedule->schedule_work(schedule->handle, sizeof(int), &doit);
+            } else {
+                flworker.cv.notify_one();
+            }
+        }
+    }
+    if (!hold) xsynth.snapshot_voices();
 
-            break;
-            default:
-                break;
+    if (hold) {
+        memset(output, 0, n_samples * sizeof(float));
+        memset(output1, 0, n_samples * sizeof(float));
+    } else {
+        xsynth.synth_process(n_samples, output, output1);
+        // fade out into a hold and back in after it
+        const float target = fade_out ? 0.0f : 1.0f;
+        if (target != fade_gain) {
+            const float step = (target - fade_gain) / n_samples;
+            for (uint32_t i = 0; i < n_samples; i++) {
+                const float g = fade_gain + step * (i + 1);
+                output[i] *= g;
+                output1[i] *= g;
             }
         }
     }
-    xsynth.synth_process(n_samples, output, output1);
+    fade_gain = (hold || fade_out) ? 0.0f : 1.0f;
+    master.process(n_samples, output, output1, hold || xsynth.is_silent());
+    if (latency) *latency = (float)master.latency();
 
     if (restore_send.load(std::memory_order_acquire)) {
-        send_midi_cc();
         doit = 1;
         if (use_worker.load(std::memory_order_acquire)) {
             schedule->schedule_work(schedule->handle, sizeof(int), &doit);
@@ -927,21 +1569,169 @@ void Fluida_::run_dsp_(uint32_t n_samples) {
         restore_send.store(false, std::memory_order_release);
     }
 
-    if (re_send.load(std::memory_order_acquire)) {
+    if (!hold && re_send.load(std::memory_order_acquire)) {
         send_filebrowser_state();
         send_instrument_state();
-        send_controller_state();
         if ((get_flags & GET_SCL) || (get_flags & GET_TUNING))
-            write_float_value(this->uris.fluida_tuning, tuning);
+            touch_controller(CTL_TUNING);
+        send_controller_state();
         get_flags = 0;
         re_send.store(false, std::memory_order_release);
     }
+
+    if (prefault_send.exchange(false, std::memory_order_acq_rel)) {
+        int status[3];
+        for (int i=0;i<3;i++) status[i] = prefault_status[i].load(std::memory_order_relaxed);
+        write_set_prefault(&forge, uris, status);
+    }
+
+    // soundfont load progress, about 10 times a second
+    if (xsynth.progress.active.load(std::memory_order_acquire)) {
+        load_frames += n_samples;
+        if (!load_shown || load_frames >= sample_rate / 10) {
+            load_frames = 0;
+            load_shown = true;
+            int status[3];
+            status[0] = xsynth.progress.bytes.load(std::memory_order_relaxed) / 1024;
+            status[1] = xsynth.progress.total.load(std::memory_order_relaxed) / 1024;
+            status[2] = xsynth.progress.presets.load(std::memory_order_relaxed);
+            write_set_load_progress(&forge, uris, status);
+        }
+    } else if (load_shown) {
+        load_shown = false;
+        int status[3] = {0, 0, 0};
+        write_set_load_progress(&forge, uris, status);
+    }
+
+    if (sample_send.exchange(false, std::memory_order_acq_rel)) {
+        int status[4];
+        for (int i=0;i<4;i++) status[i] = sample_status[i].load(std::memory_order_relaxed);
+        write_set_sample_status(&forge, uris, status);
+    }
+
+    if (footprint_send.exchange(false, std::memory_order_acq_rel)) {
+        int table[FOOTPRINT_SIZE];
+        for (int i=0;i<FOOTPRINT_SIZE;i++) table[i] = footprint[i].load(std::memory_order_relaxed);
+        write_set_footprint(&forge, uris, table);
+    }
+
+    if (memory_send.exchange(false, std::memory_order_acq_rel)) {
+        int status[5];
+        for (int i=0;i<5;i++) status[i] = memory_status[i].load(std::memory_order_relaxed);
+        write_set_memory_status(&forge, uris, status);
+    }
+
+    if (silent != xsynth.is_silent()) {
+        silent = xsynth.is_silent();
+        write_bool_value(uris->fluida_silent, (float)silent);
+    }
+
+    // limiter gain reduction, about 20 times a second
+    if (master.mode & xsynth::MASTER_LIMITER) {
+        gr_frames += n_samples;
+        if (gr_frames >= sample_rate / 20) {
+            gr_frames = 0;
+            const float gr = master.gain_reduction();
+            if (!FLOAT_EQUAL(gr, gain_reduction)) {
+                gain_reduction = gr;
+                write_float_value(uris->fluida_gain_reduction, gain_reduction);
+            }
+        }
+    } else if (gain_reduction != 0.0) {
+        gain_reduction = 0.0;
+        write_float_value(uris->fluida_gain_reduction, gain_reduction);
+    }
+
+    // output and channel levels, silence is sent once
+    out_levels.add(0, output, n_samples);
+    out_levels.add(1, output1, n_samples);
+    meter_frames += n_samples;
+    if (meter_frames >= sample_rate / METER_RATE) {
+        meter_frames = 0;
+        float levels[METER_VALUES];
+        out_levels.take(0, levels[0], levels[1]);
+        out_levels.take(1, levels[2], levels[3]);
+        for (int c = 0; c < 16; c++) {
+            xsynth.channel_levels.take(c, levels[4 + 2 * c], levels[5 + 2 * c]);
+        }
+        bool quiet = true;
+        for (int i = 0; i < METER_VALUES; i++) {
+            if (levels[i] > METER_FLOOR) quiet = false;
+        }
+        if (!quiet || meter_shown) {
+            meter_shown = !quiet;
+            write_set_meter(&forge, uris, levels);
+        }
+    }
+    // done with the synth for this block, the worker could go on
+    if (fade_out) {
+        int expected = HOLD_REQUEST;
+        hold_state.compare_exchange_strong(expected, HOLD_ACTIVE, std::memory_order_acq_rel);
+    }
     MXCSR.reset_();
 }
 
 void Fluida_::do_non_rt_work_f() {
-    if (get_flags & GET_SOUNDFONT) {
-        if (xsynth.load_soundfont(soundfont.data()) == 0) {
+    // a restored session: new fonts are parsed while the old ones keep
+    // playing, then the audio thread hold at a block boundary and the
+    // whole image is applied in this one pass
+    int ready = SESSION_READY;
+    const bool session = session_state.compare_exchange_strong(ready, SESSION_APPLYING,
+                                                               std::memory_order_acq_rel);
+    std::chrono::steady_clock::time_point held;
+    if (session) {
+        prepare_session_image();
+        hold_audio();
+        held = std::chrono::steady_clock::now();
+        apply_session_image();
+    }
+    const bool prefault = get_flags & (GET_SOUNDFONT | GET_FONT_STACK | GET_CHANNEL_FONT |
+                                       GET_CHANNEL_LIST | GET_PREFAULT);
+    const bool new_stack = get_flags & (GET_SOUNDFONT | GET_FONT_STACK | GET_CHANNEL_FONT);
+    // the budget decide how a font get loaded, so set it first. A font
+    // load follow then, it reload the stack in the new mode
+    if(get_flags & GET_SAMPLE_BUDGET) {
+        if (xsynth.set_sample_budget(sample_budget, !(get_flags & (GET_SOUNDFONT | GET_FONT_STACK)))) {
+            for (int i=0;i<16;i++) {
+                instrument_list[i] = xsynth.get_instrument_for_channel(i);
+            }
+            flags |= SEND_INSTRUMENTS | SEND_CHANNEL_LIST;
+        }
+    }
+    apply_pending_programs();
+    if (get_flags & (GET_SOUNDFONT | GET_FONT_STACK)) {
+        int ret = xsynth::LOAD_CANCELLED;
+        int request = font_request.load(std::memory_order_acquire);
+        if (get_flags & GET_FONT_STACK) {
+            xsynth.progress.cancel.store(false, std::memory_order_release);
+            // restore the whole soundfont stack, fonts load in parallel
+            std::vector<std::string> paths;
+            paths.push_back(soundfont.get());
+            std::istringstream buf(font_stack);
+            std::string path;
+            while (std::getline(buf, path)) {
+                if (!path.empty()) paths.push_back(path);
+            }
+            ret = xsynth.load_font_stack(paths);
+            // saved channel routing refers to the restored stack order,
+            // both come from the session image
+            if (session && image.restore_channel_font) {
+                for (int i=0;i<16;i++) {
+                    if (image.channel_font[i] >= 0 && image.channel_font[i] < (int)xsynth.sfonts.size())
+                        xsynth.channel_font[i] = image.channel_font[i];
+                }
+            }
+            get_flags &= ~GET_FONT_STACK;
+        }
+        // a newer soundfont request cancel the load in flight, the
+        // latest requested font is loaded then
+        while (ret == xsynth::LOAD_CANCELLED) {
+            xsynth.progress.cancel.store(false, std::memory_order_release);
+            request = font_request.load(std::memory_order_acquire);
+            const std::string path = soundfont.get();
+            ret = xsynth.load_soundfont(path.data());
+        }
+        if (ret == 0) {
             if (current_instrument < (int)xsynth.instruments.size()) {
                 xsynth.synth_pgm_changed(channel,current_instrument);
             } else {
@@ -949,11 +1739,14 @@ void Fluida_::do_non_rt_work_f() {
             }
             flags |= SEND_SOUNDFONT | SEND_INSTRUMENTS;
         } else {
-            soundfont.clear();
+            font_failed.store(request, std::memory_order_release);
         }
+        get_flags &= ~GET_INSTRUMENT;
         if (get_flags & GET_CHANNEL_LIST) {
+            // only the channels which differ, the font may be unchanged
             for (int i=0;i<16;i++) {
-                xsynth.set_instrument_on_channel(i, instrument_list[i]);
+                if (xsynth.get_instrument_for_channel(i) != instrument_list[i])
+                    xsynth.set_instrument_on_channel(i, instrument_list[i]);
             }
             get_flags &= ~GET_CHANNEL_LIST;
         } else {
@@ -962,6 +1755,20 @@ void Fluida_::do_non_rt_work_f() {
             }
         }
     }
+    if (get_flags & GET_INSTRUMENT) {
+        xsynth.synth_pgm_changed(channel, current_instrument);
+    }
+    if (get_flags & GET_CHANNEL_FONT) {
+        xsynth.progress.cancel.store(false, std::memory_order_release);
+        if (xsynth.load_soundfont_on_channel(font_channel, channel_font_path.data()) == 0) {
+            // indices in the merged instrument list may have moved
+            for (int i=0;i<16;i++) {
+                instrument_list[i] = xsynth.get_instrument_for_channel(i);
+            }
+            current_instrument = instrument_list[0];
+            flags |= SEND_INSTRUMENTS | SEND_CHANNEL_LIST | SET_INSTRUMENT;
+        }
+    }
     if (get_flags & GET_SCL) {
         std::ifstream _scale;
         _scale.open(scl_file.data());
@@ -1007,6 +1814,369 @@ void Fluida_::do_non_rt_work_f() {
             else tuning = 0.0;
         }
     }
+    if(get_flags & GET_VOICE_POLICY) {
+        xsynth.set_voice_priority();
+    }
+    if(get_flags & GET_MIDI_FILE) {
+        load_midi_file();
+    }
+    if (xsynth.sample_budget > 0 || (get_flags & GET_SAMPLE_BUDGET)) update_sample_status();
+    if(get_flags & GET_CHANNEL_METER) {
+        xsynth.set_channel_meter(meter_on.load(std::memory_order_acquire));
+    }
+    if(get_flags & GET_PARTITIONS) {
+        // report back what could be set up
+        const int p = xsynth.set_partitions(partitions);
+        if (p != partitions) {
+            partitions = p;
+            touch_controller(CTL_PARTITIONS);
+        }
+    }
+    if (session) {
+        const std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+        session_state.store(SESSION_APPLIED, std::memory_order_release);
+        release_audio();
+        fprintf(stderr, "Fluida: session restored in %.1f ms, audio held for %.1f ms\n",
+                std::chrono::duration<double, std::milli>(done - image.started).count(),
+                std::chrono::duration<double, std::milli>(done - held).count());
+    }
+    if (prefault) prefault_presets();
+    if (prefault || (get_flags & GET_MEMORY_POLICY)) apply_memory_policy();
+    if ((get_flags & GET_IDLE_UNLOAD) && idle_unload > 0) release_idle_samples();
+    if (prefault || (get_flags & (GET_INSTRUMENT | GET_SAMPLE_BUDGET | GET_MEMORY_POLICY)))
+        update_footprint(new_stack);
+}
+
+// snapshot of the running state, restore_state() overwrite the stored values
+void Fluida_::capture_session_image() {
+    image.soundfont = soundfont.get();
+    image.font_stack = font_stack;
+    image.scl_file = scl_file;
+    image.midi_file = midi_file.get();
+    image.hot_list = hot_list.get();
+    image.channel = channel;
+    image.current_instrument = current_instrument;
+    memcpy(image.instrument_list, instrument_list, sizeof(instrument_list));
+    memcpy(image.voices[0], xsynth.voices.min_voices, sizeof(image.voices[0]));
+    memcpy(image.voices[1], xsynth.voices.max_voices, sizeof(image.voices[1]));
+    memcpy(image.voices[2], xsynth.voices.priority, sizeof(image.voices[2]));
+    image.vel = vel;
+    image.partitions = partitions;
+    image.sample_budget = sample_budget;
+    image.idle_unload = idle_unload;
+    image.player_on = player_on;
+    image.tuning = tuning;
+    image.finetuning = finetuning;
+    memcpy(image.scala_vec, scala_vec, sizeof(scala_vec));
+    image.scala = false;
+    memcpy(image.midi_cc, midi_cc, sizeof(midi_cc));
+    image.reverb_on = xsynth.reverb_on;
+    image.reverb_level = xsynth.reverb_level;
+    image.reverb_width = xsynth.reverb_width;
+    image.reverb_damp = xsynth.reverb_damp;
+    image.reverb_roomsize = xsynth.reverb_roomsize;
+    image.chorus_on = xsynth.chorus_on;
+    image.chorus_type = xsynth.chorus_type;
+    image.chorus_depth = xsynth.chorus_depth;
+    image.chorus_speed = xsynth.chorus_speed;
+    image.chorus_level = xsynth.chorus_level;
+    image.chorus_voices = xsynth.chorus_voices;
+    image.channel_pressure = xsynth.channel_pressure;
+    image.volume_level = xsynth.volume_level;
+    image.smooth_time = xsynth.smooth_time;
+    image.smooth_mode = xsynth.smooth_mode;
+    image.memory_policy = xsynth.memory_policy;
+    image.master_mode = master.mode;
+    image.master_ceiling = master.ceiling;
+    image.master_release = master.release;
+    image.dither_bits = master.dither_bits;
+    image.restore_channel_font = false;
+    image.what = 0;
+    image.changed = 0;
+}
+
+// the slow part of a restore, done while the running synth still play
+void Fluida_::prepare_session_image() {
+    if (!(image.what & (GET_SOUNDFONT | GET_FONT_STACK))) return;
+    // fonts are prepared for the restored sample budget
+    if (image.what & GET_SAMPLE_BUDGET) xsynth.set_sample_budget(image.sample_budget, false);
+    std::vector<std::string> paths;
+    paths.push_back(image.soundfont);
+    if (image.what & GET_FONT_STACK) {
+        std::istringstream buf(image.font_stack);
+        std::string path;
+        while (std::getline(buf, path)) {
+            if (!path.empty()) paths.push_back(path);
+        }
+    }
+    xsynth.prepare_font_stack(paths);
+}
+
+// the audio thread hold, move the image to the running values
+void Fluida_::apply_session_image() {
+    soundfont.set(image.soundfont.data());
+    font_request.fetch_add(1, std::memory_order_release);
+    font_stack = image.font_stack;
+    scl_file = image.scl_file;
+    midi_file.set(image.midi_file.data());
+    midi_request.fetch_add(1, std::memory_order_release);
+    hot_list.set(image.hot_list.data());
+    channel = image.channel;
+    current_instrument = image.current_instrument;
+    memcpy(instrument_list, image.instrument_list, sizeof(instrument_list));
+    memcpy(xsynth.voices.min_voices, image.voices[0], sizeof(image.voices[0]));
+    memcpy(xsynth.voices.max_voices, image.voices[1], sizeof(image.voices[1]));
+    memcpy(xsynth.voices.priority, image.voices[2], sizeof(image.voices[2]));
+    vel = image.vel;
+    partitions = image.partitions;
+    sample_budget = image.sample_budget;
+    idle_unload = image.idle_unload;
+    player_on = image.player_on;
+    tuning = image.tuning;
+    finetuning = image.finetuning;
+    if (image.scala) {
+        memcpy(scala_vec, image.scala_vec, sizeof(scala_vec));
+        xsynth.scala_ratios.clear();
+        xsynth.scala_size = 128;
+        for (unsigned int i = 0; i < 128; i++) {
+            if (scala_vec[i] == 0) {
+                xsynth.scala_size = i;
+                break;
+            }
+            xsynth.scala_ratios.push_back(scala_vec[i]);
+        }
+    }
+    memcpy(midi_cc, image.midi_cc, sizeof(midi_cc));
+    xsynth.reverb_on = image.reverb_on;
+    xsynth.reverb_level = image.reverb_level;
+    xsynth.reverb_width = image.reverb_width;
+    xsynth.reverb_damp = image.reverb_damp;
+    xsynth.reverb_roomsize = image.reverb_roomsize;
+    xsynth.chorus_on = image.chorus_on;
+    xsynth.chorus_type = image.chorus_type;
+    xsynth.chorus_depth = image.chorus_depth;
+    xsynth.chorus_speed = image.chorus_speed;
+    xsynth.chorus_level = image.chorus_level;
+    xsynth.chorus_voices = image.chorus_voices;
+    xsynth.channel_pressure = image.channel_pressure;
+    xsynth.volume_level = image.volume_level;
+    xsynth.smooth_time = image.smooth_time;
+    xsynth.smooth_mode = image.smooth_mode;
+    xsynth.memory_policy = image.memory_policy;
+    master.mode = image.master_mode;
+    master.ceiling = image.master_ceiling;
+    master.release = image.master_release;
+    master.dither_bits = image.dither_bits;
+    get_flags |= image.what;
+    for (int i = 0; i < CTL_FIELDS; i++) {
+        if (image.changed & (1u << i)) touch_controller(i);
+    }
+}
+
+// stop the audio thread at the next block boundary, it doesn't touch
+// the synth until release_audio(). The hold is active once the audio
+// thread acknowledged it at the end of a block, or deactivate() did.
+// Nested holds are counted.
+void Fluida_::hold_audio() {
+    if (hold_depth++) return;
+    hold_state.store(HOLD_REQUEST);
+    // a deactivated plugin get no block to acknowledge it, and hosts
+    // may run the worker on the audio thread while freewheeling
+    if (!dsp_running.load() || std::this_thread::get_id() == dsp_id) {
+        int expected = HOLD_REQUEST;
+        hold_state.compare_exchange_strong(expected, HOLD_ACTIVE);
+    }
+    while (hold_state.load(std::memory_order_acquire) != HOLD_ACTIVE) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void Fluida_::release_audio() {
+    if (--hold_depth) return;
+    hold_state.store(HOLD_NONE, std::memory_order_release);
+}
+
+void Fluida_::audio_hold(void* data, bool hold) {
+    Fluida_ *self = static_cast<Fluida_*>(data);
+    if (hold) self->hold_audio();
+    else self->release_audio();
+}
+
+// bring the presets in use and the hot list into memory
+void Fluida_::schedule_prefault() {
+    doit = 1;
+    get_flags |= GET_PREFAULT;
+    if (use_worker.load(std::memory_order_acquire)) {
+        schedule->schedule_work(schedule->handle, sizeof(int), &doit);
+    } else {
+        flworker.cv.notify_one();
+    }
+}
+
+// with a sample budget selecting a preset may read it's samples from
+// disk, program changes are left to the worker then
+void Fluida_::queue_program(int channel, int pgm, int inst) {
+    pending_program[channel].store(pgm >= 0 ? pgm : PENDING_INSTRUMENT | inst,
+                                   std::memory_order_release);
+    doit = 1;
+    if (use_worker.load(std::memory_order_acquire)) {
+        schedule->schedule_work(schedule->handle, sizeof(int), &doit);
+    } else {
+        flworker.cv.notify_one();
+    }
+}
+
+void Fluida_::apply_pending_programs() {
+    bool changed = false;
+    for (int i=0;i<16;i++) {
+        const int p = pending_program[i].exchange(-1, std::memory_order_acq_rel);
+        if (p < 0) continue;
+        if (p & PENDING_INSTRUMENT) xsynth.set_instrument_on_channel(i, p & ~PENDING_INSTRUMENT);
+        else xsynth.synth_pgm_changed(i, p);
+        changed = true;
+    }
+    if (!changed) return;
+    for (int i=0;i<16;i++) {
+        instrument_list[i] = xsynth.get_instrument_for_channel(i);
+    }
+    current_instrument = instrument_list[0];
+    flags |= SEND_CHANNEL_LIST | SET_INSTRUMENT;
+}
+
+void Fluida_::update_sample_status() {
+    sample_status[0] = xsynth.sample_budget > 0 ? xsynth.selected_bytes() / 1024 : 0;
+    sample_status[1] = xsynth.sample_budget * 1024;
+    sample_status[2] = xsynth.budget_refused.load(std::memory_order_relaxed);
+    sample_status[3] = xsynth.late_notes.load(std::memory_order_relaxed);
+    sample_send.store(true, std::memory_order_release);
+}
+
+// the per channel render cost some, it's only done while the UI show
+// the channel levels. The worker build the synth engines for it, true
+// when there is work to schedule.
+bool Fluida_::set_channel_meter(bool on) {
+    if (meter_on.load(std::memory_order_relaxed) == on) return false;
+    meter_on.store(on, std::memory_order_release);
+    get_flags |= GET_CHANNEL_METER;
+    return true;
+}
+
+// the per preset and per bank sample bytes, only the biggest go to the UI.
+// They change with the soundfont stack, else only the channel sums are
+// new and the rest of the table is kept.
+void Fluida_::update_footprint(bool full) {
+    xsynth::Footprint fp;
+    if (!full) {
+        xsynth.get_assigned_footprint(fp);
+        footprint[0] = fp.assigned / 1024;
+        footprint[1] = fp.assigned_resident / 1024;
+        footprint_send.store(true, std::memory_order_release);
+        return;
+    }
+    xsynth.get_footprint(fp);
+    std::vector<std::pair<size_t, int> > presets;
+    for (size_t i = 0; i < fp.presets.size(); i++) {
+        presets.push_back(std::make_pair(fp.presets[i].bytes, (int)i));
+    }
+    std::vector<std::pair<size_t, int> > banks;
+    for (auto& b : fp.banks) banks.push_back(std::make_pair(b.bytes, b.bank));
+    std::sort(presets.rbegin(), presets.rend());
+    std::sort(banks.rbegin(), banks.rend());
+    footprint[0] = fp.assigned / 1024;
+    footprint[1] = fp.assigned_resident / 1024;
+    footprint[2] = fp.total / 1024;
+    for (int i = 0; i < FOOTPRINT_TOP; i++) {
+        const bool used = i < (int)presets.size();
+        footprint[3 + 2 * i] = used ? presets[i].second : -1;
+        footprint[4 + 2 * i] = used ? presets[i].first / 1024 : 0;
+    }
+    for (int i = 0; i < FOOTPRINT_BANKS; i++) {
+        const bool used = i < (int)banks.size();
+        footprint[3 + 2 * FOOTPRINT_TOP + 2 * i] = used ? banks[i].second : -1;
+        footprint[4 + 2 * FOOTPRINT_TOP + 2 * i] = used ? banks[i].first / 1024 : 0;
+    }
+    footprint_send.store(true, std::memory_order_release);
+}
+
+// page out the samples of presets idle for idle_unload seconds
+void Fluida_::release_idle_samples() {
+    const bool wait = std::this_thread::get_id() != dsp_id;
+    const size_t released = xsynth.release_idle_samples(idle_unload, wait);
+    if (!released) return;
+    prefault_status[2] = xsynth.resident_bytes() / 1024;
+    prefault_send.store(true, std::memory_order_release);
+    update_footprint(false);
+}
+
+// load the midi file to the slot the audio thread isn't playing, and
+// hand it over. A slot is reused after the audio thread left it, when
+// it doesn't run to leave it the audio thread is held for the load.
+void Fluida_::load_midi_file() {
+    const int request = midi_request.load(std::memory_order_acquire);
+    const std::string path = midi_file.get();
+    if (path.empty()) {
+        midi_slot.store(-1, std::memory_order_release);
+        return;
+    }
+    const int s = midi_slot.load(std::memory_order_acquire) == 0 ? 1 : 0;
+    for (int i = 0; i < 100 && midi_in_use.load(std::memory_order_acquire) == s; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const bool in_use = midi_in_use.load(std::memory_order_acquire) == s;
+    if (in_use) hold_audio();
+    const bool loaded = midi_files[s].load(path.data());
+    if (loaded) midi_slot.store(s, std::memory_order_release);
+    if (in_use) release_audio();
+    if (!loaded) {
+        fprintf(stderr, "Fluida: could not load midi file %s\n", path.data());
+        // the audio thread clear the path and send it
+        midi_failed.store(request, std::memory_order_release);
+        flags |= SET_PLAYER;
+    }
+}
+
+void Fluida_::apply_memory_policy() {
+    xsynth::MemoryStatus status;
+    const int node = xsynth::XSynth::get_cpu_node(dsp_cpu.load(std::memory_order_relaxed));
+    xsynth.apply_memory_policy(node, status);
+    memory_status[0] = status.policy;
+    memory_status[1] = status.locked / 1024;
+    memory_status[2] = status.total / 1024;
+    memory_status[3] = status.huge / 1024;
+    memory_status[4] = status.node;
+    memory_send.store(true, std::memory_order_release);
+}
+
+// bring the sample data of the presets in use, and the presets from
+// the hot list, into memory, before the first note hit them.
+void Fluida_::prefault_presets() {
+    std::vector<xsynth::PresetRef> refs;
+    auto add = [&refs](const xsynth::PresetRef& r) {
+        for (auto& i : refs) {
+            if (i.font == r.font && i.bank == r.bank && i.program == r.program) return;
+        }
+        refs.push_back(r);
+    };
+    xsynth::PresetRef ref;
+    for (int i=0;i<16;i++) {
+        if (xsynth.get_preset_ref(instrument_list[i], ref)) add(ref);
+    }
+    // the hot list holds "bank program" pairs, looked up in every font
+    std::istringstream buf(hot_list.get());
+    while (buf >> ref.bank >> ref.program) {
+        for (ref.font = 0; ref.font < (int)xsynth.sfonts.size(); ref.font++) {
+            if (xsynth.sfonts[ref.font].map.find_preset(ref.bank, ref.program)) add(ref);
+        }
+    }
+    prefault_status[0] = 0;
+    prefault_status[1] = refs.size();
+    for (auto& r : refs) {
+        xsynth.prefault_preset(r);
+        prefault_status[0]++;
+        prefault_send.store(true, std::memory_order_release);
+    }
+    prefault_status[2] = xsynth.resident_bytes() / 1024;
+    prefault_send.store(true, std::memory_order_release);
 }
 
 void Fluida_::do_non_rt_work(Fluida_ *fl) {
@@ -1068,11 +2238,17 @@ Fluida_::instantiate(const LV2_Descriptor* descriptor,
 
     LV2_URID_Map* map = NULL;
     LV2_Worker_Schedule*      schedule = NULL;
+    const LV2_Options_Option* options = NULL;
+    bool pow2 = false;
     for (int i = 0; features[i]; ++i) {
         if (!strcmp(features[i]->URI, LV2_URID__map)) {
             map = (LV2_URID_Map*)features[i]->data;
         } else if (!strcmp(features[i]->URI, LV2_WORKER__schedule)) {
             schedule = (LV2_Worker_Schedule*)features[i]->data;
+        } else if (!strcmp(features[i]->URI, LV2_OPTIONS__options)) {
+            options = (const LV2_Options_Option*)features[i]->data;
+        } else if (!strcmp(features[i]->URI, LV2_BUF_SIZE__powerOf2BlockLength)) {
+            pow2 = true;
         }
     }
     if (!map) {
@@ -1096,6 +2272,23 @@ Fluida_::instantiate(const LV2_Descriptor* descriptor,
         self->schedule = schedule;
     }
 
+    // size the scratch buffers from the block length the host will use
+    if (options) {
+        const LV2_URID max_block = map->map(map->handle, LV2_BUF_SIZE__maxBlockLength);
+        const LV2_URID nominal_block = map->map(map->handle, LV2_BUF_SIZE__nominalBlockLength);
+        uint32_t max_len = 0;
+        uint32_t nominal_len = 0;
+        for (const LV2_Options_Option* o = options; o->key; ++o) {
+            if (o->type != self->uris.atom_Int || o->size != sizeof(int32_t)) continue;
+            const int32_t len = *(const int32_t*)o->value;
+            if (len <= 0) continue;
+            if (o->key == max_block) max_len = (uint32_t)len;
+            else if (o->key == nominal_block) nominal_len = (uint32_t)len;
+        }
+        self->block_length = max_len ? max_len : nominal_len;
+        self->block_pow2 = pow2 && self->block_length;
+    }
+
     self->init_dsp_((uint32_t)rate);
 
     return (LV2_Handle)self;
@@ -1123,7 +2316,7 @@ void Fluida_::store_ctrl_values_array(LV2_State_Store_Function store,
     instrumentVector ivec;
     ivec.child_type = uris->atom_Int;
     ivec.child_size = sizeof(int);
-    memcpy(ivec.ratio, instrument_list, sizeof(instrument_list));
+    memcpy(ivec.ratio, vec, sizeof(ivec.ratio));
     store(handle,urid,(void*)&ivec, sizeof(ivec),
           uris->atom_Vector, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
 }
@@ -1159,7 +2352,8 @@ LV2_State_Status Fluida_::save_state(LV2_Handle instance,
     Fluida_* self = static_cast<Fluida_*>(instance);
     FluidaLV2URIs* uris = &self->uris;
 
-    store(handle,uris->atom_Path,self->soundfont.data(), strlen(self->soundfont.data()) + 1,
+    const std::string soundfont = self->soundfont.get();
+    store(handle,uris->atom_Path,soundfont.data(), soundfont.size() + 1,
           uris->atom_String, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
 
     self->store_ctrl_values(store, handle,uris->fluida_rev_lev,(float)self->xsynth.reverb_level);
@@ -1178,6 +2372,16 @@ LV2_State_Status Fluida_::save_state(LV2_Handle instance,
     self->store_ctrl_values_int(store, handle,uris->fluida_channel_pressure, (int)self->xsynth.channel_pressure);
     self->store_ctrl_values(store, handle,uris->fluida_gain, (float)self->xsynth.volume_level);
     self->store_ctrl_values_int(store, handle,uris->fluida_velocity, (int)self->vel);
+    self->store_ctrl_values_int(store, handle,uris->fluida_memory_policy, (int)self->xsynth.memory_policy);
+    self->store_ctrl_values_int(store, handle,uris->fluida_partitions, (int)self->partitions);
+    self->store_ctrl_values_int(store, handle,uris->fluida_sample_budget, (int)self->sample_budget);
+    self->store_ctrl_values_int(store, handle,uris->fluida_idle_unload, (int)self->idle_unload);
+    self->store_ctrl_values(store, handle,uris->fluida_smooth_time, (float)self->xsynth.smooth_time);
+    self->store_ctrl_values_int(store, handle,uris->fluida_smooth_mode, (int)self->xsynth.smooth_mode);
+    self->store_ctrl_values_int(store, handle,uris->fluida_master_mode, (int)self->master.mode);
+    self->store_ctrl_values(store, handle,uris->fluida_master_ceiling, (float)self->master.ceiling);
+    self->store_ctrl_values(store, handle,uris->fluida_master_release, (float)self->master.release);
+    self->store_ctrl_values_int(store, handle,uris->fluida_dither_bits, (int)self->master.dither_bits);
 
     self->store_ctrl_values(store, handle,uris->fluida_finetuning, (float)self->finetuning);
 
@@ -1185,6 +2389,28 @@ LV2_State_Status Fluida_::save_state(LV2_Handle instance,
     self->store_ctrl_values_int(store, handle,uris->fluida_instrument, (int)self->current_instrument);
     self->store_ctrl_values_array(store, handle,uris->fluida_channel_list, self->instrument_list);
 
+    std::string stack;
+    for (size_t i = 1; i < self->xsynth.sfonts.size(); i++) {
+        stack += self->xsynth.sfonts[i].path + "\n";
+    }
+    store(handle,uris->fluida_font_stack,stack.data(), strlen(stack.data()) + 1,
+          uris->atom_String, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+    self->store_ctrl_values_array(store, handle,uris->fluida_channel_font, self->xsynth.channel_font);
+    self->store_ctrl_values_array(store, handle,uris->fluida_voice_min, self->xsynth.voices.min_voices);
+    self->store_ctrl_values_array(store, handle,uris->fluida_voice_max, self->xsynth.voices.max_voices);
+    self->store_ctrl_values_array(store, handle,uris->fluida_voice_priority, self->xsynth.voices.priority);
+
+    const std::string hot_list = self->hot_list.get();
+    store(handle,uris->fluida_hot_list,hot_list.data(), hot_list.size() + 1,
+          uris->atom_String, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+
+    self->store_ctrl_values_int(store, handle,uris->fluida_player_on, (int)self->player_on);
+    const std::string midi_file = self->midi_file.get();
+    if (!midi_file.empty()) {
+        store(handle,uris->fluida_midi_file,midi_file.data(), midi_file.size() + 1,
+              uris->atom_Path, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+    }
+
     if (self->xsynth.scala_size > 1) {
         store(handle,uris->fluida_scl,self->scl_file.data(), strlen(self->scl_file.data()) + 1,
           uris->atom_String, LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
@@ -1215,6 +2441,24 @@ LV2_State_Status Fluida_::restore_state(LV2_Handle instance,
 
     Fluida_* self = static_cast<Fluida_*>(instance);
     FluidaLV2URIs* uris = &self->uris;
+    // a image the worker didn't take yet is replaced, while the worker
+    // apply one we wait for it to finish
+    bool taken = false;
+    for (int i = 0; !taken && i < 5000; i++) {
+        int state = self->session_state.load(std::memory_order_acquire);
+        if (state == SESSION_FILLING || state == SESSION_APPLYING) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        taken = self->session_state.compare_exchange_strong(state, SESSION_FILLING,
+                                                            std::memory_order_acq_rel);
+    }
+    if (!taken) {
+        fprintf(stderr, "Fluida: the last session is still restored, state not applied\n");
+        return LV2_STATE_ERR_UNKNOWN;
+    }
+    self->capture_session_image();
+    self->image.started = std::chrono::steady_clock::now();
 
     size_t      size;
     uint32_t    type;
@@ -1222,152 +2466,236 @@ LV2_State_Status Fluida_::restore_state(LV2_Handle instance,
     const void* name = retrieve(handle, uris->atom_Path, &size, &type, &fflags);
 
     if (name) {
-        self->soundfont = (const char*)(name);
-        if (!self->soundfont.empty())
-            self->get_flags |= GET_SOUNDFONT;
+        self->image.soundfont = (const char*)(name);
+        if (!self->image.soundfont.empty())
+            self->image.what |= GET_SOUNDFONT;
     }
 
     float* value = NULL;
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_rev_lev);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.reverb_level)) {
-            self->flags |= SET_REV_LEV;
-            self->xsynth.reverb_level =  *((float *)value);
-            self->get_flags |= GET_REVERB_LEVELS;
+            self->image.changed |= 1u << CTL_REV_LEV;
+            self->image.reverb_level =  *((float *)value);
+            self->image.what |= GET_REVERB_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_rev_width);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.reverb_width)) {
-            self->flags |= SET_REV_WIDTH;
-            self->xsynth.reverb_width =  *((float *)value);
-            self->get_flags |= GET_REVERB_LEVELS;
+            self->image.changed |= 1u << CTL_REV_WIDTH;
+            self->image.reverb_width =  *((float *)value);
+            self->image.what |= GET_REVERB_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_rev_damp);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.reverb_damp)) {
-            self->flags |= SET_REV_DAMP;
-            self->xsynth.reverb_damp =  *((float *)value);
-            self->get_flags |= GET_REVERB_LEVELS;
+            self->image.changed |= 1u << CTL_REV_DAMP;
+            self->image.reverb_damp =  *((float *)value);
+            self->image.what |= GET_REVERB_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_rev_size);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.reverb_roomsize)) {
-            self->flags |= SET_REV_SIZE;
-            self->xsynth.reverb_roomsize =  *((float *)value);
-            self->get_flags |= GET_REVERB_LEVELS;
+            self->image.changed |= 1u << CTL_REV_SIZE;
+            self->image.reverb_roomsize =  *((float *)value);
+            self->image.what |= GET_REVERB_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_rev_on);
     if (value) {
         if (*((int *)value) != self->xsynth.reverb_on) {
-            self->flags |= SET_REV_ON;
-            self->xsynth.reverb_on =  *((int *)value);
-            self->get_flags |= GET_REVERB_ON;
+            self->image.changed |= 1u << CTL_REV_ON;
+            self->image.reverb_on =  *((int *)value);
+            self->image.what |= GET_REVERB_ON;
         }
     }
 
 
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_memory_policy);
+    if (value) {
+        if (*((int *)value) != self->xsynth.memory_policy) {
+            self->image.changed |= 1u << CTL_MEMORY_POLICY;
+            self->image.memory_policy =  *((int *)value);
+            self->image.what |= GET_MEMORY_POLICY;
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_smooth_time);
+    if (value) {
+        if (!FLOAT_EQUAL(*((float *)value), self->xsynth.smooth_time)) {
+            self->image.changed |= 1u << CTL_SMOOTH_TIME;
+            self->image.smooth_time =  *((float *)value);
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_smooth_mode);
+    if (value) {
+        if (*((int *)value) != self->xsynth.smooth_mode) {
+            self->image.changed |= 1u << CTL_SMOOTH_MODE;
+            self->image.smooth_mode =  *((int *)value);
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_master_mode);
+    if (value) {
+        if (*((int *)value) != self->master.mode) {
+            self->image.changed |= 1u << CTL_MASTER_MODE;
+            self->image.master_mode =  *((int *)value);
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_master_ceiling);
+    if (value) {
+        if (!FLOAT_EQUAL(*((float *)value), self->master.ceiling)) {
+            self->image.changed |= 1u << CTL_MASTER_CEILING;
+            self->image.master_ceiling =  *((float *)value);
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_master_release);
+    if (value) {
+        if (!FLOAT_EQUAL(*((float *)value), self->master.release)) {
+            self->image.changed |= 1u << CTL_MASTER_RELEASE;
+            self->image.master_release =  *((float *)value);
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_dither_bits);
+    if (value) {
+        if (*((int *)value) != self->master.dither_bits) {
+            self->image.changed |= 1u << CTL_DITHER_BITS;
+            self->image.dither_bits =  *((int *)value);
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_partitions);
+    if (value) {
+        if (*((int *)value) != self->partitions) {
+            self->image.changed |= 1u << CTL_PARTITIONS;
+            self->image.partitions =  *((int *)value);
+            self->image.what |= GET_PARTITIONS;
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_sample_budget);
+    if (value) {
+        if (*((int *)value) != self->sample_budget) {
+            self->image.changed |= 1u << CTL_SAMPLE_BUDGET;
+            self->image.sample_budget =  *((int *)value);
+            self->image.what |= GET_SAMPLE_BUDGET;
+        }
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_idle_unload);
+    if (value) {
+        if (*((int *)value) != self->idle_unload) {
+            self->image.changed |= 1u << CTL_IDLE_UNLOAD;
+            self->image.idle_unload =  *((int *)value);
+            self->image.what |= GET_IDLE_UNLOAD;
+        }
+    }
+
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_chorus_type);
     if (value) {
         if (*((int *)value) != self->xsynth.chorus_type) {
-            self->flags |= SET_CHORUS_TYPE;
-            self->xsynth.chorus_type =  *((int *)value);
-            self->get_flags |= GET_CHORUS_LEVELS;
+            self->image.changed |= 1u << CTL_CHORUS_TYPE;
+            self->image.chorus_type =  *((int *)value);
+            self->image.what |= GET_CHORUS_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_chorus_depth);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.chorus_depth)) {
-            self->flags |= SET_CHORUS_DEPTH;
-            self->xsynth.chorus_depth =  *((float *)value);
-            self->get_flags |= GET_CHORUS_LEVELS;
+            self->image.changed |= 1u << CTL_CHORUS_DEPTH;
+            self->image.chorus_depth =  *((float *)value);
+            self->image.what |= GET_CHORUS_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_chorus_speed);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.chorus_speed)) {
-            self->flags |= SET_CHORUS_SPEED;
-            self->xsynth.chorus_speed =  *((float *)value);
-            self->get_flags |= GET_CHORUS_LEVELS;
+            self->image.changed |= 1u << CTL_CHORUS_SPEED;
+            self->image.chorus_speed =  *((float *)value);
+            self->image.what |= GET_CHORUS_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_chorus_lev);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.chorus_level)) {
-            self->flags |= SET_CHORUS_LEV;
-            self->xsynth.chorus_level =  *((float *)value);
-            self->get_flags |= GET_CHORUS_LEVELS;
+            self->image.changed |= 1u << CTL_CHORUS_LEV;
+            self->image.chorus_level =  *((float *)value);
+            self->image.what |= GET_CHORUS_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_chorus_voices);
     if (value) {
         if (*((int *)value) != self->xsynth.chorus_voices) {
-            self->flags |= SET_CHORUS_VOICES;
-            self->xsynth.chorus_voices =  *((int *)value);
-            self->get_flags |= GET_CHORUS_LEVELS;
+            self->image.changed |= 1u << CTL_CHORUS_VOICES;
+            self->image.chorus_voices =  *((int *)value);
+            self->image.what |= GET_CHORUS_LEVELS;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_chorus_on);
     if (value) {
         if (*((int *)value) != self->xsynth.chorus_on) {
-            self->flags |= SET_CHORUS_ON;
-            self->xsynth.chorus_on =  *((int *)value);
-            self->get_flags |= GET_CHORUS_ON;
+            self->image.changed |= 1u << CTL_CHORUS_ON;
+            self->image.chorus_on =  *((int *)value);
+            self->image.what |= GET_CHORUS_ON;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_channel_pressure);
     if (value) {
         if (*((int *)value) != self->xsynth.channel_pressure) {
-            self->flags |= SET_CHANNEL_PRES;
-            self->xsynth.channel_pressure =  *((int *)value);
-            self->get_flags |= GET_CHANNEL_PRESSURE;
+            self->image.changed |= 1u << CTL_CHANNEL_PRES;
+            self->image.channel_pressure =  *((int *)value);
+            self->image.what |= GET_CHANNEL_PRESSURE;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_gain);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value), self->xsynth.volume_level)) {
-            self->flags |= SET_GAIN;
-            self->xsynth.volume_level =  *((float *)value);
-            self->get_flags |= GET_GAIN ;
+            self->image.changed |= 1u << CTL_GAIN;
+            self->image.volume_level =  *((float *)value);
+            self->image.what |= GET_GAIN ;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_velocity);
     if (value) {
         if (*((int *)value) != self->vel) {
-            self->flags |= SET_VELOCITY;
-            self->vel =  *((int *)value);
-            self->get_flags |= GET_VELOCITY;
+            self->image.changed |= 1u << CTL_VELOCITY;
+            self->image.vel =  *((int *)value);
+            self->image.what |= GET_VELOCITY;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_finetuning);
     if (value) {
         if (!FLOAT_EQUAL(*((float *)value),self->finetuning)) {
-            self->flags |= SET_FINETUNING;
-            self->finetuning =  *((float *)value);
-            self->get_flags |= GET_FINETUNING;
+            self->image.changed |= 1u << CTL_FINETUNING;
+            self->image.finetuning =  *((float *)value);
+            self->image.what |= GET_FINETUNING;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_channel);
     if (value) {
         if (*((int *)value) != self->channel) {
-            self->channel =  *((int *)value);
+            self->image.channel =  *((int *)value);
         }
     }
 
@@ -1375,61 +2703,105 @@ LV2_State_Status Fluida_::restore_state(LV2_Handle instance,
     if (value) {
         if (*((int *)value) != self->current_instrument) {
             self->flags |= SET_INSTRUMENT;
-            self->current_instrument =  *((int *)value);
-            self->xsynth.synth_pgm_changed(self->channel, self->current_instrument);
+            self->image.current_instrument =  *((int *)value);
+            self->image.what |= GET_INSTRUMENT;
         }
     }
 
     const void *vec = retrieve(handle, uris->fluida_channel_list, &size, &type, &fflags);
     if (vec && size == sizeof (LV2_Atom) + sizeof (self->instrument_list)  && type == uris->atom_Vector) {
         if (((LV2_Atom*)vec)->type == uris->atom_Int) {
-            memcpy (self->instrument_list, LV2_ATOM_BODY (vec), sizeof(self->instrument_list));
-            self->current_instrument = 0;
+            memcpy (self->image.instrument_list, LV2_ATOM_BODY (vec), sizeof(self->instrument_list));
+            self->image.current_instrument = 0;
             self->flags |= SET_INSTRUMENT;
-            self->get_flags |= GET_CHANNEL_LIST;
+            self->image.what |= GET_CHANNEL_LIST;
+        }
+    }
+
+    name = retrieve(handle, uris->fluida_font_stack, &size, &type, &fflags);
+    if (name) {
+        self->image.font_stack = (const char*)(name);
+        if ((self->image.what & GET_SOUNDFONT) &&
+                (!self->image.font_stack.empty() || self->xsynth.sfonts.size() > 1))
+            self->image.what |= GET_FONT_STACK;
+    }
+
+    vec = retrieve(handle, uris->fluida_channel_font, &size, &type, &fflags);
+    if (vec && size == sizeof (LV2_Atom) + sizeof (self->xsynth.channel_font)  && type == uris->atom_Vector) {
+        if (((LV2_Atom*)vec)->type == uris->atom_Int) {
+            memcpy (self->image.channel_font, LV2_ATOM_BODY (vec), sizeof(self->image.channel_font));
+            self->image.restore_channel_font = true;
+            if (self->image.what & GET_SOUNDFONT)
+                self->image.what |= GET_FONT_STACK;
+        }
+    }
+
+    const LV2_URID voice_urids[3] = {uris->fluida_voice_min, uris->fluida_voice_max,
+                                     uris->fluida_voice_priority};
+    for (int i = 0; i < 3; i++) {
+        vec = retrieve(handle, voice_urids[i], &size, &type, &fflags);
+        if (vec && size == sizeof (LV2_Atom) + 16 * sizeof(int)  && type == uris->atom_Vector) {
+            if (((LV2_Atom*)vec)->type == uris->atom_Int) {
+                memcpy (self->image.voices[i], LV2_ATOM_BODY (vec), 16 * sizeof(int));
+                self->image.what |= GET_VOICE_POLICY;
+            }
+        }
+    }
+
+    name = retrieve(handle, uris->fluida_hot_list, &size, &type, &fflags);
+    if (name) {
+        self->image.hot_list = (const char*)(name);
+    }
+
+    name = retrieve(handle, uris->fluida_midi_file, &size, &type, &fflags);
+    if (name && type == uris->atom_Path) {
+        self->image.midi_file = (const char*)(name);
+        self->flags |= SET_PLAYER;
+        self->image.what |= GET_MIDI_FILE;
+    }
+
+    value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_player_on);
+    if (value) {
+        if (*((int *)value) != (int)self->player_on) {
+            self->image.changed |= 1u << CTL_PLAYER_ON;
+            self->image.player_on =  *((int *)value);
         }
     }
 
     name = retrieve(handle, uris->fluida_scl, &size, &type, &fflags);
     if (name) {
-        self->scl_file = (const char*)(name);
+        self->image.scl_file = (const char*)(name);
         self->flags |= SEND_SCL_NAME;
-        self->get_flags |= GET_SCL;
+        self->image.what |= GET_SCL;
     }
 
     const void* sc = retrieve(handle, uris->fluida_scl_data, &size, &type, &fflags);
     if (sc && size == sizeof (LV2_Atom) + sizeof (self->scala_vec) && type == uris->atom_Vector) {
         if (((LV2_Atom*)sc)->type == uris->atom_Float) {
-            memcpy (self->scala_vec, LV2_ATOM_BODY (sc), sizeof (self->scala_vec));
-            self->xsynth.scala_ratios.clear();
-            for (int i=0;i<128;i++) self->scala_vec[i] = 0;
-            for (unsigned int i = 0; i < sizeof (self->scala_vec); i++ ){
-                if (self->scala_vec[i] == 0) {
-                    self->xsynth.scala_size = i;
-                    break;
-                }
-                self->xsynth.scala_ratios.push_back(self->scala_vec[i]);
-            }
-            self->tuning = 1.0;
-            self->get_flags |= GET_TUNING;
+            memcpy (self->image.scala_vec, LV2_ATOM_BODY (sc), sizeof (self->scala_vec));
+            self->image.scala = true;
+            self->image.tuning = 1.0;
+            self->image.changed |= 1u << CTL_TUNING;
+            self->image.what |= GET_TUNING;
         }
     }
 
     value = (float *)self->restore_ctrl_values(retrieve,handle, uris->fluida_tuning);
     if (value) {
-        if (*((int *)value) != self->tuning) {
-            self->tuning =  *((int *)value);
-            self->flags |= GET_TUNING;
+        if (!FLOAT_EQUAL(*((float *)value), self->tuning)) {
+            self->image.tuning =  *((float *)value);
+            self->image.changed |= 1u << CTL_TUNING;
         }
     }
 
     const void *mc = retrieve(handle, uris->fluida_midi_controller, &size, &type, &fflags);
     if (mc && size == sizeof (LV2_Atom) + sizeof (self->midi_cc)  && type == uris->atom_Vector) {
-        if (((LV2_Atom*)vec)->type == uris->atom_Int) {
-            memcpy (self->midi_cc, LV2_ATOM_BODY (mc), sizeof(self->midi_cc));
+        if (((LV2_Atom*)mc)->type == uris->atom_Int) {
+            memcpy (self->image.midi_cc, LV2_ATOM_BODY (mc), sizeof(self->midi_cc));
         }
     }
     
+    self->session_state.store(SESSION_READY, std::memory_order_release);
     self->restore_send.store(true, std::memory_order_release);
     return LV2_STATE_SUCCESS;
 }
@@ -1458,6 +2830,8 @@ void Fluida_::activate(LV2_Handle instance) {
 }
 
 void Fluida_::run(LV2_Handle instance, uint32_t n_samples) {
+    // mark the audio thread for the RT safety audit (make rtcheck)
+    RTCHECK_SCOPE;
     // run dsp
     static_cast<Fluida_*>(instance)->run_dsp_(n_samples);
 }
@@ -30,7 +30,9 @@
 #include <lv2/urid/urid.h>
 #include "lv2/patch/patch.h"
 #include "lv2/options/options.h"
+#include "lv2/buf-size/buf-size.h"
 #include "lv2/state/state.h"
+#include "lv2/time/time.h"
 #include "lv2/worker/worker.h"
 
 #define PLUGIN_URI "https://github.com/brummer10/Fluida.lv2"
@@ -68,6 +70,35 @@
 #define FLUIDA__finetuning          PLUGIN_URI "#finetuning"
 #define FLUIDA__midi_controller     PLUGIN_URI "#midicc"
 #define FLUIDA__velocity            PLUGIN_URI "#velocity"
+#define FLUIDA__font_stack          PLUGIN_URI "#font_stack"
+#define FLUIDA__channel_font        PLUGIN_URI "#channel_font"
+#define FLUIDA__hot_list            PLUGIN_URI "#hot_list"
+#define FLUIDA__prefault            PLUGIN_URI "#prefault"
+#define FLUIDA__memory_policy       PLUGIN_URI "#memory_policy"
+#define FLUIDA__memory_status       PLUGIN_URI "#memory_status"
+#define FLUIDA__load_progress       PLUGIN_URI "#load_progress"
+#define FLUIDA__smooth_time         PLUGIN_URI "#smooth_time"
+#define FLUIDA__smooth_mode         PLUGIN_URI "#smooth_mode"
+#define FLUIDA__master_mode         PLUGIN_URI "#master_mode"
+#define FLUIDA__master_ceiling      PLUGIN_URI "#master_ceiling"
+#define FLUIDA__master_release      PLUGIN_URI "#master_release"
+#define FLUIDA__dither_bits         PLUGIN_URI "#dither_bits"
+#define FLUIDA__gain_reduction      PLUGIN_URI "#gain_reduction"
+#define FLUIDA__silent              PLUGIN_URI "#silent"
+#define FLUIDA__voice_min           PLUGIN_URI "#voice_min"
+#define FLUIDA__voice_max           PLUGIN_URI "#voice_max"
+#define FLUIDA__voice_priority      PLUGIN_URI "#voice_priority"
+#define FLUIDA__partitions          PLUGIN_URI "#partitions"
+#define FLUIDA__sample_budget       PLUGIN_URI "#sample_budget"
+#define FLUIDA__sample_status       PLUGIN_URI "#sample_status"
+#define FLUIDA__idle_unload         PLUGIN_URI "#idle_unload"
+#define FLUIDA__meter               PLUGIN_URI "#meter"
+#define FLUIDA__footprint           PLUGIN_URI "#footprint"
+#define FLUIDA__midi_file           PLUGIN_URI "#midi_file"
+#define FLUIDA__player_on           PLUGIN_URI "#player_on"
+#define FLUIDA__snapshot            PLUGIN_URI "#snapshot"
+#define FLUIDA__snapshot_ack        PLUGIN_URI "#snapshot_ack"
+#define FLUIDA__meter_request       PLUGIN_URI "#meter_request"
 
 typedef struct {
     LV2_URID midi_MidiEvent;
@@ -75,6 +106,8 @@ typedef struct {
     LV2_URID atom_Object;
     LV2_URID atom_Int;
     LV2_URID atom_Float;
+    LV2_URID atom_Double;
+    LV2_URID atom_Long;
     LV2_URID atom_Bool;
     LV2_URID atom_Vector;
     LV2_URID atom_Path;
@@ -111,7 +144,44 @@ typedef struct {
     LV2_URID fluida_finetuning;
     LV2_URID fluida_midi_controller;
     LV2_URID fluida_velocity;
+    LV2_URID fluida_font_stack;
+    LV2_URID fluida_channel_font;
+    LV2_URID fluida_hot_list;
+    LV2_URID fluida_prefault;
+    LV2_URID fluida_memory_policy;
+    LV2_URID fluida_memory_status;
+    LV2_URID fluida_load_progress;
+    LV2_URID fluida_smooth_time;
+    LV2_URID fluida_smooth_mode;
+    LV2_URID fluida_master_mode;
+    LV2_URID fluida_master_ceiling;
+    LV2_URID fluida_master_release;
+    LV2_URID fluida_dither_bits;
+    LV2_URID fluida_gain_reduction;
+    LV2_URID fluida_silent;
+    LV2_URID fluida_voice_min;
+    LV2_URID fluida_voice_max;
+    LV2_URID fluida_voice_priority;
+    LV2_URID fluida_partitions;
+    LV2_URID fluida_sample_budget;
+    LV2_URID fluida_sample_status;
+    LV2_URID fluida_idle_unload;
+    LV2_URID fluida_meter;
+    LV2_URID fluida_footprint;
+    LV2_URID fluida_midi_file;
+    LV2_URID fluida_player_on;
+    LV2_URID fluida_snapshot;
+    LV2_URID fluida_snapshot_ack;
+    LV2_URID fluida_meter_request;
+    LV2_URID time_Position;
+    LV2_URID time_bar;
+    LV2_URID time_barBeat;
+    LV2_URID time_beatUnit;
+    LV2_URID time_beatsPerBar;
+    LV2_URID time_beatsPerMinute;
+    LV2_URID time_speed;
     LV2_URID patch_Put;
+    LV2_URID patch_body;
     LV2_URID patch_Get;
     LV2_URID patch_Set;
     LV2_URID patch_property;
@@ -122,6 +192,8 @@ static inline void map_fluidalv2_uris(LV2_URID_Map* map, FluidaLV2URIs* uris) {
     uris->atom_Object             = map->map(map->handle, LV2_ATOM__Object);
     uris->atom_Int                = map->map(map->handle, LV2_ATOM__Int);
     uris->atom_Float              = map->map(map->handle, LV2_ATOM__Float);
+    uris->atom_Double             = map->map(map->handle, LV2_ATOM__Double);
+    uris->atom_Long               = map->map(map->handle, LV2_ATOM__Long);
     uris->atom_Bool               = map->map(map->handle, LV2_ATOM__Bool);
     uris->atom_Vector             = map->map(map->handle, LV2_ATOM__Vector);
     uris->atom_Path               = map->map(map->handle, LV2_ATOM__Path);
@@ -158,7 +230,44 @@ static inline void map_fluidalv2_uris(LV2_URID_Map* map, FluidaLV2URIs* uris) {
     uris->fluida_finetuning       = map->map(map->handle, FLUIDA__finetuning);
     uris->fluida_midi_controller  = map->map(map->handle, FLUIDA__midi_controller);
     uris->fluida_velocity         = map->map(map->handle, FLUIDA__velocity);
+    uris->fluida_font_stack       = map->map(map->handle, FLUIDA__font_stack);
+    uris->fluida_channel_font     = map->map(map->handle, FLUIDA__channel_font);
+    uris->fluida_hot_list         = map->map(map->handle, FLUIDA__hot_list);
+    uris->fluida_prefault         = map->map(map->handle, FLUIDA__prefault);
+    uris->fluida_memory_policy    = map->map(map->handle, FLUIDA__memory_policy);
+    uris->fluida_memory_status    = map->map(map->handle, FLUIDA__memory_status);
+    uris->fluida_load_progress    = map->map(map->handle, FLUIDA__load_progress);
+    uris->fluida_smooth_time      = map->map(map->handle, FLUIDA__smooth_time);
+    uris->fluida_smooth_mode      = map->map(map->handle, FLUIDA__smooth_mode);
+    uris->fluida_master_mode      = map->map(map->handle, FLUIDA__master_mode);
+    uris->fluida_master_ceiling   = map->map(map->handle, FLUIDA__master_ceiling);
+    uris->fluida_master_release   = map->map(map->handle, FLUIDA__master_release);
+    uris->fluida_dither_bits      = map->map(map->handle, FLUIDA__dither_bits);
+    uris->fluida_gain_reduction   = map->map(map->handle, FLUIDA__gain_reduction);
+    uris->fluida_silent           = map->map(map->handle, FLUIDA__silent);
+    uris->fluida_voice_min        = map->map(map->handle, FLUIDA__voice_min);
+    uris->fluida_voice_max        = map->map(map->handle, FLUIDA__voice_max);
+    uris->fluida_voice_priority   = map->map(map->handle, FLUIDA__voice_priority);
+    uris->fluida_partitions       = map->map(map->handle, FLUIDA__partitions);
+    uris->fluida_sample_budget    = map->map(map->handle, FLUIDA__sample_budget);
+    uris->fluida_sample_status    = map->map(map->handle, FLUIDA__sample_status);
+    uris->fluida_idle_unload      = map->map(map->handle, FLUIDA__idle_unload);
+    uris->fluida_meter            = map->map(map->handle, FLUIDA__meter);
+    uris->fluida_footprint        = map->map(map->handle, FLUIDA__footprint);
+    uris->fluida_midi_file        = map->map(map->handle, FLUIDA__midi_file);
+    uris->fluida_player_on        = map->map(map->handle, FLUIDA__player_on);
+    uris->fluida_snapshot         = map->map(map->handle, FLUIDA__snapshot);
+    uris->fluida_snapshot_ack     = map->map(map->handle, FLUIDA__snapshot_ack);
+    uris->fluida_meter_request    = map->map(map->handle, FLUIDA__meter_request);
+    uris->time_Position           = map->map(map->handle, LV2_TIME__Position);
+    uris->time_bar                = map->map(map->handle, LV2_TIME__bar);
+    uris->time_barBeat            = map->map(map->handle, LV2_TIME__barBeat);
+    uris->time_beatUnit           = map->map(map->handle, LV2_TIME__beatUnit);
+    uris->time_beatsPerBar        = map->map(map->handle, LV2_TIME__beatsPerBar);
+    uris->time_beatsPerMinute     = map->map(map->handle, LV2_TIME__beatsPerMinute);
+    uris->time_speed              = map->map(map->handle, LV2_TIME__speed);
     uris->patch_Put               = map->map(map->handle, LV2_PATCH__Put);
+    uris->patch_body              = map->map(map->handle, LV2_PATCH__body);
     uris->patch_Get               = map->map(map->handle, LV2_PATCH__Get);
     uris->patch_Set               = map->map(map->handle, LV2_PATCH__Set);
     uris->patch_property          = map->map(map->handle, LV2_PATCH__property);
@@ -259,6 +368,232 @@ static inline LV2_Atom* write_set_channel_inst(LV2_Atom_Forge* forge,
     return set;
 }
 
+static inline LV2_Atom* write_set_channel_font(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int channel, const char* filename) {
+    LV2_Atom_Forge_Frame frame;
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_channel_font);
+
+    lv2_atom_forge_key(forge, uris->fluida_channel);
+    lv2_atom_forge_int(forge, channel);
+    lv2_atom_forge_key(forge, uris->patch_value);
+    lv2_atom_forge_path(forge, filename, strlen(filename));
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// prefault progress: presets done, presets total, resident sample data in kB
+static inline LV2_Atom* write_set_prefault(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int *status) {
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(forge, 0);
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_prefault);
+
+    lv2_atom_forge_property_head(forge, uris->atom_Vector,0);
+    lv2_atom_forge_vector(forge, sizeof(int), uris->atom_Int, 3, (void*)status);
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// memory policy result: applied policy, locked kB, total kB, huge page kB, NUMA node
+static inline LV2_Atom* write_set_memory_status(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int *status) {
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(forge, 0);
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_memory_status);
+
+    lv2_atom_forge_property_head(forge, uris->atom_Vector,0);
+    lv2_atom_forge_vector(forge, sizeof(int), uris->atom_Int, 5, (void*)status);
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// sample budget: kB used by the selected presets, budget kB, refused program changes,
+// notes started before the samples of there program were loaded
+static inline LV2_Atom* write_set_sample_status(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int *status) {
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(forge, 0);
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_sample_status);
+
+    lv2_atom_forge_property_head(forge, uris->atom_Vector,0);
+    lv2_atom_forge_vector(forge, sizeof(int), uris->atom_Int, 4, (void*)status);
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// sample footprint: kB of the presets on the channels, resident kB of them,
+// kB of all sample data, then (instrument, kB) of the biggest presets and
+// (bank, kB) of the biggest banks, -1 marks unused pairs
+#define FOOTPRINT_TOP 8
+#define FOOTPRINT_BANKS 8
+#define FOOTPRINT_SIZE (3 + 2 * FOOTPRINT_TOP + 2 * FOOTPRINT_BANKS)
+
+static inline LV2_Atom* write_set_footprint(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int *table) {
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(forge, 0);
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_footprint);
+
+    lv2_atom_forge_property_head(forge, uris->atom_Vector,0);
+    lv2_atom_forge_vector(forge, sizeof(int), uris->atom_Int, FOOTPRINT_SIZE, (void*)table);
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// controller snapshot, the fixed layout of the controller values send to the UI
+enum {
+    CTL_REV_LEV = 0,
+    CTL_REV_WIDTH,
+    CTL_REV_DAMP,
+    CTL_REV_SIZE,
+    CTL_REV_ON,
+    CTL_CHORUS_TYPE,
+    CTL_CHORUS_DEPTH,
+    CTL_CHORUS_SPEED,
+    CTL_CHORUS_LEV,
+    CTL_CHORUS_VOICES,
+    CTL_CHORUS_ON,
+    CTL_CHANNEL_PRES,
+    CTL_GAIN,
+    CTL_VELOCITY,
+    CTL_FINETUNING,
+    CTL_TUNING,
+    CTL_MEMORY_POLICY,
+    CTL_SMOOTH_TIME,
+    CTL_SMOOTH_MODE,
+    CTL_MASTER_MODE,
+    CTL_MASTER_CEILING,
+    CTL_MASTER_RELEASE,
+    CTL_DITHER_BITS,
+    CTL_PARTITIONS,
+    CTL_SAMPLE_BUDGET,
+    CTL_IDLE_UNLOAD,
+    CTL_PLAYER_ON,
+    CTL_FIELDS
+};
+
+// the parameter a snapshot field belongs to
+static inline LV2_URID snapshot_field_urid(const FluidaLV2URIs* uris, int field) {
+    switch (field) {
+        case CTL_REV_LEV:         return uris->fluida_rev_lev;
+        case CTL_REV_WIDTH:       return uris->fluida_rev_width;
+        case CTL_REV_DAMP:        return uris->fluida_rev_damp;
+        case CTL_REV_SIZE:        return uris->fluida_rev_size;
+        case CTL_REV_ON:          return uris->fluida_rev_on;
+        case CTL_CHORUS_TYPE:     return uris->fluida_chorus_type;
+        case CTL_CHORUS_DEPTH:    return uris->fluida_chorus_depth;
+        case CTL_CHORUS_SPEED:    return uris->fluida_chorus_speed;
+        case CTL_CHORUS_LEV:      return uris->fluida_chorus_lev;
+        case CTL_CHORUS_VOICES:   return uris->fluida_chorus_voices;
+        case CTL_CHORUS_ON:       return uris->fluida_chorus_on;
+        case CTL_CHANNEL_PRES:    return uris->fluida_channel_pressure;
+        case CTL_GAIN:            return uris->fluida_gain;
+        case CTL_VELOCITY:        return uris->fluida_velocity;
+        case CTL_FINETUNING:      return uris->fluida_finetuning;
+        case CTL_TUNING:          return uris->fluida_tuning;
+        case CTL_MEMORY_POLICY:   return uris->fluida_memory_policy;
+        case CTL_SMOOTH_TIME:     return uris->fluida_smooth_time;
+        case CTL_SMOOTH_MODE:     return uris->fluida_smooth_mode;
+        case CTL_MASTER_MODE:     return uris->fluida_master_mode;
+        case CTL_MASTER_CEILING:  return uris->fluida_master_ceiling;
+        case CTL_MASTER_RELEASE:  return uris->fluida_master_release;
+        case CTL_DITHER_BITS:     return uris->fluida_dither_bits;
+        case CTL_PARTITIONS:      return uris->fluida_partitions;
+        case CTL_SAMPLE_BUDGET:   return uris->fluida_sample_budget;
+        case CTL_IDLE_UNLOAD:     return uris->fluida_idle_unload;
+        case CTL_PLAYER_ON:       return uris->fluida_player_on;
+        default:                  return 0;
+    }
+}
+
+// generations: the snapshot generation, then the generation of each
+// field or 0 when the field is not part of this snapshot.
+// values: CTL_FIELDS floats, int and bool parameters included
+static inline LV2_Atom* write_set_snapshot(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int *generations, float *values) {
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(forge, 0);
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_snapshot);
+
+    lv2_atom_forge_property_head(forge, uris->atom_Int,0);
+    lv2_atom_forge_vector(forge, sizeof(int), uris->atom_Int, CTL_FIELDS + 1, (void*)generations);
+    lv2_atom_forge_property_head(forge, uris->atom_Float,0);
+    lv2_atom_forge_vector(forge, sizeof(float), uris->atom_Float, CTL_FIELDS, (void*)values);
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// the UI applied the snapshot with this generation
+static inline LV2_Atom* write_set_snapshot_ack(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int generation) {
+    LV2_Atom_Forge_Frame frame;
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_snapshot_ack);
+
+    lv2_atom_forge_key(forge, uris->atom_Int);
+    lv2_atom_forge_int(forge, generation);
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// the UI ask for the channel levels while it show them, 1 or 0
+static inline LV2_Atom* write_set_meter_request(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int on) {
+    LV2_Atom_Forge_Frame frame;
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_meter_request);
+
+    lv2_atom_forge_key(forge, uris->atom_Int);
+    lv2_atom_forge_int(forge, on);
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// levels in dB: peak and RMS of the left and right output, then peak
+// and RMS of the 16 MIDI channels
+#define METER_VALUES 36
+
+static inline LV2_Atom* write_set_meter(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, float *levels) {
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(forge, 0);
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_meter);
+
+    lv2_atom_forge_property_head(forge, uris->atom_Vector,0);
+    lv2_atom_forge_vector(forge, sizeof(float), uris->atom_Float, METER_VALUES, (void*)levels);
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
+// soundfont load progress: read kB, total kB, presets found, all 0 when done
+static inline LV2_Atom* write_set_load_progress(LV2_Atom_Forge* forge,
+                        const FluidaLV2URIs* uris, int *status) {
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_frame_time(forge, 0);
+    LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+                        forge, &frame, 1, uris->fluida_load_progress);
+
+    lv2_atom_forge_property_head(forge, uris->atom_Vector,0);
+    lv2_atom_forge_vector(forge, sizeof(int), uris->atom_Int, 3, (void*)status);
+
+    lv2_atom_forge_pop(forge, &frame);
+    return set;
+}
+
 static inline LV2_Atom* write_get_sflist(LV2_Atom_Forge* forge,
                         const FluidaLV2URIs* uris, int instrument) {
     LV2_Atom_Forge_Frame frame;
@@ -417,6 +752,167 @@ static inline const LV2_Atom_Vector* read_set_channel_inst(const FluidaLV2URIs*
     return NULL;
 }
 
+static inline const LV2_Atom* read_set_channel_font(const FluidaLV2URIs* uris,
+                                    const LV2_Atom_Object* obj, int* channel) {
+    if (obj->body.otype != uris->fluida_channel_font) {
+        return NULL;
+    }
+    const LV2_Atom* chan = NULL;
+    const LV2_Atom* file_path = NULL;
+    lv2_atom_object_get(obj, uris->fluida_channel, &chan,
+                        uris->patch_value, &file_path, 0);
+    if (!chan || (chan->type != uris->atom_Int)) {
+        return NULL;
+    }
+    if (!file_path || (file_path->type != uris->atom_Path)) {
+        return NULL;
+    }
+    *channel = ((const LV2_Atom_Int*)chan)->body;
+    if (*channel < 0 || *channel > 15) return NULL;
+    return file_path;
+}
+
+static inline const LV2_Atom_Vector* read_set_prefault(const FluidaLV2URIs* uris,
+                                                const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_prefault) {
+        return NULL;
+    }
+    const LV2_Atom* vector_data = NULL;
+    const int n_props  = lv2_atom_object_get(obj,uris->atom_Vector, &vector_data, NULL);
+    if (!n_props) return NULL;
+    const LV2_Atom_Vector* vec = (LV2_Atom_Vector*)LV2_ATOM_BODY(vector_data);
+    if (vec->atom.type == uris->atom_Int) {
+        return vec;
+    }
+    return NULL;
+}
+
+static inline const LV2_Atom_Vector* read_set_memory_status(const FluidaLV2URIs* uris,
+                                                const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_memory_status) {
+        return NULL;
+    }
+    const LV2_Atom* vector_data = NULL;
+    const int n_props  = lv2_atom_object_get(obj,uris->atom_Vector, &vector_data, NULL);
+    if (!n_props) return NULL;
+    const LV2_Atom_Vector* vec = (LV2_Atom_Vector*)LV2_ATOM_BODY(vector_data);
+    if (vec->atom.type == uris->atom_Int) {
+        return vec;
+    }
+    return NULL;
+}
+
+static inline const LV2_Atom_Vector* read_set_sample_status(const FluidaLV2URIs* uris,
+                                                const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_sample_status) {
+        return NULL;
+    }
+    const LV2_Atom* vector_data = NULL;
+    const int n_props  = lv2_atom_object_get(obj,uris->atom_Vector, &vector_data, NULL);
+    if (!n_props) return NULL;
+    const LV2_Atom_Vector* vec = (LV2_Atom_Vector*)LV2_ATOM_BODY(vector_data);
+    if (vec->atom.type == uris->atom_Int && vector_data->size >= sizeof(LV2_Atom_Vector_Body)
+                                + 4 * sizeof(int)) {
+        return vec;
+    }
+    return NULL;
+}
+
+static inline const LV2_Atom_Vector* read_set_footprint(const FluidaLV2URIs* uris,
+                                                const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_footprint) {
+        return NULL;
+    }
+    const LV2_Atom* vector_data = NULL;
+    const int n_props  = lv2_atom_object_get(obj,uris->atom_Vector, &vector_data, NULL);
+    if (!n_props) return NULL;
+    const LV2_Atom_Vector* vec = (LV2_Atom_Vector*)LV2_ATOM_BODY(vector_data);
+    if (vec->atom.type == uris->atom_Int && vector_data->size >= sizeof(LV2_Atom_Vector_Body)
+                                + FOOTPRINT_SIZE * sizeof(int)) {
+        return vec;
+    }
+    return NULL;
+}
+
+static inline const LV2_Atom_Vector* read_set_meter(const FluidaLV2URIs* uris,
+                                                const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_meter) {
+        return NULL;
+    }
+    const LV2_Atom* vector_data = NULL;
+    const int n_props  = lv2_atom_object_get(obj,uris->atom_Vector, &vector_data, NULL);
+    if (!n_props) return NULL;
+    const LV2_Atom_Vector* vec = (LV2_Atom_Vector*)LV2_ATOM_BODY(vector_data);
+    if (vec->atom.type == uris->atom_Float && vector_data->size >= sizeof(LV2_Atom_Vector_Body)
+                                + METER_VALUES * sizeof(float)) {
+        return vec;
+    }
+    return NULL;
+}
+
+static inline const LV2_Atom_Vector* read_set_load_progress(const FluidaLV2URIs* uris,
+                                                const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_load_progress) {
+        return NULL;
+    }
+    const LV2_Atom* vector_data = NULL;
+    const int n_props  = lv2_atom_object_get(obj,uris->atom_Vector, &vector_data, NULL);
+    if (!n_props) return NULL;
+    const LV2_Atom_Vector* vec = (LV2_Atom_Vector*)LV2_ATOM_BODY(vector_data);
+    if (vec->atom.type == uris->atom_Int) {
+        return vec;
+    }
+    return NULL;
+}
+
+// the generation and value vectors of a snapshot, 0 when malformed
+static inline int read_set_snapshot(const FluidaLV2URIs* uris, const LV2_Atom_Object* obj,
+                    const LV2_Atom_Vector** generations, const LV2_Atom_Vector** values) {
+    if (obj->body.otype != uris->fluida_snapshot) {
+        return 0;
+    }
+    const LV2_Atom* gen_data = NULL;
+    const LV2_Atom* value_data = NULL;
+    const int n_props  = lv2_atom_object_get(obj, uris->atom_Int, &gen_data,
+                                             uris->atom_Float, &value_data, NULL);
+    if (n_props < 2 || !gen_data || !value_data) return 0;
+    const LV2_Atom_Vector* gen = (LV2_Atom_Vector*)LV2_ATOM_BODY(gen_data);
+    const LV2_Atom_Vector* val = (LV2_Atom_Vector*)LV2_ATOM_BODY(value_data);
+    if (gen->atom.type != uris->atom_Int || gen_data->size < sizeof(LV2_Atom_Vector_Body)
+                                + (CTL_FIELDS + 1) * sizeof(int)) return 0;
+    if (val->atom.type != uris->atom_Float || value_data->size < sizeof(LV2_Atom_Vector_Body)
+                                + CTL_FIELDS * sizeof(float)) return 0;
+    *generations = gen;
+    *values = val;
+    return 1;
+}
+
+static inline const LV2_Atom* read_set_snapshot_ack(const FluidaLV2URIs* uris,
+                                            const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_snapshot_ack) {
+        return NULL;
+    }
+    const LV2_Atom* value = NULL;
+    lv2_atom_object_get(obj, uris->atom_Int, &value, 0);
+    if (!value || (value->type != uris->atom_Int)) {
+        return NULL;
+    }
+    return value;
+}
+
+static inline const LV2_Atom* read_set_meter_request(const FluidaLV2URIs* uris,
+                                            const LV2_Atom_Object* obj) {
+    if (obj->body.otype != uris->fluida_meter_request) {
+        return NULL;
+    }
+    const LV2_Atom* value = NULL;
+    lv2_atom_object_get(obj, uris->atom_Int, &value, 0);
+    if (!value || (value->type != uris->atom_Int)) {
+        return NULL;
+    }
+    return value;
+}
+
 static inline const LV2_Atom* read_set_gui(const FluidaLV2URIs* uris,
                                             const LV2_Atom_Object* obj) {
     if (obj->body.otype != uris->fluida_state) {
@@ -442,6 +938,7 @@ typedef enum
     EFFECTS_OUTPUT1,
     MIDI_IN,
     NOTIFY,
+    LATENCY,
 } PortIndex;
 
 #endif //FLUIDA_H_
@@ -0,0 +1,261 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/****************************************************************
+ ** fluida_bench, render speed against the partition count
+ **
+ ** ./fluida_bench font.sf2 [max partitions] [seconds]
+ ** ./fluida_bench --load font.sf2 [runs]
+ **
+ ** play dense chords on all 16 channels and render them with
+ ** 1 .. max partitions, print the time used and the speedup
+ ** against a single synth. Build with make bench, or with
+ ** make bench RTCHECK=1 and run with LD_PRELOAD=librtcheck.so
+ ** to audit the render loop on the calling thread.
+ **
+ ** The cost of the channel metering is given in percent of the
+ ** block time, in full and split in the per channel render and
+ ** the output levels the plugin take around it.
+ **
+ ** With --load the font is dropped from the page cache before
+ ** each run and load_soundfont() is timed cold, with and without
+ ** the sample readahead.
+ */
+
+#include "XSynth.h"
+#include "rtcheck.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BENCH_RATE 48000
+#define BENCH_BLOCK 256
+#define CHORD_NOTES 8
+// level messages per second, as the plugin send them
+#define BENCH_METER_RATE 20
+
+// retrigger a chord on every channel each half second
+static void play(xsynth::XSynth& synth, int block, int* held) {
+    const int period = BENCH_RATE / 2 / BENCH_BLOCK;
+    if (block % period) return;
+    for (int c = 0; c < 16; c++) {
+        for (int i = 0; i < CHORD_NOTES; i++) {
+            if (held[c]) synth.synth_note_off(c, held[c] + i * 3);
+        }
+        held[c] = 36 + (block / period * 5 + c * 7) % 48;
+        for (int i = 0; i < CHORD_NOTES; i++) {
+            synth.synth_note_on(c, held[c] + i * 3, 100);
+        }
+    }
+}
+
+static double run(xsynth::XSynth& synth, int seconds) {
+    static float outl[BENCH_BLOCK];
+    static float outr[BENCH_BLOCK];
+    int held[16] = {0};
+    const int blocks = seconds * BENCH_RATE / BENCH_BLOCK;
+    const auto start = std::chrono::steady_clock::now();
+    {
+        RTCHECK_SCOPE;
+        for (int b = 0; b < blocks; b++) {
+            play(synth, b, held);
+            synth.synth_process(BENCH_BLOCK, outl, outr);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    synth.panic();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// the fx return mix of one stereo block, with the 16 lane kernel or
+// the plain loop
+static double mix_cost(bool lanes) {
+    const int blocks = 200000;
+    std::vector<float> buf(6 * BENCH_BLOCK);
+    uint32_t seed = 1;
+    for (auto& v : buf) {
+        seed = seed * 1664525u + 1013904223u;
+        v = (float)seed / 4294967296.0f - 0.5f;
+    }
+    float *dry = &buf[0];
+    const float *rev = &buf[2 * BENCH_BLOCK];
+    const float *chorus = &buf[4 * BENCH_BLOCK];
+    const float d = 1e-6f;
+    const auto start = std::chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++) {
+        for (int c = 0; c < 2; c++) {
+            float *out = dry + c * BENCH_BLOCK;
+            const float *r = rev + c * BENCH_BLOCK;
+            const float *ch = chorus + c * BENCH_BLOCK;
+            if (lanes) xsynth::mix_fx16(out, r, ch, BENCH_BLOCK, 1.0f, d, 0.3f, d, 0.2f, -d);
+            else xsynth::mix_fx(out, r, ch, BENCH_BLOCK, 1.0f, d, 0.3f, d, 0.2f, -d);
+        }
+        // keep the values bounded
+        dry[b % BENCH_BLOCK] = 0.1f;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    volatile float sink = dry[0];
+    (void)sink;
+    return std::chrono::duration<double>(end - start).count() / blocks;
+}
+
+// what the plugin add to the metered render per block: the levels of
+// the 2 outputs, and taking all meters at the message rate
+static double meter_cost() {
+    const int blocks = 20000;
+    const int period = BENCH_RATE / BENCH_METER_RATE / BENCH_BLOCK;
+    std::vector<float> buf(2 * BENCH_BLOCK);
+    uint32_t seed = 1;
+    for (auto& v : buf) {
+        seed = seed * 1664525u + 1013904223u;
+        v = (float)seed / 4294967296.0f - 0.5f;
+    }
+    xsynth::LevelMeter out;
+    xsynth::LevelMeter channels;
+    float peak = 0.0f;
+    float rms = 0.0f;
+    const auto start = std::chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++) {
+        out.add(0, &buf[0], BENCH_BLOCK);
+        out.add(1, &buf[BENCH_BLOCK], BENCH_BLOCK);
+        if (b % period) continue;
+        out.take(0, peak, rms);
+        out.take(1, peak, rms);
+        for (int c = 0; c < 16; c++) channels.take(c, peak, rms);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    volatile float sink = peak + rms;
+    (void)sink;
+    return std::chrono::duration<double>(end - start).count() / blocks;
+}
+
+// ask the kernel to forget the cached pages of the file
+static bool drop_cache(const char* path) {
+#ifdef POSIX_FADV_DONTNEED
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    const int ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return ret == 0;
+#else
+    return false;
+#endif
+}
+
+static double load(const char* path, bool readahead) {
+    xsynth::XSynth synth;
+    synth.readahead = readahead;
+    synth.setup(BENCH_RATE, BENCH_BLOCK, true);
+    synth.init_synth();
+    if (!drop_cache(path)) fprintf(stderr, "could not drop %s from the page cache\n", path);
+    const auto start = std::chrono::steady_clock::now();
+    const int ret = synth.load_soundfont(path);
+    const auto end = std::chrono::steady_clock::now();
+    if (ret != 0) return -1.0;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static int load_bench(const char* path, int runs) {
+    printf("%s, cold cache load, %i runs\n", path, runs);
+    printf("run   plain [s]   readahead [s]   speedup\n");
+    double plain_sum = 0.0;
+    double ahead_sum = 0.0;
+    for (int r = 1; r <= runs; r++) {
+        const double plain = load(path, false);
+        const double ahead = load(path, true);
+        if (plain < 0.0 || ahead < 0.0) {
+            fprintf(stderr, "could not load %s\n", path);
+            return 1;
+        }
+        plain_sum += plain;
+        ahead_sum += ahead;
+        printf("%3i   %9.3f   %13.3f   %6.2fx\n", r, plain, ahead, plain / ahead);
+    }
+    printf("avg   %9.3f   %13.3f   %6.2fx\n", plain_sum / runs, ahead_sum / runs,
+                                              plain_sum / ahead_sum);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2 && strcmp(argv[1], "--load") == 0) {
+        const int runs = argc > 3 ? atoi(argv[3]) : 3;
+        return load_bench(argv[2], runs > 0 ? runs : 1);
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s font.sf2 [max partitions] [seconds]\n", argv[0]);
+        fprintf(stderr, "       %s --load font.sf2 [runs]\n", argv[0]);
+        return 1;
+    }
+    const int max_parts = argc > 2 ? atoi(argv[2]) : MAX_PARTITIONS;
+    const int seconds = argc > 3 ? atoi(argv[3]) : 10;
+
+    xsynth::XSynth synth;
+    synth.setup(BENCH_RATE, BENCH_BLOCK, true);
+    synth.init_synth();
+    if (synth.load_soundfont(argv[1]) != 0) {
+        fprintf(stderr, "could not load %s\n", argv[1]);
+        return 1;
+    }
+    synth.set_reverb_on(1);
+    synth.set_chorus_on(1);
+
+    printf("%s, %i s audio, %i frames per block\n", argv[1], seconds, BENCH_BLOCK);
+    printf("partitions   time [s]   realtime   speedup\n");
+    double single = 0.0;
+    for (int p = 1; p <= max_parts; p++) {
+        const int used = synth.set_partitions(p);
+        if (used != p) {
+            printf("%10i   not supported by this fluidsynth\n", p);
+            break;
+        }
+        const double t = run(synth, seconds);
+        if (p == 1) single = t;
+        printf("%10i   %8.3f   %7.1fx   %6.2fx\n", p, t, seconds / t, single / t);
+    }
+    // per channel render and metering against the plain render
+    const double block_time = (double)BENCH_BLOCK / BENCH_RATE;
+    const int blocks = seconds * BENCH_RATE / BENCH_BLOCK;
+    synth.set_partitions(1);
+    synth.set_channel_meter(false);
+    const double plain = run(synth, seconds);
+    synth.set_channel_meter(true);
+    const double metered = run(synth, seconds);
+    synth.set_channel_meter(false);
+    const double render = (metered - plain) / blocks;
+    const double levels = meter_cost();
+    printf("channel metering   %+.3f%% of the block time, %+.3f%% render, %.3f%% levels\n",
+           100.0 * (render + levels) / block_time, 100.0 * render / block_time,
+           100.0 * levels / block_time);
+    const double mix_plain = mix_cost(false);
+    const double mix_lanes = mix_cost(true);
+    printf("fx mix             %.4f%% of the block time, %.2fx with %i lanes\n",
+           100.0 * mix_lanes / block_time, mix_plain / mix_lanes, MIX_LANES);
+    const int violations = RTCHECK_VIOLATIONS();
+    if (violations) {
+        printf("%i RT violations in the render loop\n", violations);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/****************************************************************
+ ** fluida_render, offline renders for comparing the DSP path
+ **
+ ** fluida_render render font.sf2 song.mid out.wav [options]
+ **     -g gain  -r (reverb on)  -c (chorus on)  -t bpm  -s seconds
+ ** fluida_render compare reference.wav out.wav [rms dB] [spectral dB]
+ ** fluida_render footprint font.sf2 [song.mid]
+ **
+ ** render play the midi file through XSynth, the midi player
+ ** and the master bus on a single thread with a fixed block
+ ** size, so the same input always give the same output.
+ ** compare report the RMS and spectral difference of two
+ ** renders and exit with 1 when it's above the tolerance, the
+ ** difference is written next to out.wav as out.diff.wav then.
+ ** footprint list the sample bytes per preset and per bank, and
+ ** the sum for the default instruments, or with a midi file for
+ ** all presets the song select.
+ ** Build with make render RTCHECK=1 and run it with librtcheck
+ ** preloaded, render then exit with 1 when the block loop broke the
+ ** RT rules.
+ */
+
+#include "XSynth.h"
+#include "MidiFile.h"
+#include "MasterBus.h"
+#include "WavFile.h"
+#include "rtcheck.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define RENDER_RATE 48000
+#define RENDER_BLOCK 256
+#define FFT_SIZE 2048
+#define TAIL_SECONDS 2
+
+/****************************************************************
+ ** render
+ */
+
+struct Render {
+    xsynth::XSynth synth;
+};
+
+static void play_event(void* data, const uint8_t* msg) {
+    xsynth::XSynth& synth = static_cast<Render*>(data)->synth;
+    const int ch = msg[0] & 0x0f;
+    switch (msg[0] & 0xf0) {
+    case 0x90: synth.synth_note_on(ch, msg[1], msg[2]); break;
+    case 0x80: synth.synth_note_off(ch, msg[1]); break;
+    case 0xB0:
+        if (msg[1] == 0 || msg[1] == 32) synth.synth_bank_changed(ch, msg[2]);
+        else if (msg[1] == 120 || msg[1] == 123) synth.panic();
+        else synth.synth_send_cc(ch, msg[1], msg[2]);
+        break;
+    case 0xC0: synth.synth_pgm_changed(ch, msg[1]); break;
+    case 0xE0: synth.synth_send_pitch_bend(ch, msg[2] << 7 | msg[1]); break;
+    default: break;
+    }
+}
+
+static int render(int argc, char** argv) {
+    if (argc < 5) return 2;
+    double gain = 0.2;
+    double bpm = 120.0;
+    double seconds = 0.0;
+    bool reverb = false;
+    bool chorus = false;
+    for (int i = 5; i < argc; i++) {
+        if (!strcmp(argv[i], "-g") && i + 1 < argc) gain = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) bpm = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-r")) reverb = true;
+        else if (!strcmp(argv[i], "-c")) chorus = true;
+    }
+    xsynth::MidiFile song;
+    if (!song.load(argv[3]) || song.events.empty()) {
+        fprintf(stderr, "could not load %s\n", argv[3]);
+        return 1;
+    }
+    Render r;
+    r.synth.setup(RENDER_RATE, RENDER_BLOCK, true);
+    r.synth.init_synth();
+    if (r.synth.load_soundfont(argv[2]) != 0) {
+        fprintf(stderr, "could not load %s\n", argv[2]);
+        return 1;
+    }
+    r.synth.volume_level = gain;
+    r.synth.smooth_time = 0.0;
+    r.synth.set_reverb_on(reverb);
+    r.synth.set_chorus_on(chorus);
+    r.synth.set_gain();
+    xsynth::MasterBus master;
+    master.init(RENDER_RATE, RENDER_BLOCK);
+
+    const double song_end = song.quarters(song.events.size() - 1) * 60.0 / bpm + TAIL_SECONDS;
+    const size_t frames = (size_t)((seconds > 0.0 ? seconds : song_end) * RENDER_RATE);
+    std::vector<float> out(frames * 2);
+    float left[RENDER_BLOCK];
+    float right[RENDER_BLOCK];
+    xsynth::MidiPlayer player;
+    player.set_file(&song);
+    const double step = RENDER_BLOCK * bpm / (60.0 * RENDER_RATE);
+    double pos = 0.0;
+    for (size_t f = 0; f < frames; f += RENDER_BLOCK) {
+        RTCHECK_SCOPE;
+        player.process(pos, pos + step, true, play_event, &r);
+        pos += step;
+        r.synth.synth_process(RENDER_BLOCK, left, right);
+        master.process(RENDER_BLOCK, left, right, r.synth.is_silent());
+        for (size_t i = 0; i < RENDER_BLOCK && f + i < frames; i++) {
+            out[2 * (f + i)] = left[i];
+            out[2 * (f + i) + 1] = right[i];
+        }
+    }
+    if (!xsynth::write_wav(argv[4], out, RENDER_RATE)) {
+        fprintf(stderr, "could not write %s\n", argv[4]);
+        return 1;
+    }
+    printf("%s: %zu frames\n", argv[4], frames);
+    const int violations = RTCHECK_VIOLATIONS();
+    if (violations) {
+        printf("%i RT violations in the render loop\n", violations);
+        return 1;
+    }
+    return 0;
+}
+
+/****************************************************************
+ ** compare
+ */
+
+static void fft(std::vector<float>& re, std::vector<float>& im) {
+    const size_t n = re.size();
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        const double a = -2.0 * M_PI / len;
+        for (size_t i = 0; i < n; i += len) {
+            for (size_t k = 0; k < len / 2; k++) {
+                const float wr = cos(a * k);
+                const float wi = sin(a * k);
+                const float xr = re[i + k + len / 2] * wr - im[i + k + len / 2] * wi;
+                const float xi = re[i + k + len / 2] * wi + im[i + k + len / 2] * wr;
+                re[i + k + len / 2] = re[i + k] - xr;
+                im[i + k + len / 2] = im[i + k] - xi;
+                re[i + k] += xr;
+                im[i + k] += xi;
+            }
+        }
+    }
+}
+
+// mean power spectrum of the mono sum, hann windowed
+static void spectrum(const std::vector<float>& frames, std::vector<double>& power) {
+    power.assign(FFT_SIZE / 2, 0.0);
+    std::vector<float> re(FFT_SIZE);
+    std::vector<float> im(FFT_SIZE);
+    const size_t n = frames.size() / 2;
+    for (size_t pos = 0; pos + FFT_SIZE <= n; pos += FFT_SIZE / 2) {
+        for (size_t i = 0; i < FFT_SIZE; i++) {
+            const float w = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / FFT_SIZE);
+            re[i] = w * 0.5f * (frames[2 * (pos + i)] + frames[2 * (pos + i) + 1]);
+            im[i] = 0.0f;
+        }
+        fft(re, im);
+        for (size_t k = 0; k < FFT_SIZE / 2; k++) power[k] += re[k] * re[k] + im[k] * im[k];
+    }
+}
+
+static double to_db(double v) {
+    return 10.0 * log10(v + 1e-20);
+}
+
+static int compare(int argc, char** argv) {
+    if (argc < 4) return 2;
+    const double rms_tol = argc > 4 ? atof(argv[4]) : -80.0;
+    const double spec_tol = argc > 5 ? atof(argv[5]) : 0.5;
+    std::vector<float> ref;
+    std::vector<float> out;
+    int ref_rate = 0;
+    int out_rate = 0;
+    if (!xsynth::read_wav(argv[2], ref, ref_rate) || !xsynth::read_wav(argv[3], out, out_rate)) {
+        fprintf(stderr, "could not read the renders, 32 bit float stereo wav expected\n");
+        return 1;
+    }
+    if (ref_rate != out_rate || ref.size() != out.size()) {
+        fprintf(stderr, "length or rate differ: %zu/%i against %zu/%i\n",
+                ref.size() / 2, ref_rate, out.size() / 2, out_rate);
+        return 1;
+    }
+    std::vector<float> diff(ref.size());
+    double ref_energy = 0.0;
+    double diff_energy = 0.0;
+    float peak = 0.0f;
+    for (size_t i = 0; i < ref.size(); i++) {
+        diff[i] = out[i] - ref[i];
+        ref_energy += (double)ref[i] * ref[i];
+        diff_energy += (double)diff[i] * diff[i];
+        peak = std::max(peak, fabsf(diff[i]));
+    }
+    const double n = std::max((size_t)1, ref.size());
+    const double rms = to_db(diff_energy / n);
+    // spectral distance, mean of the per bin level difference, bins
+    // 60 dB below the loudest one are left out
+    std::vector<double> ps_ref;
+    std::vector<double> ps_out;
+    spectrum(ref, ps_ref);
+    spectrum(out, ps_out);
+    double loudest = 0.0;
+    for (auto p : ps_ref) loudest = std::max(loudest, p);
+    double spec = 0.0;
+    int bins = 0;
+    for (size_t k = 1; k < ps_ref.size(); k++) {
+        if (to_db(ps_ref[k]) < to_db(loudest) - 60.0) continue;
+        spec += fabs(to_db(ps_out[k]) - to_db(ps_ref[k]));
+        bins++;
+    }
+    if (bins) spec /= bins;
+    printf("signal %.1f dB  diff rms %.1f dB  diff peak %.1f dB  spectral %.3f dB\n",
+           to_db(ref_energy / n), rms, 20.0 * log10(peak + 1e-20), spec);
+    if (rms <= rms_tol && spec <= spec_tol) return 0;
+    std::string path = argv[3];
+    const size_t dot = path.rfind(".wav");
+    path = (dot != std::string::npos ? path.substr(0, dot) : path) + ".diff.wav";
+    xsynth::write_wav(path.data(), diff, ref_rate);
+    printf("FAILED, tolerance rms %.1f dB spectral %.3f dB, difference in %s\n",
+           rms_tol, spec_tol, path.data());
+    return 1;
+}
+
+/****************************************************************
+ ** footprint
+ */
+
+static double mb(size_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+// add the preset selected on a channel, once
+static void add_channel(xsynth::XSynth& synth, int channel, std::vector<xsynth::PresetRef>& refs) {
+    xsynth::PresetRef r;
+    if (!synth.get_channel_preset(channel, r)) return;
+    for (auto& i : refs) {
+        if (i.font == r.font && i.bank == r.bank && i.program == r.program) return;
+    }
+    refs.push_back(r);
+}
+
+static int footprint(int argc, char** argv) {
+    if (argc < 3) return 2;
+    Render r;
+    r.synth.setup(RENDER_RATE, RENDER_BLOCK, true);
+    r.synth.init_synth();
+    if (r.synth.load_soundfont(argv[2]) != 0) {
+        fprintf(stderr, "could not load %s\n", argv[2]);
+        return 1;
+    }
+    xsynth::Footprint fp;
+    r.synth.get_footprint(fp);
+    std::vector<size_t> order(fp.presets.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&fp](size_t a, size_t b) {
+        return fp.presets[a].bytes > fp.presets[b].bytes;
+    });
+    printf("preset                                      MB   resident MB\n");
+    for (auto i : order) {
+        printf("%-36.36s %9.2f %13.2f\n", r.synth.instruments[i].data(),
+               mb(fp.presets[i].bytes), mb(fp.presets[i].resident));
+    }
+    printf("\nbank                                        MB   resident MB\n");
+    for (auto& b : fp.banks) {
+        printf("%03d                                  %9.2f %13.2f\n", b.bank, mb(b.bytes), mb(b.resident));
+    }
+    printf("\nsample data %.2f MB, default instruments %.2f MB (%.2f MB resident)\n",
+           mb(fp.total), mb(fp.assigned), mb(fp.assigned_resident));
+    if (argc > 3) {
+        // follow the bank and program changes of the song
+        xsynth::MidiFile song;
+        if (!song.load(argv[3])) {
+            fprintf(stderr, "could not load %s\n", argv[3]);
+            return 1;
+        }
+        std::vector<xsynth::PresetRef> refs;
+        for (int c = 0; c < 16; c++) add_channel(r.synth, c, refs);
+        for (auto& ev : song.events) {
+            const int type = ev.msg[0] & 0xf0;
+            if (type != 0xB0 && type != 0xC0) continue;
+            play_event(&r, ev.msg);
+            if (type == 0xC0) add_channel(r.synth, ev.msg[0] & 0x0f, refs);
+        }
+        size_t resident = 0;
+        const size_t bytes = r.synth.presets_bytes(refs, &resident);
+        printf("%s: %zu presets, %.2f MB (%.2f MB resident)\n", argv[3], refs.size(),
+               mb(bytes), mb(resident));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int ret = 2;
+    if (argc > 1 && !strcmp(argv[1], "render")) ret = render(argc, argv);
+    else if (argc > 1 && !strcmp(argv[1], "compare")) ret = compare(argc, argv);
+    else if (argc > 1 && !strcmp(argv[1], "footprint")) ret = footprint(argc, argv);
+    if (ret == 2) {
+        fprintf(stderr, "usage: %s render font.sf2 song.mid out.wav [-g gain] [-r] [-c] [-t bpm] [-s seconds]\n"
+                        "       %s compare reference.wav out.wav [rms dB] [spectral dB]\n"
+                        "       %s footprint font.sf2 [song.mid]\n", argv[0], argv[0], argv[0]);
+    }
+    return ret;
+}
@@ -0,0 +1,674 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+/****************************************************************
+ ** fluida_test, golden renders of the plugin
+ **
+ ** fluida_test case testdir out.wav
+ **     cases: notes programs scala restore
+ ** fluida_test batch testdir
+ ** fluida_test font out.sf2
+ **
+ ** host the plugin like a LV2 host does, with one audio thread at
+ ** a fixed rate and block size. The scheduled work runs on a
+ ** worker thread in between two blocks, so the same case always
+ ** give the same output. A case restore a state, play a midi file
+ ** from testdir on the MIDI input and write the output as 32 bit
+ ** float wav. The soundfont, two looped waveforms, is
+ ** testdir/fluida_test.sf2, fluida_test font write it again from
+ ** the code below. The restore case render a second instance
+ ** from the state the first one saved, both renders must match.
+ ** make test compare the renders to the ones in testdir/golden.
+ ** The batch case check itself, it send a patch:Put like the UI
+ ** and the snapshot must carry the new values.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+
+#include "fluida.h"
+#include "MidiFile.h"
+#include "WavFile.h"
+
+// the plugin is linked in, the host take it's descriptor
+extern "C" const LV2_Descriptor* lv2_descriptor(uint32_t index);
+
+#define TEST_RATE 48000
+#define TEST_BLOCK 256
+#define TEST_BPM 120.0
+#define TAIL_SECONDS 2
+// blocks to run after a restore, before the midi file start
+#define SETTLE_BLOCKS 16
+#define ATOM_BUFFER 65536
+
+/****************************************************************
+ ** the test soundfont
+ **
+ ** a sine and a square made of the odd partials up to the 7th, a
+ ** cycle of 100 frames at 44 kHz is a 440 Hz A. Preset 0 play the
+ ** sine, preset 1 the square.
+ */
+
+#define FONT_CYCLE 100
+#define FONT_CYCLES 10
+#define FONT_RATE 44000
+
+static void put_id(std::vector<uint8_t>& b, const char *id) {
+    b.insert(b.end(), id, id + 4);
+}
+
+static void put_le(std::vector<uint8_t>& b, uint32_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) b.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void put_name(std::vector<uint8_t>& b, const char *name) {
+    char field[20] = {0};
+    strncpy(field, name, sizeof(field) - 1);
+    b.insert(b.end(), field, field + sizeof(field));
+}
+
+static void put_chunk(std::vector<uint8_t>& b, const char *id, const std::vector<uint8_t>& data) {
+    put_id(b, id);
+    put_le(b, data.size(), 4);
+    b.insert(b.end(), data.begin(), data.end());
+    if (data.size() & 1) b.push_back(0);
+}
+
+static void put_list(std::vector<uint8_t>& b, const char *type, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> list;
+    put_id(list, type);
+    list.insert(list.end(), data.begin(), data.end());
+    put_chunk(b, "LIST", list);
+}
+
+static bool write_test_font(const char *path) {
+    const char* names[2] = {"Sine", "Square"};
+    const uint32_t frames = FONT_CYCLE * FONT_CYCLES;
+    // every sample is followed by 46 zero frames
+    const uint32_t stride = frames + 46;
+
+    std::vector<uint8_t> info;
+    std::vector<uint8_t> data;
+    put_le(data, 2, 2);
+    put_le(data, 1, 2);
+    put_chunk(info, "ifil", data);
+    const char engine[] = "EMU8000";
+    put_chunk(info, "isng", std::vector<uint8_t>(engine, engine + sizeof(engine)));
+    const char title[] = "Fluida test";
+    put_chunk(info, "INAM", std::vector<uint8_t>(title, title + sizeof(title)));
+
+    std::vector<uint8_t> smpl;
+    for (int s = 0; s < 2; s++) {
+        for (uint32_t i = 0; i < stride; i++) {
+            double v = 0.0;
+            if (i < frames) {
+                const double phase = 2.0 * M_PI * (i % FONT_CYCLE) / FONT_CYCLE;
+                if (s == 0) v = sin(phase);
+                else for (int k = 1; k <= 7; k += 2) v += sin(k * phase) / k;
+            }
+            put_le(smpl, (uint16_t)(int16_t)lrint(v * 16000.0), 2);
+        }
+    }
+    std::vector<uint8_t> sdta;
+    put_chunk(sdta, "smpl", smpl);
+
+    std::vector<uint8_t> phdr, pbag, pmod, pgen, inst, ibag, imod, igen, shdr;
+    for (int s = 0; s < 2; s++) {
+        put_name(phdr, names[s]);
+        put_le(phdr, s, 2);             // preset
+        put_le(phdr, 0, 2);             // bank
+        put_le(phdr, s, 2);             // bag
+        put_le(phdr, 0, 4);
+        put_le(phdr, 0, 4);
+        put_le(phdr, 0, 4);
+        put_le(pbag, s, 2);             // one generator per zone
+        put_le(pbag, 0, 2);
+        put_le(pgen, 41, 2);            // instrument
+        put_le(pgen, s, 2);
+
+        put_name(inst, names[s]);
+        put_le(inst, s, 2);
+        put_le(ibag, 3 * s, 2);         // three generators per zone
+        put_le(ibag, 0, 2);
+        put_le(igen, 54, 2);            // sampleModes, loop
+        put_le(igen, 1, 2);
+        put_le(igen, 38, 2);            // releaseVolEnv, 0.25 s
+        put_le(igen, (uint16_t)(int16_t)-2400, 2);
+        put_le(igen, 53, 2);            // sampleID
+        put_le(igen, s, 2);
+
+        put_name(shdr, names[s]);
+        put_le(shdr, s * stride, 4);
+        put_le(shdr, s * stride + frames, 4);
+        // the loop leave out the first and the last cycle
+        put_le(shdr, s * stride + FONT_CYCLE, 4);
+        put_le(shdr, s * stride + frames - FONT_CYCLE, 4);
+        put_le(shdr, FONT_RATE, 4);
+        shdr.push_back(69);             // original pitch
+        shdr.push_back(0);              // pitch correction
+        put_le(shdr, 0, 2);             // sample link
+        put_le(shdr, 1, 2);             // mono
+    }
+    // the terminal records
+    put_name(phdr, "EOP");
+    put_le(phdr, 0, 2);
+    put_le(phdr, 0, 2);
+    put_le(phdr, 2, 2);
+    put_le(phdr, 0, 12);
+    put_le(pbag, 2, 2);
+    put_le(pbag, 0, 2);
+    put_le(pmod, 0, 10);
+    put_le(pgen, 0, 4);
+    put_name(inst, "EOI");
+    put_le(inst, 2, 2);
+    put_le(ibag, 6, 2);
+    put_le(ibag, 0, 2);
+    put_le(imod, 0, 10);
+    put_le(igen, 0, 4);
+    put_name(shdr, "EOS");
+    put_le(shdr, 0, 26);
+
+    std::vector<uint8_t> pdta;
+    put_chunk(pdta, "phdr", phdr);
+    put_chunk(pdta, "pbag", pbag);
+    put_chunk(pdta, "pmod", pmod);
+    put_chunk(pdta, "pgen", pgen);
+    put_chunk(pdta, "inst", inst);
+    put_chunk(pdta, "ibag", ibag);
+    put_chunk(pdta, "imod", imod);
+    put_chunk(pdta, "igen", igen);
+    put_chunk(pdta, "shdr", shdr);
+
+    std::vector<uint8_t> body;
+    put_id(body, "sfbk");
+    put_list(body, "INFO", info);
+    put_list(body, "sdta", sdta);
+    put_list(body, "pdta", pdta);
+    std::vector<uint8_t> file;
+    put_chunk(file, "RIFF", body);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return false;
+    const bool ok = fwrite(file.data(), 1, file.size(), fp) == file.size();
+    fclose(fp);
+    return ok;
+}
+
+/****************************************************************
+ ** the host side of the state interface
+ */
+
+struct Property {
+    uint32_t type;
+    std::vector<uint8_t> value;
+};
+
+typedef std::map<uint32_t, Property> State;
+
+static LV2_State_Status store_property(LV2_State_Handle handle, uint32_t key,
+                const void* value, size_t size, uint32_t type, uint32_t flags) {
+    Property& p = (*static_cast<State*>(handle))[key];
+    p.type = type;
+    p.value.assign((const uint8_t*)value, (const uint8_t*)value + size);
+    return LV2_STATE_SUCCESS;
+}
+
+static const void* retrieve_property(LV2_State_Handle handle, uint32_t key,
+                size_t* size, uint32_t* type, uint32_t* flags) {
+    State& state = *static_cast<State*>(handle);
+    State::const_iterator it = state.find(key);
+    if (it == state.end()) return NULL;
+    *size = it->second.value.size();
+    *type = it->second.type;
+    *flags = LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE;
+    return it->second.value.data();
+}
+
+/****************************************************************
+ ** class Host
+ **
+ ** one plugin instance with it's ports, the worker and the URID map
+ */
+
+class Host {
+private:
+    std::vector<std::string> uris;
+    LV2_URID_Map map;
+    LV2_Worker_Schedule schedule;
+    int32_t block_length;
+    LV2_Options_Option options[2];
+    LV2_Feature features[4];
+    const LV2_Feature* feature_list[5];
+    const LV2_Descriptor* descriptor;
+    LV2_Handle instance;
+    const LV2_Worker_Interface* worker;
+    const LV2_State_Interface* state;
+    std::vector<std::vector<uint8_t> > jobs;
+    std::vector<std::vector<uint8_t> > responses;
+    uint64_t midi_buffer[ATOM_BUFFER / 8];
+    uint64_t notify_buffer[ATOM_BUFFER / 8];
+    float left[TEST_BLOCK];
+    float right[TEST_BLOCK];
+    float latency;
+    LV2_Atom_Forge forge;
+    LV2_URID midi_event;
+    // an atom for the next block, at frame 0
+    std::vector<uint8_t> message;
+
+    static LV2_URID map_uri(LV2_URID_Map_Handle handle, const char* uri);
+    static LV2_Worker_Status schedule_work(LV2_Worker_Schedule_Handle handle,
+                                           uint32_t size, const void* data);
+    static LV2_Worker_Status respond(LV2_Worker_Respond_Handle handle,
+                                     uint32_t size, const void* data);
+    void do_work();
+
+public:
+    LV2_URID urid(const char* uri) { return map_uri(&uris, uri); }
+    LV2_URID_Map* urid_map() { return &map; }
+    bool open();
+    void restore(State& s);
+    void save(State& s);
+    // run one block, the events are (frame, event) pairs in it
+    void run(const std::vector<std::pair<uint32_t, const xsynth::MidiEvent*> >& events);
+    void settle();
+    void post(const LV2_Atom* msg);
+    const LV2_Atom_Sequence* notify() const { return (const LV2_Atom_Sequence*)notify_buffer; }
+    const float* out_left() const { return left; }
+    const float* out_right() const { return right; }
+
+    Host();
+    ~Host();
+};
+
+Host::Host() : block_length(TEST_BLOCK), descriptor(NULL), instance(NULL),
+    worker(NULL), state(NULL), latency(0.0f) {
+    map.handle = &uris;
+    map.map = map_uri;
+    schedule.handle = this;
+    schedule.schedule_work = schedule_work;
+    midi_event = urid(LV2_MIDI__MidiEvent);
+    lv2_atom_forge_init(&forge, &map);
+}
+
+Host::~Host() {
+    if (instance) descriptor->cleanup(instance);
+}
+
+LV2_URID Host::map_uri(LV2_URID_Map_Handle handle, const char* uri) {
+    std::vector<std::string>& uris = *static_cast<std::vector<std::string>*>(handle);
+    for (size_t i = 0; i < uris.size(); i++) {
+        if (uris[i] == uri) return i + 1;
+    }
+    uris.push_back(uri);
+    return uris.size();
+}
+
+LV2_Worker_Status Host::schedule_work(LV2_Worker_Schedule_Handle handle,
+                                      uint32_t size, const void* data) {
+    Host* self = static_cast<Host*>(handle);
+    self->jobs.push_back(std::vector<uint8_t>((const uint8_t*)data, (const uint8_t*)data + size));
+    return LV2_WORKER_SUCCESS;
+}
+
+LV2_Worker_Status Host::respond(LV2_Worker_Respond_Handle handle,
+                                uint32_t size, const void* data) {
+    Host* self = static_cast<Host*>(handle);
+    self->responses.push_back(std::vector<uint8_t>((const uint8_t*)data, (const uint8_t*)data + size));
+    return LV2_WORKER_SUCCESS;
+}
+
+// the work scheduled in the last block, on a thread of it's own
+// while the audio thread wait. No block run meanwhile, the plugin is
+// deactivated so a hold the work ask for don't wait for one.
+void Host::do_work() {
+    if (jobs.empty()) return;
+    std::vector<std::vector<uint8_t> > batch;
+    batch.swap(jobs);
+    descriptor->deactivate(instance);
+    std::thread t([this, &batch]() {
+        for (auto& job : batch) worker->work(instance, respond, this, job.size(), job.data());
+    });
+    t.join();
+    descriptor->activate(instance);
+}
+
+bool Host::open() {
+    options[0].context = LV2_OPTIONS_INSTANCE;
+    options[0].subject = 0;
+    options[0].key = urid(LV2_BUF_SIZE__maxBlockLength);
+    options[0].size = sizeof(int32_t);
+    options[0].type = urid(LV2_ATOM__Int);
+    options[0].value = &block_length;
+    memset(&options[1], 0, sizeof(options[1]));
+    features[0].URI = LV2_URID__map;
+    features[0].data = &map;
+    features[1].URI = LV2_WORKER__schedule;
+    features[1].data = &schedule;
+    features[2].URI = LV2_OPTIONS__options;
+    features[2].data = options;
+    features[3].URI = LV2_BUF_SIZE__powerOf2BlockLength;
+    features[3].data = NULL;
+    for (int i = 0; i < 4; i++) feature_list[i] = &features[i];
+    feature_list[4] = NULL;
+
+    descriptor = lv2_descriptor(0);
+    if (!descriptor) return false;
+    instance = descriptor->instantiate(descriptor, TEST_RATE, ".", feature_list);
+    if (!instance) return false;
+    worker = (const LV2_Worker_Interface*)descriptor->extension_data(LV2_WORKER__interface);
+    state = (const LV2_State_Interface*)descriptor->extension_data(LV2_STATE__interface);
+    if (!worker || !state) return false;
+    descriptor->connect_port(instance, EFFECTS_OUTPUT, left);
+    descriptor->connect_port(instance, EFFECTS_OUTPUT1, right);
+    descriptor->connect_port(instance, MIDI_IN, midi_buffer);
+    descriptor->connect_port(instance, NOTIFY, notify_buffer);
+    descriptor->connect_port(instance, LATENCY, &latency);
+    descriptor->activate(instance);
+    return true;
+}
+
+void Host::restore(State& s) {
+    const LV2_Feature* none[1] = {NULL};
+    state->restore(instance, retrieve_property, &s, 0, none);
+}
+
+void Host::save(State& s) {
+    const LV2_Feature* none[1] = {NULL};
+    state->save(instance, store_property, &s, 0, none);
+}
+
+void Host::run(const std::vector<std::pair<uint32_t, const xsynth::MidiEvent*> >& events) {
+    for (auto& r : responses) worker->work_response(instance, r.size(), r.data());
+    responses.clear();
+
+    lv2_atom_forge_set_buffer(&forge, (uint8_t*)midi_buffer, sizeof(midi_buffer));
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_sequence_head(&forge, &frame, 0);
+    if (!message.empty()) {
+        const LV2_Atom* msg = (const LV2_Atom*)message.data();
+        lv2_atom_forge_frame_time(&forge, 0);
+        lv2_atom_forge_write(&forge, msg, lv2_atom_total_size(msg));
+        message.clear();
+    }
+    for (auto& ev : events) {
+        lv2_atom_forge_frame_time(&forge, ev.first);
+        lv2_atom_forge_atom(&forge, ev.second->size, midi_event);
+        lv2_atom_forge_write(&forge, ev.second->msg, ev.second->size);
+    }
+    lv2_atom_forge_pop(&forge, &frame);
+    LV2_Atom_Sequence* notify = (LV2_Atom_Sequence*)notify_buffer;
+    notify->atom.type = 0;
+    notify->atom.size = sizeof(notify_buffer) - sizeof(LV2_Atom);
+
+    descriptor->run(instance, TEST_BLOCK);
+    do_work();
+}
+
+// let the worker apply a restored state, without input
+void Host::settle() {
+    const std::vector<std::pair<uint32_t, const xsynth::MidiEvent*> > none;
+    for (int i = 0; i < SETTLE_BLOCKS; i++) run(none);
+}
+
+void Host::post(const LV2_Atom* msg) {
+    message.assign((const uint8_t*)msg, (const uint8_t*)msg + lv2_atom_total_size(msg));
+}
+
+/****************************************************************
+ ** cases
+ */
+
+static void set_string(Host& host, State& s, LV2_URID key, const char* type, const std::string& value) {
+    Property& p = s[key];
+    p.type = host.urid(type);
+    p.value.assign(value.begin(), value.end());
+    p.value.push_back(0);
+}
+
+static void set_int(Host& host, State& s, const char* key, int32_t value) {
+    Property& p = s[host.urid(key)];
+    p.type = host.urid(LV2_ATOM__Int);
+    p.value.assign((const uint8_t*)&value, (const uint8_t*)&value + sizeof(value));
+}
+
+static void set_float(Host& host, State& s, const char* key, float value) {
+    Property& p = s[host.urid(key)];
+    p.type = host.urid(LV2_ATOM__Float);
+    p.value.assign((const uint8_t*)&value, (const uint8_t*)&value + sizeof(value));
+}
+
+// the state a case start with, the soundfont is stored under atom:Path
+static void case_state(Host& host, State& s, const std::string& name,
+                       const std::string& dir, const std::string& font) {
+    set_string(host, s, host.urid(LV2_ATOM__Path), LV2_ATOM__String, font);
+    if (name == "programs" || name == "restore") {
+        set_int(host, s, FLUIDA__rev_on, 1);
+    }
+    if (name == "scala" || name == "restore") {
+        set_string(host, s, host.urid(FLUIDA__scl), LV2_ATOM__Path, dir + "/tuning.scl");
+        set_float(host, s, FLUIDA__tuning, 1.0f);
+    }
+    if (name == "restore") {
+        set_int(host, s, FLUIDA__chorus_on, 1);
+        set_float(host, s, FLUIDA__gain, 0.5f);
+    }
+}
+
+// play the song on the MIDI input, from the first block on
+static void render_song(Host& host, const xsynth::MidiFile& song, std::vector<float>& out) {
+    const double frames_per_quarter = 60.0 / TEST_BPM * TEST_RATE;
+    const size_t frames = (size_t)(song.quarters(song.events.size() - 1) * frames_per_quarter)
+                          + TAIL_SECONDS * TEST_RATE;
+    out.assign(frames * 2, 0.0f);
+    std::vector<std::pair<uint32_t, const xsynth::MidiEvent*> > events;
+    size_t index = 0;
+    for (size_t f = 0; f < frames; f += TEST_BLOCK) {
+        events.clear();
+        for (; index < song.events.size(); index++) {
+            const size_t at = (size_t)lrint(song.quarters(index) * frames_per_quarter);
+            if (at >= f + TEST_BLOCK) break;
+            events.push_back(std::make_pair((uint32_t)(at - f), &song.events[index]));
+        }
+        host.run(events);
+        for (size_t i = 0; i < TEST_BLOCK && f + i < frames; i++) {
+            out[2 * (f + i)] = host.out_left()[i];
+            out[2 * (f + i) + 1] = host.out_right()[i];
+        }
+    }
+}
+
+static int run_case(const std::string& name, const std::string& dir, const char* path) {
+    if (name != "notes" && name != "programs" && name != "scala" && name != "restore") return 2;
+    const std::string font = dir + "/fluida_test.sf2";
+    const std::string midi = dir + (name == "programs" || name == "restore" ? "/programs.mid" : "/notes.mid");
+    xsynth::MidiFile song;
+    if (!song.load(midi.data()) || song.events.empty()) {
+        fprintf(stderr, "could not load %s\n", midi.data());
+        return 1;
+    }
+
+    Host host;
+    if (!host.open()) {
+        fprintf(stderr, "could not instantiate the plugin\n");
+        return 1;
+    }
+    State initial;
+    case_state(host, initial, name, dir, font);
+    host.restore(initial);
+    host.settle();
+    std::vector<float> out;
+    if (name == "restore") {
+        // a second instance restore what the first one saved
+        State saved;
+        host.save(saved);
+        std::vector<float> first;
+        render_song(host, song, first);
+        Host copy;
+        if (!copy.open()) {
+            fprintf(stderr, "could not instantiate the plugin\n");
+            return 1;
+        }
+        copy.restore(saved);
+        copy.settle();
+        render_song(copy, song, out);
+        float peak = 0.0f;
+        for (size_t i = 0; i < out.size(); i++) peak = std::max(peak, fabsf(out[i] - first[i]));
+        if (peak > 1e-6f) {
+            fprintf(stderr, "the restored instance differ from the saved one, peak %g\n", peak);
+            return 1;
+        }
+    } else {
+        render_song(host, song, out);
+    }
+    if (!xsynth::write_wav(path, out, TEST_RATE)) {
+        fprintf(stderr, "could not write %s\n", path);
+        return 1;
+    }
+    printf("%s: %zu frames\n", path, out.size() / 2);
+    return 0;
+}
+
+// the fields of the snapshots in the last block, over what is known
+static bool take_snapshot(Host& host, const FluidaLV2URIs* uris, int* generations, float* values) {
+    bool found = false;
+    LV2_ATOM_SEQUENCE_FOREACH(host.notify(), ev) {
+        if (ev->body.type != uris->atom_Object) continue;
+        const LV2_Atom_Vector* gen = NULL;
+        const LV2_Atom_Vector* val = NULL;
+        if (!read_set_snapshot(uris, (const LV2_Atom_Object*)&ev->body, &gen, &val)) continue;
+        const int* g = (const int*)LV2_ATOM_BODY(&gen->atom);
+        const float* v = (const float*)LV2_ATOM_BODY(&val->atom);
+        for (int i = 0; i < CTL_FIELDS; i++) {
+            if (!g[i + 1]) continue;
+            generations[i] = g[i + 1];
+            values[i] = v[i];
+        }
+        found = true;
+    }
+    return found;
+}
+
+// a batch of controller values in one patch:Put, as the UI send it. The
+// next snapshot must carry each value with a newer generation.
+static const struct {
+    int field;
+    const char* key;
+    bool is_int;
+    float value;
+} batch[] = {
+    {CTL_REV_LEV, FLUIDA__rev_lev, false, 0.25f},
+    {CTL_CHORUS_DEPTH, FLUIDA__chorus_depth, false, 3.5f},
+    {CTL_VELOCITY, FLUIDA__velocity, true, 90.0f},
+    {CTL_CHORUS_VOICES, FLUIDA__chorus_voices, true, 4.0f},
+};
+#define BATCH_FIELDS (int)(sizeof(batch) / sizeof(batch[0]))
+
+static int run_batch(const std::string& dir) {
+    Host host;
+    if (!host.open()) {
+        fprintf(stderr, "could not instantiate the plugin\n");
+        return 1;
+    }
+    FluidaLV2URIs uris;
+    map_fluidalv2_uris(host.urid_map(), &uris);
+    State initial;
+    case_state(host, initial, "notes", dir, dir + "/fluida_test.sf2");
+    host.restore(initial);
+    host.settle();
+
+    const std::vector<std::pair<uint32_t, const xsynth::MidiEvent*> > none;
+    uint8_t buf[1024];
+    LV2_Atom_Forge forge;
+    lv2_atom_forge_init(&forge, host.urid_map());
+
+    // the known generations, a patch:Get send the whole snapshot
+    int before[CTL_FIELDS] = {0};
+    float values[CTL_FIELDS] = {0};
+    LV2_Atom_Forge_Frame frame;
+    lv2_atom_forge_set_buffer(&forge, buf, sizeof(buf));
+    host.post((const LV2_Atom*)lv2_atom_forge_object(&forge, &frame, 0, uris.patch_Get));
+    lv2_atom_forge_pop(&forge, &frame);
+    host.run(none);
+    take_snapshot(host, &uris, before, values);
+
+    LV2_Atom_Forge_Frame body;
+    lv2_atom_forge_set_buffer(&forge, buf, sizeof(buf));
+    const LV2_Atom* msg = (const LV2_Atom*)lv2_atom_forge_object(&forge, &frame, 0, uris.patch_Put);
+    lv2_atom_forge_key(&forge, uris.patch_body);
+    lv2_atom_forge_object(&forge, &body, 0, 0);
+    for (int i = 0; i < BATCH_FIELDS; i++) {
+        lv2_atom_forge_key(&forge, host.urid(batch[i].key));
+        if (batch[i].is_int) lv2_atom_forge_int(&forge, (int)batch[i].value);
+        else lv2_atom_forge_float(&forge, batch[i].value);
+    }
+    lv2_atom_forge_pop(&forge, &body);
+    lv2_atom_forge_pop(&forge, &frame);
+    host.post(msg);
+
+    int after[CTL_FIELDS];
+    memcpy(after, before, sizeof(after));
+    bool found = false;
+    for (int b = 0; b < SETTLE_BLOCKS; b++) {
+        host.run(none);
+        found |= take_snapshot(host, &uris, after, values);
+    }
+    if (!found) {
+        fprintf(stderr, "batch: no snapshot after the patch:Put\n");
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 0; i < BATCH_FIELDS; i++) {
+        const int f = batch[i].field;
+        if (after[f] <= before[f] || values[f] != batch[i].value) {
+            fprintf(stderr, "batch: field %i generation %i after %i, value %g for %g\n",
+                    f, after[f], before[f], values[f], batch[i].value);
+            ret = 1;
+        }
+    }
+    if (!ret) printf("batch: %i fields with new generations\n", BATCH_FIELDS);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    int ret = 2;
+    if (argc == 3 && strcmp(argv[1], "font") == 0) {
+        ret = write_test_font(argv[2]) ? 0 : 1;
+        if (ret) fprintf(stderr, "could not write %s\n", argv[2]);
+    } else if (argc == 3 && strcmp(argv[1], "batch") == 0) {
+        ret = run_batch(argv[2]);
+    } else if (argc > 3) {
+        ret = run_case(argv[1], argv[2], argv[3]);
+    }
+    if (ret == 2) {
+        fprintf(stderr, "usage: %s notes|programs|scala|restore testdir out.wav\n", argv[0]);
+        fprintf(stderr, "       %s batch testdir\n", argv[0]);
+        fprintf(stderr, "       %s font out.sf2\n", argv[0]);
+    }
+    return ret;
+}
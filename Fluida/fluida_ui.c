@@ -19,7 +19,10 @@
 
 
 #include <stdio.h>
+#include <stdint.h>
+#include <ctype.h>
 #include <libgen.h>
+#include <time.h>
 
 /*---------------------------------------------------------------------
 -----------------------------------------------------------------------
@@ -56,6 +59,46 @@
 #define OBJ_BUF_SIZE 1024
 #define _(S) S
 
+// frames per second the UI redraw at most, state updates from the
+// host between two frames are collected and drawn once
+#define REDRAW_RATE 30
+#define REDRAW_QUEUE 24
+
+// parts of the UI waiting for the next frame
+enum {
+    DIRTY_WINDOW    = 1<<0,
+    DIRTY_KEYBOARD  = 1<<1,
+    DIRTY_METERS    = 1<<2,
+    DIRTY_LISTS     = 1<<3,
+};
+
+#define SEARCH_SIZE 64
+
+
+// the parts of a window which only change with its size, rendered
+// once and composited on expose. back is the background below the
+// dynamic content, front the panel frames and shadows above it.
+typedef struct {
+    cairo_surface_t *back;
+    cairo_surface_t *front;
+    int width;
+    int height;
+} StaticLayer;
+
+// search index over the preset names ("bank program name"), every
+// 1, 2 and 3 byte gram of the lower cased names with the preset it
+// was found in, sorted by gram and preset
+typedef struct {
+    uint32_t key;
+    int item;
+} PresetGram;
+
+typedef struct {
+    PresetGram *grams;
+    size_t n_grams;
+    char **names;
+    int n_names;
+} PresetIndex;
 
 typedef struct {
     LV2_Atom_Forge forge;
@@ -67,15 +110,47 @@ typedef struct {
     Widget_t *combo;
     Widget_t *control[CONTROLS];
     Widget_t *channel_matrix;
+    // the output levels, then the levels of the 16 channels
+    Widget_t *meters[17];
     Widget_t *ichannel[16];
+    Widget_t *ifont[16];
     Widget_t *cm;
+    Widget_t *search;
     int *instrument_list;
+    int channel_instrument[16];
+    // the instrument selected on channel 0, as the DSP reported it
+    int instrument;
+    int prefault[3];
+    int memory[5];
+    int loading[3];
+    int samples[4];
+    int footprint[FOOTPRINT_SIZE];
+    float meter[METER_VALUES];
+    float gain_reduction;
     char *filename;
     char *dir_name;
     char *sc_dir_name;
     char **instruments;
     size_t n_elem;
     uint8_t obj_buf[OBJ_BUF_SIZE];
+    int dirty;
+    Widget_t *redraw[REDRAW_QUEUE];
+    int n_redraw;
+    double last_frame;
+    StaticLayer layer[2];
+    PresetIndex index;
+    char search_text[SEARCH_SIZE];
+    int search_active;
+    int *match;
+    int n_match;
+    // controller changes waiting for the next frame, latest value each
+    float pending_value[CONTROLS];
+    unsigned int pending_controls;
+    int pending_cc[4];
+    unsigned int pending_ccs;
+    // the channel levels are asked from the DSP while the matrix is shown
+    int meter_request;
+    double meter_check;
 
 } X11_UI_Private_t;
 
@@ -140,6 +215,104 @@ void boxShadowOutset(cairo_t* const cr, int x, int y, int width, int height, boo
 }
 
 
+// a level bar, RMS filled and peak as line, -70 .. 0 dB
+static void draw_meter(cairo_t* const cr, double x, double y, double w, double h,
+                                        float peak, float rms, bool vertical) {
+    const double len = vertical ? h : w;
+    const double r = len * (fmax(-70.0, fmin(0.0, rms)) + 70.0) / 70.0;
+    const double p = len * (fmax(-70.0, fmin(0.0, peak)) + 70.0) / 70.0;
+    cairo_set_source_rgba(cr, 0.1, 0.1, 0.1, 0.6);
+    cairo_rectangle(cr, x, y, w, h);
+    cairo_fill(cr);
+    cairo_set_source_rgba(cr, 0.3, 0.7, 0.3, 0.8);
+    if (vertical) cairo_rectangle(cr, x, y + h - r, w, r);
+    else cairo_rectangle(cr, x, y, r, h);
+    cairo_fill(cr);
+    if (peak > -70.0) {
+        if (peak > -0.5) cairo_set_source_rgba(cr, 0.9, 0.2, 0.2, 1.0);
+        else cairo_set_source_rgba(cr, 0.9, 0.6, 0.2, 1.0);
+        if (vertical) cairo_rectangle(cr, x, y + h - p, w, 2);
+        else cairo_rectangle(cr, x + p - 2, y, 2, h);
+        cairo_fill(cr);
+    }
+}
+
+// a meter widget, data 0 is the output, 1 .. 16 the channels. Level
+// messages only expose these, the background come from the layer of
+// the window below.
+static void draw_level_meter(void *w_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    Widget_t *p = (Widget_t*)w->parent;
+    X11_UI *ui = (X11_UI*) p->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    Metrics_t metrics;
+    os_get_window_metrics(w, &metrics);
+    if (!metrics.visible) return;
+    const int width = metrics.width;
+    const int height = metrics.height;
+    StaticLayer *layer = &ps->layer[p == ui->win ? 0 : 1];
+    if (layer->back) {
+        cairo_set_source_surface(w->crb, layer->back, -w->x, -w->y);
+        cairo_paint(w->crb);
+    }
+    const int slot = (int)w->data;
+    if (slot == 0) {
+        // left above right
+        const double h = (height - 2) * 0.5;
+        draw_meter(w->crb, 0, 0, width, h, ps->meter[0], ps->meter[1], false);
+        draw_meter(w->crb, 0, h + 2, width, h, ps->meter[2], ps->meter[3], false);
+    } else {
+        draw_meter(w->crb, 0, 0, width, height, ps->meter[2 + 2 * slot], ps->meter[3 + 2 * slot], true);
+    }
+}
+
+static Widget_t *add_level_meter(X11_UI *ui, Widget_t *parent, int slot,
+                                 int x, int y, int width, int height) {
+    Widget_t *w = create_widget(&ui->main, parent, x, y, width, height);
+    w->scale.gravity = ASPECT;
+    w->data = slot;
+    w->func.expose_callback = draw_level_meter;
+    return w;
+}
+
+static void free_static_layer(StaticLayer *layer) {
+    if (layer->back) cairo_surface_destroy(layer->back);
+    if (layer->front) cairo_surface_destroy(layer->front);
+    layer->back = NULL;
+    layer->front = NULL;
+    layer->width = 0;
+    layer->height = 0;
+}
+
+// render the background and the frames when the size changed,
+// the frames leave out the bottom rows (keyboard)
+static void update_static_layer(Widget_t *w, StaticLayer *layer,
+                                int width, int height, int bottom) {
+    if (layer->back && layer->width == width && layer->height == height) return;
+    free_static_layer(layer);
+    cairo_surface_t *target = cairo_get_target(w->crb);
+    layer->back = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA, width, height);
+    layer->front = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA, width, height);
+    layer->width = width;
+    layer->height = height;
+
+    // set_pattern() build the background gradient on the widget context,
+    // take it from there
+    set_pattern(w,&w->app->color_scheme->selected,&w->app->color_scheme->normal,BACKGROUND_);
+    cairo_t *cr = cairo_create(layer->back);
+    cairo_set_source(cr, cairo_get_source(w->crb));
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    height -= bottom;
+    cr = cairo_create(layer->front);
+    cairo_rectangle(cr,10, 10, width -20, height -20);
+    boxShadowInset(cr,10, 10, width -20, height -20, true);
+    cairo_stroke(cr);
+    boxShadowOutset(cr,0, 0, width, height, false);
+    cairo_destroy(cr);
+}
+
 //static
 void draw_ui(void *w_, void* user_data) {
     Widget_t *w = (Widget_t*)w_;
@@ -150,8 +323,9 @@ void draw_ui(void *w_, void* user_data) {
     if (!metrics.visible) return;
     X11_UI *ui = (X11_UI*) w->parent_struct;
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-    if (w == ui->win) height -= 64;
-    set_pattern(w,&w->app->color_scheme->selected,&w->app->color_scheme->normal,BACKGROUND_);
+    StaticLayer *layer = &ps->layer[w == ui->win ? 0 : 1];
+    update_static_layer(w, layer, width, height, w == ui->win ? 64 : 0);
+    cairo_set_source_surface(w->crb, layer->back, 0, 0);
     cairo_paint (w->crb);
 
     use_text_color_scheme(w, NORMAL_);
@@ -161,10 +335,70 @@ void draw_ui(void *w_, void* user_data) {
     cairo_move_to (w->crb, 70 * w->app->hdpi, 45 * w->app->hdpi);
     widget_reset_scale(w);
     cairo_show_text(w->crb, ps->filename);
-    cairo_rectangle(w->crb,10, 10, width -20, height -20);
-    boxShadowInset(w->crb,10, 10, width -20, height -20, true);
-    cairo_stroke(w->crb);
-    boxShadowOutset(w->crb,0, 0, width, height, false);
+    if (w == ui->win && (ps->loading[1] || ps->samples[1] || ps->prefault[1] || ps->footprint[2] ||
+                                ps->memory[2] || ps->gain_reduction < 0.0)) {
+        // load and prefault progress, resident memory, memory policy and limiter
+        char status[256] = {0};
+        if (ps->loading[1]) {
+            snprintf(status, 127, _("loading %.1f/%.1f MB, %i presets"),
+                (float)ps->loading[0] / 1024.0, (float)ps->loading[1] / 1024.0, ps->loading[2]);
+        } else if (ps->prefault[0] < ps->prefault[1]) {
+            snprintf(status, 127, _("prefault %i/%i"), ps->prefault[0], ps->prefault[1]);
+        } else if (ps->prefault[1]) {
+            snprintf(status, 127, _("%i presets ready, %.1f MB resident"),
+                            ps->prefault[1], (float)ps->prefault[2] / 1024.0);
+        }
+        if (ps->samples[1]) {
+            char budget[128];
+            snprintf(budget, 127, _("%ssamples %.1f/%.1f MB"), status[0] ? " | " : "",
+                (float)ps->samples[0] / 1024.0, (float)ps->samples[1] / 1024.0);
+            strncat(status, budget, 127);
+            if (ps->samples[2]) {
+                snprintf(budget, 127, _(", %i refused"), ps->samples[2]);
+                strncat(status, budget, 127);
+            }
+            if (ps->samples[3]) {
+                snprintf(budget, 127, _(", %i notes early"), ps->samples[3]);
+                strncat(status, budget, 127);
+            }
+        }
+        if (ps->footprint[2] && !ps->loading[1]) {
+            // sample data of the presets on the channels and the biggest preset
+            char fp[256];
+            snprintf(fp, 127, _("%spresets %.1f/%.1f MB"), status[0] ? " | " : "",
+                (float)ps->footprint[0] / 1024.0, (float)ps->footprint[2] / 1024.0);
+            strncat(status, fp, sizeof(status) - strlen(status) - 1);
+            const int top = ps->footprint[3];
+            if (top >= 0 && top < (int)ps->n_elem && ps->instruments) {
+                snprintf(fp, 255, _(", biggest %s %.1f MB"), ps->instruments[top],
+                                        (float)ps->footprint[4] / 1024.0);
+                strncat(status, fp, sizeof(status) - strlen(status) - 1);
+            }
+        }
+        if (ps->memory[2]) {
+            char policy[128];
+            snprintf(policy, 127, _("%slocked %.1f/%.1f MB%s"), status[0] ? " | " : "",
+                (float)ps->memory[1] / 1024.0, (float)ps->memory[2] / 1024.0,
+                (ps->memory[0] & 2) ? ", huge pages" : "");
+            strncat(status, policy, 127);
+            if (ps->memory[0] & 4) {
+                snprintf(policy, 127, _(", node %i"), ps->memory[4]);
+                strncat(status, policy, 127);
+            }
+        }
+        if (ps->gain_reduction < 0.0) {
+            char gr[64];
+            snprintf(gr, 63, _("%sGR %.1f dB"), status[0] ? " | " : "", ps->gain_reduction);
+            strncat(status, gr, 63);
+        }
+        cairo_set_font_size (w->crb, w->app->small_font/w->scale.ascale);
+        widget_set_scale(w);
+        cairo_move_to (w->crb, 70 * w->app->hdpi, 60 * w->app->hdpi);
+        widget_reset_scale(w);
+        cairo_show_text(w->crb, status);
+    }
+    cairo_set_source_surface(w->crb, layer->front, 0, 0);
+    cairo_paint (w->crb);
     cairo_new_path (w->crb);
 }
 
@@ -279,6 +513,233 @@ static void dummy_callback(void *w_, void* user_data) {
 
 }
 
+/****************************************************************
+ ** preset search
+ **
+ ** the index is build once when the preset list arrive. A query
+ ** take the posting range of the rarest gram of the search text and
+ ** check only those presets with strstr(), results keep list order.
+ */
+
+static uint32_t gram_key(const char *s, int len) {
+    uint32_t key = (uint32_t)len << 24;
+    for (int i = 0; i < len; i++) key |= (uint32_t)(unsigned char)s[i] << (8 * i);
+    return key;
+}
+
+static int gram_compare(const void *a_, const void *b_) {
+    const PresetGram *a = (const PresetGram*)a_;
+    const PresetGram *b = (const PresetGram*)b_;
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    return a->item - b->item;
+}
+
+static void preset_index_free(PresetIndex *index) {
+    for (int i = 0; i < index->n_names; i++) free(index->names[i]);
+    free(index->names);
+    free(index->grams);
+    index->names = NULL;
+    index->grams = NULL;
+    index->n_names = 0;
+    index->n_grams = 0;
+}
+
+static void preset_index_build(PresetIndex *index, char **names, int n) {
+    preset_index_free(index);
+    if (!n) return;
+    index->names = (char**)malloc(n * sizeof(char*));
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        index->names[i] = strdup(names[i] ? names[i] : "");
+        for (char *c = index->names[i]; *c; c++) *c = tolower((unsigned char)*c);
+        const size_t len = strlen(index->names[i]);
+        if (len) total += 3 * len;
+    }
+    index->n_names = n;
+    index->grams = (PresetGram*)malloc((total ? total : 1) * sizeof(PresetGram));
+    size_t g = 0;
+    for (int i = 0; i < n; i++) {
+        const char *name = index->names[i];
+        const int len = (int)strlen(name);
+        for (int l = 1; l <= 3; l++) {
+            for (int j = 0; j + l <= len; j++) {
+                index->grams[g].key = gram_key(name + j, l);
+                index->grams[g].item = i;
+                g++;
+            }
+        }
+    }
+    qsort(index->grams, g, sizeof(PresetGram), gram_compare);
+    // a gram found twice in one name is listed once
+    size_t k = 0;
+    for (size_t i = 0; i < g; i++) {
+        if (k && index->grams[k-1].key == index->grams[i].key &&
+                index->grams[k-1].item == index->grams[i].item) continue;
+        index->grams[k++] = index->grams[i];
+    }
+    index->n_grams = k;
+}
+
+// first gram with a key not below key
+static size_t gram_lower_bound(const PresetIndex *index, uint32_t key) {
+    size_t lo = 0;
+    size_t hi = index->n_grams;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (index->grams[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// write the matching presets to match (room for n_names), return the count
+static int preset_index_query(const PresetIndex *index, const char *text, int *match) {
+    char q[SEARCH_SIZE];
+    int len = 0;
+    for (; text[len] && len < SEARCH_SIZE - 1; len++) q[len] = tolower((unsigned char)text[len]);
+    q[len] = 0;
+    if (!len || !index->n_grams) return 0;
+    const int l = len < 3 ? len : 3;
+    size_t first = 0;
+    size_t last = index->n_grams;
+    for (int j = 0; j + l <= len; j++) {
+        const uint32_t key = gram_key(q + j, l);
+        const size_t b = gram_lower_bound(index, key);
+        const size_t e = gram_lower_bound(index, key + 1);
+        if (e - b < last - first) {
+            first = b;
+            last = e;
+        }
+        if (first == last) return 0;
+    }
+    int n = 0;
+    for (size_t i = first; i < last; i++) {
+        const int item = index->grams[i].item;
+        if (l == len || strstr(index->names[item], q)) match[n++] = item;
+    }
+    return n;
+}
+
+// the entries shown in the instrument selectors, all presets or the search result
+static int visible_count(X11_UI_Private_t *ps) {
+    return ps->search_text[0] ? ps->n_match : (int)ps->n_elem;
+}
+
+static int entry_to_instrument(X11_UI_Private_t *ps, int e) {
+    if (!ps->search_text[0]) return e;
+    return (e >= 0 && e < ps->n_match) ? ps->match[e] : -1;
+}
+
+// -1 when the instrument isn't in the list
+static int instrument_to_entry(X11_UI_Private_t *ps, int a) {
+    if (!ps->search_text[0]) return a < (int)ps->n_elem ? a : -1;
+    for (int i = 0; i < ps->n_match; i++) {
+        if (ps->match[i] == a) return i;
+    }
+    return -1;
+}
+
+static void run_search(X11_UI *ui) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    ps->n_match = ps->search_text[0] && ps->match ?
+        preset_index_query(&ps->index, ps->search_text, ps->match) : 0;
+}
+
+/****************************************************************
+ ** redraw scheduling
+ **
+ ** messages from the host only update the model and mark what
+ ** changed, plugin_idle() draw the dirty parts once per frame.
+ */
+
+static void mark_dirty(X11_UI *ui, int what) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    ps->dirty |= what;
+}
+
+static void queue_redraw(X11_UI *ui, Widget_t *w) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    for (int i = 0; i < ps->n_redraw; i++) {
+        if (ps->redraw[i] == w) return;
+    }
+    if (ps->n_redraw < REDRAW_QUEUE) {
+        ps->redraw[ps->n_redraw++] = w;
+    } else {
+        // queue full, redraw the whole window instead
+        ps->dirty |= DIRTY_WINDOW;
+    }
+}
+
+void fill_instrument_lists(X11_UI *ui);
+static void flush_controller_messages(X11_UI *ui);
+
+// select an entry without calling back to the host. e is -1 for an
+// instrument the list doesn't show, no entry is active then and any
+// one could be picked, the label stay as it is.
+static void set_active_entry(Widget_t *w, int e) {
+    xevfunc store = w->func.value_changed_callback;
+    w->func.value_changed_callback = dummy_callback;
+    combobox_set_active_entry(w, e);
+    w->func.value_changed_callback = *(*store);
+}
+
+static double monotonic_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// the DSP render the channels one by one only while they are metered
+static void request_channel_meter(X11_UI *ui, int on) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if (ps->meter_request == on) return;
+    ps->meter_request = on;
+    uint8_t obj_buf[OBJ_BUF_SIZE];
+    lv2_atom_forge_set_buffer(&ps->forge, obj_buf, OBJ_BUF_SIZE);
+    LV2_Atom* msg = write_set_meter_request(&ps->forge, &ps->uris, on);
+    ui->write_function(ui->controller, MIDI_IN, lv2_atom_total_size(msg),
+                       ps->uris.atom_eventTransfer, msg);
+}
+
+// the window manager could close the matrix too, look twice a second
+static void check_channel_meter(X11_UI *ui, double now) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if (!ps->channel_matrix || now - ps->meter_check < 0.5) return;
+    ps->meter_check = now;
+    Metrics_t metrics;
+    os_get_window_metrics(ps->channel_matrix, &metrics);
+    request_channel_meter(ui, metrics.visible ? 1 : 0);
+}
+
+void plugin_idle(X11_UI *ui) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if (!ps) return;
+    const double now = monotonic_seconds();
+    check_channel_meter(ui, now);
+    if (!ps->dirty && !ps->n_redraw && !ps->pending_controls && !ps->pending_ccs) return;
+    if (now - ps->last_frame < 1.0 / REDRAW_RATE) return;
+    ps->last_frame = now;
+    flush_controller_messages(ui);
+    if (ps->dirty & DIRTY_WINDOW) {
+        // exposing the toplevel window redraw all child widgets
+        expose_widget(ui->win);
+    } else {
+        if (ps->dirty & DIRTY_KEYBOARD) expose_widget(ui->widget[0]);
+        if (ps->dirty & DIRTY_METERS) expose_widget(ps->meters[0]);
+        for (int i = 0; i < ps->n_redraw; i++) {
+            expose_widget(ps->redraw[i]);
+        }
+    }
+    // the channel levels only come while the matrix is shown
+    if ((ps->dirty & DIRTY_METERS) && ps->channel_matrix && ps->meter_request) {
+        for (int i = 1; i < 17; i++) expose_widget(ps->meters[i]);
+    }
+    // search results, refill the selectors once for all keys typed in a frame
+    if (ps->dirty & DIRTY_LISTS) fill_instrument_lists(ui);
+    ps->dirty = 0;
+    ps->n_redraw = 0;
+}
+
 void get_channel_instruments(X11_UI *ui) {
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
     const FluidaLV2URIs* uris = &ps->uris;
@@ -295,55 +756,63 @@ void get_channel_instruments(X11_UI *ui) {
 void rebuild_channel_matrix(X11_UI *ui) {
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
     if (!ps->channel_matrix) return;
+    const int n = visible_count(ps);
     for (int i=0;i<16;i++) {
         if(ps->ichannel[i]) {
             combobox_delete_entrys(ps->ichannel[i]);
         }
-        for (int j = 0; j < (int)ps->n_elem; j++) {
-            combobox_add_entry(ps->ichannel[i],ps->instruments[j]);
+        for (int j = 0; j < n; j++) {
+            combobox_add_entry(ps->ichannel[i],ps->instruments[entry_to_instrument(ps, j)]);
         }
-        if (!(int)ps->n_elem) {
+        if (!n) {
             combobox_add_entry(ps->ichannel[i],"None");
         }
         combobox_set_menu_size(ps->ichannel[i], 12);
         if (ps->instrument_list) {
-            xevfunc store = ps->ichannel[i]->func.value_changed_callback;
-            ps->ichannel[i]->func.value_changed_callback = dummy_callback;
-            combobox_set_active_entry(ps->ichannel[i],ps->instrument_list[i]);
-            ps->ichannel[i]->func.value_changed_callback = *(*store);
+            // a preset filtered out by the search keep its label
+            set_active_entry(ps->ichannel[i], instrument_to_entry(ps, ps->instrument_list[i]));
             expose_widget(ps->ichannel[i]);
         }
     }
     expose_widget(ps->channel_matrix);
 }
 
-void rebuild_instrument_list(X11_UI *ui) {
+// fill the instrument selector and the channel matrix with the visible entries
+void fill_instrument_lists(X11_UI *ui) {
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-    get_channel_instruments(ui);
+    const int n = visible_count(ps);
     if(ps->combo) {
         combobox_delete_entrys(ps->combo);
     }
-    for (int i = 0; i < (int)ps->n_elem; i++) {
-        combobox_add_entry(ps->combo, ps->instruments[i]);
+    for (int i = 0; i < n; i++) {
+        combobox_add_entry(ps->combo, ps->instruments[entry_to_instrument(ps, i)]);
     }
-    if (!(int)ps->n_elem) {
+    if (!n) {
         combobox_add_entry(ps->combo,"None");
     }
     combobox_set_menu_size(ps->combo, 12);
-    xevfunc store = ps->combo->func.value_changed_callback;
-    ps->combo->func.value_changed_callback = dummy_callback;
-    combobox_set_active_entry(ps->combo, 0);
-    ps->combo->func.value_changed_callback = *(*store);
+    set_active_entry(ps->combo, n ? instrument_to_entry(ps, ps->instrument) : 0);
     expose_widget(ps->combo);
     rebuild_channel_matrix(ui);
 }
 
+void rebuild_instrument_list(X11_UI *ui) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    get_channel_instruments(ui);
+    preset_index_build(&ps->index, ps->instruments, (int)ps->n_elem);
+    free(ps->match);
+    ps->match = (int*)malloc(((int)ps->n_elem + 1) * sizeof(int));
+    run_search(ui);
+    fill_instrument_lists(ui);
+}
+
 static void channel_instrument_callback(void *w_, void* user_data) {
     Widget_t *w = (Widget_t*)w_;
     Widget_t *p = (Widget_t*)w->parent;
     X11_UI *ui = (X11_UI*) p->parent_struct;
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-    const int i = (const int)adj_get_value(w->adj);
+    const int i = entry_to_instrument(ps, (int)adj_get_value(w->adj));
+    if (i < 0) return;
     int vec[2] = {w->data, i};
     lv2_atom_forge_set_buffer(&ps->forge, ps->obj_buf, sizeof(ps->obj_buf));
 
@@ -354,12 +823,42 @@ static void channel_instrument_callback(void *w_, void* user_data) {
 
 }
 
+static void channel_font_response(void *w_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    Widget_t *p = (Widget_t*)w->parent;
+    X11_UI *ui = (X11_UI*) p->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if(user_data !=NULL) {
+        if( access(*(const char**)user_data, F_OK ) == -1 ) {
+            Widget_t *dia = open_message_dialog(ps->channel_matrix, ERROR_BOX, *(const char**)user_data,
+                                                _("Couldn't access file, sorry"),NULL);
+            os_set_transient_for_hint(ps->channel_matrix, dia);
+            return;
+        }
+        if (strstr(*(const char**)user_data, ".sfz")) {
+            Widget_t *dia = open_message_dialog(ps->channel_matrix, ERROR_BOX, *(const char**)user_data, 
+            _("Couldn't load file in sfz format, sorry"),NULL);
+            os_set_transient_for_hint(ps->channel_matrix, dia);
+            return;
+        }
+        lv2_atom_forge_set_buffer(&ps->forge, ps->obj_buf, sizeof(ps->obj_buf));
+
+        LV2_Atom* msg = (LV2_Atom*)write_set_channel_font(&ps->forge, &ps->uris,
+                                                        w->data, *(const char**)user_data);
+
+        ui->write_function(ui->controller, MIDI_IN, lv2_atom_total_size(msg),
+                           ps->uris.atom_eventTransfer, msg);
+    }
+}
+
 static void instrument_callback(void *w_, void* user_data) {
     Widget_t *w = (Widget_t*)w_;
     Widget_t *p = (Widget_t*)w->parent;
     X11_UI *ui = (X11_UI*) p->parent_struct;
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-    const int i = (const int)adj_get_value(w->adj);
+    const int i = entry_to_instrument(ps, (int)adj_get_value(w->adj));
+    if (i < 0) return;
+    ps->instrument = i;
     lv2_atom_forge_set_buffer(&ps->forge, ps->obj_buf, sizeof(ps->obj_buf));
 
     LV2_Atom* msg = write_set_instrument(&ps->forge, &ps->uris, i);
@@ -397,9 +896,8 @@ void first_loop(X11_UI *ui) {
 
 void set_active_instrument(X11_UI *ui, int a) {
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-    ps->combo->func.value_changed_callback = dummy_callback;
-    combobox_set_active_entry(ps->combo, a);
-    ps->combo->func.value_changed_callback = instrument_callback;
+    ps->instrument = a;
+    set_active_entry(ps->combo, instrument_to_entry(ps, a));
 }
 
 static void dnd_load_response(void *w_, void* user_data) {
@@ -423,12 +921,35 @@ static void dnd_load_response(void *w_, void* user_data) {
     }
 }
 
+static void forge_controller_value(LV2_Atom_Forge *forge, Widget_t *w, const float value) {
+    switch(w->data) {
+        case 2:
+            lv2_atom_forge_int(forge, (int)value);
+        break;
+        case 3:
+            lv2_atom_forge_bool(forge, (int)value);
+        break;
+        default:
+            lv2_atom_forge_float(forge, value);
+        break;
+    }
+}
+
+// controls are collected and send once a frame by flush_controller_messages(),
+// other widgets go out at once
 void send_controller_message(Widget_t *w, const LV2_URID control) {
     Widget_t *p = (Widget_t*)w->parent;
     X11_UI *ui = (X11_UI*) p->parent_struct;
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
     const FluidaLV2URIs* uris = &ps->uris;
     const float value = adj_get_value(w->adj);
+    for (int i = 0; i < CONTROLS; i++) {
+        if (ps->control[i] == w) {
+            ps->pending_value[i] = value;
+            ps->pending_controls |= 1u << i;
+            return;
+        }
+    }
     uint8_t obj_buf[OBJ_BUF_SIZE];
     lv2_atom_forge_set_buffer(&ps->forge, obj_buf, OBJ_BUF_SIZE);
 
@@ -437,32 +958,20 @@ void send_controller_message(Widget_t *w, const LV2_URID control) {
     lv2_atom_forge_key(&ps->forge, uris->patch_property);
     lv2_atom_forge_urid(&ps->forge, control);
     lv2_atom_forge_key(&ps->forge, uris->patch_value);
-    switch(w->data) {
-        case 2:
-            lv2_atom_forge_int(&ps->forge, (int)value);
-        break;
-        case 3:
-            lv2_atom_forge_bool(&ps->forge, (int)value);
-        break;
-        default:
-            lv2_atom_forge_float(&ps->forge, value);
-        break;
-    }
+    forge_controller_value(&ps->forge, w, value);
     lv2_atom_forge_pop(&ps->forge, &frame);
     ui->write_function(ui->controller, MIDI_IN, lv2_atom_total_size(msg),
                        ps->uris.atom_eventTransfer, msg);
 }
 
-static void send_midi_data(Widget_t *w, const int *key, const int control) {
-    X11_UI *ui = (X11_UI*) w->parent_struct;
+static void write_midi_cc(X11_UI *ui, uint8_t cc, uint8_t value) {
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-    MidiKeyboard *keys = (MidiKeyboard*)ui->widget[0]->private_struct;
     uint8_t obj_buf[OBJ_BUF_SIZE];
     uint8_t vec[3];
-    vec[0] = (int)control;
-    vec[0] |= keys->channel;
-    vec[1] = (*key);
-    vec[2] = keys->velocity;
+    vec[0] = 0xB0;
+    vec[0] |= 0;
+    vec[1] = cc;
+    vec[2] = value;
     lv2_atom_forge_set_buffer(&ps->forge, obj_buf, OBJ_BUF_SIZE);
 
     lv2_atom_forge_frame_time(&ps->forge,0);
@@ -472,20 +981,50 @@ static void send_midi_data(Widget_t *w, const int *key, const int control) {
 
     ui->write_function(ui->controller, 2, lv2_atom_total_size(msg),
                        ps->uris.atom_eventTransfer, msg);
+}
 
+// send what changed since the last frame: all controls in one patch:Put,
+// the DSP apply it as one worker job, and the last value of each CC knob
+static void flush_controller_messages(X11_UI *ui) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    const FluidaLV2URIs* uris = &ps->uris;
+    if (ps->pending_controls) {
+        uint8_t obj_buf[OBJ_BUF_SIZE];
+        lv2_atom_forge_set_buffer(&ps->forge, obj_buf, OBJ_BUF_SIZE);
+
+        LV2_Atom_Forge_Frame frame;
+        LV2_Atom_Forge_Frame body;
+        LV2_Atom* msg = (LV2_Atom*)lv2_atom_forge_object(&ps->forge, &frame, 0, uris->patch_Put);
+        lv2_atom_forge_key(&ps->forge, uris->patch_body);
+        lv2_atom_forge_object(&ps->forge, &body, 0, 0);
+        for (int i = 0; i < CONTROLS; i++) {
+            if (!(ps->pending_controls & (1u << i))) continue;
+            lv2_atom_forge_key(&ps->forge, *(const LV2_URID*)ps->control[i]->parent_struct);
+            forge_controller_value(&ps->forge, ps->control[i], ps->pending_value[i]);
+        }
+        lv2_atom_forge_pop(&ps->forge, &body);
+        lv2_atom_forge_pop(&ps->forge, &frame);
+        ui->write_function(ui->controller, MIDI_IN, lv2_atom_total_size(msg),
+                           ps->uris.atom_eventTransfer, msg);
+        ps->pending_controls = 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!(ps->pending_ccs & (1u << i))) continue;
+        write_midi_cc(ui, (uint8_t)ui->widget[i + 1]->data, (uint8_t)ps->pending_cc[i]);
+    }
+    ps->pending_ccs = 0;
 }
 
-static void send_midi_cc(void *w_, void* user_data) {
-    Widget_t *w = (Widget_t*)w_;
+static void send_midi_data(Widget_t *w, const int *key, const int control) {
     X11_UI *ui = (X11_UI*) w->parent_struct;
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
-    int i = (int)adj_get_value(w->adj);
+    MidiKeyboard *keys = (MidiKeyboard*)ui->widget[0]->private_struct;
     uint8_t obj_buf[OBJ_BUF_SIZE];
     uint8_t vec[3];
-    vec[0] = 0xB0;
-    vec[0] |= 0;
-    vec[1] = (int)w->data;
-    vec[2] = i;
+    vec[0] = (int)control;
+    vec[0] |= keys->channel;
+    vec[1] = (*key);
+    vec[2] = keys->velocity;
     lv2_atom_forge_set_buffer(&ps->forge, obj_buf, OBJ_BUF_SIZE);
 
     lv2_atom_forge_frame_time(&ps->forge,0);
@@ -498,6 +1037,21 @@ static void send_midi_cc(void *w_, void* user_data) {
 
 }
 
+// the CC knobs, the latest value go out with the next frame
+static void send_midi_cc(void *w_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    X11_UI *ui = (X11_UI*) w->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    for (int i = 0; i < 4; i++) {
+        if (ui->widget[i + 1] == w) {
+            ps->pending_cc[i] = (int)adj_get_value(w->adj);
+            ps->pending_ccs |= 1u << i;
+            return;
+        }
+    }
+    write_midi_cc(ui, (uint8_t)w->data, (uint8_t)adj_get_value(w->adj));
+}
+
 static void tuning_callback(void *w_, void* user_data) {
     Widget_t *w = (Widget_t*)w_;
     const LV2_URID urid = *(const LV2_URID*)w->parent_struct;
@@ -521,15 +1075,122 @@ void controller_callback(void *w_, void* user_data) {
     send_controller_message(w, urid);
 }
 
+// the search field, text typed while it is active filter the presets
+static void draw_search(void *w_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    Widget_t *p = (Widget_t*)w->parent;
+    X11_UI *ui = (X11_UI*) p->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    Metrics_t metrics;
+    os_get_window_metrics(w, &metrics);
+    if (!metrics.visible) return;
+    const int width = metrics.width;
+    const int height = metrics.height;
+
+    use_base_color_scheme(w, NORMAL_);
+    cairo_rectangle(w->crb, 2, 2, width - 4, height - 4);
+    cairo_fill_preserve(w->crb);
+    use_frame_color_scheme(w, ps->search_active ? SELECTED_ : NORMAL_);
+    cairo_set_line_width(w->crb, 1);
+    cairo_stroke(w->crb);
+
+    cairo_text_extents_t extents;
+    cairo_set_font_size (w->crb, w->app->normal_font/w->scale.ascale);
+    const char *text = ps->search_text[0] || ps->search_active ? ps->search_text : _("search");
+    cairo_text_extents(w->crb, "Ay", &extents);
+    const double y = (height + extents.height) * 0.5 - 2;
+    cairo_text_extents(w->crb, text, &extents);
+    // keep the end of a long text in view
+    double x = 6;
+    if (extents.x_advance > width - 14) x = width - 8 - extents.x_advance;
+    cairo_rectangle(w->crb, 4, 2, width - 8, height - 4);
+    cairo_clip(w->crb);
+    use_text_color_scheme(w, ps->search_text[0] ? NORMAL_ : INSENSITIVE_);
+    cairo_move_to(w->crb, x, y);
+    cairo_show_text(w->crb, text);
+    if (ps->search_active) {
+        use_text_color_scheme(w, NORMAL_);
+        cairo_rectangle(w->crb, x + extents.x_advance + 1, 6, 1, height - 12);
+        cairo_fill(w->crb);
+    }
+    cairo_reset_clip(w->crb);
+    cairo_new_path(w->crb);
+}
+
+static void search_changed(X11_UI *ui) {
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    run_search(ui);
+    mark_dirty(ui, DIRTY_LISTS);
+    queue_redraw(ui, ps->search);
+}
+
+static void search_key_press(void *w_, void *key_, void *user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    Widget_t *p = (Widget_t*)w->parent;
+    X11_UI *ui = (X11_UI*) p->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if (!key_) return;
+    char buf[32];
+    memset(buf, 0, sizeof(buf));
+    if (!os_get_keyboard_input(w, (XKeyEvent*)key_, buf, sizeof(buf) - 1)) return;
+    size_t len = strlen(ps->search_text);
+    const unsigned char c = (unsigned char)buf[0];
+    if (c == '\r' || c == '\n') {
+        ps->search_active = 0;
+        queue_redraw(ui, ps->search);
+        return;
+    } else if (c == 0x1b) {
+        ps->search_text[0] = 0;
+        ps->search_active = 0;
+    } else if (c == '\b' || c == 0x7f) {
+        if (!len) return;
+        // drop one UTF-8 character
+        while (len && ((unsigned char)ps->search_text[len - 1] & 0xc0) == 0x80) len--;
+        if (len) len--;
+        ps->search_text[len] = 0;
+    } else if (c >= 0x20) {
+        if (len + strlen(buf) >= SEARCH_SIZE) return;
+        strcat(ps->search_text, buf);
+    } else {
+        return;
+    }
+    search_changed(ui);
+}
+
+static void search_clicked(void *w_, void* button_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    Widget_t *p = (Widget_t*)w->parent;
+    X11_UI *ui = (X11_UI*) p->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    ps->search_active = 1;
+    queue_redraw(ui, w);
+}
+
+static void window_clicked(void *w_, void* button_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    X11_UI *ui = (X11_UI*) w->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if (!ps->search_active) return;
+    ps->search_active = 0;
+    queue_redraw(ui, ps->search);
+}
+
 static void xkey_press(void *w_, void *key_, void *user_data) {
     Widget_t *w = (Widget_t*)w_;
     X11_UI *ui = (X11_UI*) w->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if (ps->search_active) {
+        search_key_press(ps->search, key_, user_data);
+        return;
+    }
     ui->widget[0]->func.key_press_callback(ui->widget[0], key_, user_data);
 
 }
 static void xkey_release(void *w_, void *key_, void *user_data) {
     Widget_t *w = (Widget_t*)w_;
     X11_UI *ui = (X11_UI*) w->parent_struct;
+    X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    if (ps->search_active) return;
     ui->widget[0]->func.key_release_callback(ui->widget[0], key_, user_data);
 
 }
@@ -556,26 +1217,34 @@ static void set_velocity(void *w_, void* user_data) {
     controller_callback(w, user_data);
 }
 
+// set a value without calling back to the host. Widgets drawn by the
+// default adjustment callback are not exposed now but on the next frame,
+// widgets with an own adjustment callback (labels, combobox entries)
+// still update themselves.
+void set_ctl_val_from_host(X11_UI *ui, Widget_t *w, float value) {
+    xevfunc store = w->func.value_changed_callback;
+    w->func.value_changed_callback = dummy_callback;
+    if (w->func.adj_callback == transparent_draw) {
+        w->func.adj_callback = dummy_callback;
+        adj_set_value(w->adj, value);
+        w->func.adj_callback = transparent_draw;
+        queue_redraw(ui, w);
+    } else {
+        adj_set_value(w->adj, value);
+    }
+    w->func.value_changed_callback = *(*store);
+}
+
 void set_midi_cc_value(X11_UI *ui, uint8_t cc, uint8_t value) {
     for (int i = 1; i<5;i++) {
         int c = ui->widget[i]->data;
         if (c == (int)cc) {
-            xevfunc store =ui->widget[i]->func.value_changed_callback;
-            ui->widget[i]->func.value_changed_callback = dummy_callback;
-            adj_set_value(ui->widget[i]->adj, value);
-            ui->widget[i]->func.value_changed_callback = *(*store);
+            set_ctl_val_from_host(ui, ui->widget[i], value);
             break;
         }
     }
 }
 
-void set_ctl_val_from_host(Widget_t *w, float value) {
-    xevfunc store = w->func.value_changed_callback;
-    w->func.value_changed_callback = dummy_callback;
-    adj_set_value(w->adj, value);
-    w->func.value_changed_callback = *(*store);
-}
-
 void create_channel_matrix(X11_UI *ui) {
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
     ps->channel_matrix = create_window(&ui->main, os_get_root_window(&ui->main, IS_WINDOW), 0, 0, 590, 319);
@@ -586,10 +1255,15 @@ void create_channel_matrix(X11_UI *ui) {
     int j = 0;
     int k = 55;
     for (int i=0;i<16;i++) {
-        ps->ichannel[i] = add_combobox(ps->channel_matrix, _("Instruments"), 25+j, k, 260, 30);
+        ps->ichannel[i] = add_combobox(ps->channel_matrix, _("Instruments"), 25+j, k, 225, 30);
         ps->ichannel[i]->data = i;
         combobox_add_entry(ps->ichannel[i],"None");
         ps->ichannel[i]->func.value_changed_callback = channel_instrument_callback;
+        ps->ifont[i] = add_file_button(ps->channel_matrix, 255+j, k, 30, 30, ps->dir_name, ".sf");
+        ps->ifont[i]->data = i;
+        ps->ifont[i]->func.user_callback = channel_font_response;
+        // channel level, right of the font button
+        ps->meters[i + 1] = add_level_meter(ui, ps->channel_matrix, i + 1, 288+j, k+2, 8, 26);
         k += 30;
         if (k>270) {
             j = 280;
@@ -623,7 +1297,12 @@ void show_channel_matrix(void *w_, void* user_data) {
                 os_get_root_window(&ui->main, IS_WIDGET), 0, 0, &x1, &y1);
             widget_show_all(ps->channel_matrix);
             os_move_window(ui->win->app->dpy,ps->channel_matrix,x1+ui->win->width, y1-16);
-        } else widget_hide(ps->channel_matrix);
+            request_channel_meter(ui, 1);
+        } else {
+            widget_hide(ps->channel_matrix);
+            request_channel_meter(ui, 0);
+        }
+        ps->meter_check = monotonic_seconds();
     }
 }
 
@@ -636,7 +1315,30 @@ void plugin_create_controller_widgets(X11_UI *ui, const char * plugin_uri) {
     ps->instruments = NULL;
     ps->n_elem = 0;
     ps->instrument_list = NULL;
+    ps->instrument = 0;
     ps->channel_matrix = NULL;
+    memset(ps->prefault, 0, sizeof(ps->prefault));
+    memset(ps->memory, 0, sizeof(ps->memory));
+    memset(ps->loading, 0, sizeof(ps->loading));
+    memset(ps->samples, 0, sizeof(ps->samples));
+    memset(ps->footprint, 0, sizeof(ps->footprint));
+    for (int i = 0; i < METER_VALUES; i++) ps->meter[i] = -70.0;
+    ps->gain_reduction = 0.0;
+    ps->dirty = 0;
+    ps->n_redraw = 0;
+    ps->last_frame = 0.0;
+    ps->meter_request = 0;
+    ps->meter_check = 0.0;
+    memset(ps->layer, 0, sizeof(ps->layer));
+    memset(&ps->index, 0, sizeof(ps->index));
+    memset(ps->channel_instrument, 0, sizeof(ps->channel_instrument));
+    ps->search = NULL;
+    ps->search_text[0] = 0;
+    ps->search_active = 0;
+    ps->match = NULL;
+    ps->n_match = 0;
+    ps->pending_controls = 0;
+    ps->pending_ccs = 0;
 
     map_fluidalv2_uris(ui->map, &ps->uris);
     lv2_atom_forge_init(&ps->forge, ui->map);
@@ -656,13 +1358,23 @@ void plugin_create_controller_widgets(X11_UI *ui, const char * plugin_uri) {
     ps->dia = add_file_button(ui->win, 20, 20, 40, 40, ps->dir_name, ".sf");
     ps->dia->func.user_callback = synth_load_response;
 
-    ps->combo = add_combobox(ui->win, _("Instruments"), 20, 70, 260, 30);
+    ps->combo = add_combobox(ui->win, _("Instruments"), 20, 70, 190, 30);
     ps->combo->flags |= NO_AUTOREPEAT;
     ps->combo->parent_struct = (void*)uris;
     combobox_add_entry(ps->combo,"None");
     ps->combo->childlist->childs[0]->flags |= NO_AUTOREPEAT;
     ps->combo->func.value_changed_callback = instrument_callback;
 
+    ps->search = create_widget(&ui->main, ui->win, 215, 70, 90, 30);
+    ps->search->scale.gravity = ASPECT;
+    ps->search->func.expose_callback = draw_search;
+    ps->search->func.key_press_callback = search_key_press;
+    ps->search->func.button_release_callback = search_clicked;
+    ui->win->func.button_release_callback = window_clicked;
+
+    // output levels, left and right
+    ps->meters[0] = add_level_meter(ui, ui->win, 0, 70, 16, 450, 10);
+
     ps->cm = add_image_toggle_button(ui->win, "", 310, 70, 35, 35);
     widget_get_png(ps->cm, LDVAR(gear_png));
     ps->cm->func.value_changed_callback = show_channel_matrix;
@@ -845,6 +1557,13 @@ void plugin_create_controller_widgets(X11_UI *ui, const char * plugin_uri) {
 void plugin_cleanup(X11_UI *ui) {
     // clean up used sources when needed
     X11_UI_Private_t *ps = (X11_UI_Private_t*)ui->private_ptr;
+    // controller moves waiting for the next frame still go to the DSP
+    flush_controller_messages(ui);
+    request_channel_meter(ui, 0);
+    free_static_layer(&ps->layer[0]);
+    free_static_layer(&ps->layer[1]);
+    preset_index_free(&ps->index);
+    free(ps->match);
     free(ps->filename);
     free(ps->dir_name);
     unsigned int j = 0;
@@ -897,7 +1616,7 @@ void plugin_port_event(LV2UI_Handle handle, uint32_t port_index,
                 default:
                 break;
             }
-            expose_widget(ui->widget[0]);
+            mark_dirty(ui, DIRTY_KEYBOARD);
         } else if (atom->type == ps->uris.atom_Object) {
             const LV2_Atom_Object* obj      = (LV2_Atom_Object*)atom;
             if (obj->body.otype == uris->patch_Set) {
@@ -914,7 +1633,7 @@ void plugin_port_event(LV2UI_Handle handle, uint32_t port_index,
                             ps->dir_name = strdup(dirname((char*)uri));
                             FileButton *filebutton = (FileButton*)ps->dia->private_struct;
                             filebutton->path = ps->dir_name;
-                            expose_widget(ui->win);
+                            mark_dirty(ui, DIRTY_WINDOW);
                         }
                     }
                 } else {
@@ -928,13 +1647,18 @@ void plugin_port_event(LV2UI_Handle handle, uint32_t port_index,
                     if (w) {
                         if (value->type == uris->atom_Float ) {
                             float* val = (float*)LV2_ATOM_BODY(value);
-                            set_ctl_val_from_host(w, (*val));
+                            set_ctl_val_from_host(ui, w, (*val));
                         } else if (value->type == uris->atom_Int ) {
                             int* val = (int*)LV2_ATOM_BODY(value);
-                            set_ctl_val_from_host(w, (float)(*val));
+                            set_ctl_val_from_host(ui, w, (float)(*val));
                         }else if (value->type == uris->atom_Bool ) {
                             int* val = (int*)LV2_ATOM_BODY(value);
-                            set_ctl_val_from_host(w, (float)(*val));
+                            set_ctl_val_from_host(ui, w, (float)(*val));
+                        }
+                    } else if (((LV2_Atom_URID*)property)->body == uris->fluida_gain_reduction) {
+                        if (value->type == uris->atom_Float ) {
+                            ps->gain_reduction = *(float*)LV2_ATOM_BODY(value);
+                            mark_dirty(ui, DIRTY_WINDOW);
                         }
                     } else if (((LV2_Atom_URID*)property)->body == uris->fluida_scl) {
                         if (value->type == uris->atom_String ) {
@@ -1019,12 +1743,60 @@ void plugin_port_event(LV2UI_Handle handle, uint32_t port_index,
                     const int* uri = (int*)LV2_ATOM_BODY(value);
                     set_active_instrument(ui, (*uri)) ;
                 }
+            } else if (obj->body.otype == uris->fluida_prefault) {
+                const LV2_Atom_Vector* vec = read_set_prefault(uris, obj);
+                if (!vec) return;
+                memcpy(ps->prefault, LV2_ATOM_BODY(&vec->atom), sizeof(ps->prefault));
+                mark_dirty(ui, DIRTY_WINDOW);
+            } else if (obj->body.otype == uris->fluida_snapshot) {
+                const LV2_Atom_Vector* gen = NULL;
+                const LV2_Atom_Vector* val = NULL;
+                if (!read_set_snapshot(uris, obj, &gen, &val)) return;
+                const int* generations = (const int*)LV2_ATOM_BODY(&gen->atom);
+                const float* values = (const float*)LV2_ATOM_BODY(&val->atom);
+                // apply all fields in one pass, then tell the DSP what we have
+                for (int i = 0; i < CTL_FIELDS; i++) {
+                    if (!generations[i + 1]) continue;
+                    Widget_t *w = get_widget_from_urid(ps, snapshot_field_urid(uris, i));
+                    if (w) set_ctl_val_from_host(ui, w, values[i]);
+                }
+                lv2_atom_forge_set_buffer(&ps->forge, ps->obj_buf, sizeof(ps->obj_buf));
+                LV2_Atom* msg = write_set_snapshot_ack(&ps->forge, uris, generations[0]);
+                ui->write_function(ui->controller, MIDI_IN, lv2_atom_total_size(msg),
+                                   ps->uris.atom_eventTransfer, msg);
+            } else if (obj->body.otype == uris->fluida_sample_status) {
+                const LV2_Atom_Vector* vec = read_set_sample_status(uris, obj);
+                if (!vec) return;
+                memcpy(ps->samples, LV2_ATOM_BODY(&vec->atom), sizeof(ps->samples));
+                mark_dirty(ui, DIRTY_WINDOW);
+            } else if (obj->body.otype == uris->fluida_meter) {
+                const LV2_Atom_Vector* vec = read_set_meter(uris, obj);
+                if (!vec) return;
+                memcpy(ps->meter, LV2_ATOM_BODY(&vec->atom), sizeof(ps->meter));
+                mark_dirty(ui, DIRTY_METERS);
+            } else if (obj->body.otype == uris->fluida_footprint) {
+                const LV2_Atom_Vector* vec = read_set_footprint(uris, obj);
+                if (!vec) return;
+                memcpy(ps->footprint, LV2_ATOM_BODY(&vec->atom), sizeof(ps->footprint));
+                mark_dirty(ui, DIRTY_WINDOW);
+            } else if (obj->body.otype == uris->fluida_load_progress) {
+                const LV2_Atom_Vector* vec = read_set_load_progress(uris, obj);
+                if (!vec) return;
+                memcpy(ps->loading, LV2_ATOM_BODY(&vec->atom), sizeof(ps->loading));
+                mark_dirty(ui, DIRTY_WINDOW);
+            } else if (obj->body.otype == uris->fluida_memory_status) {
+                const LV2_Atom_Vector* vec = read_set_memory_status(uris, obj);
+                if (!vec) return;
+                memcpy(ps->memory, LV2_ATOM_BODY(&vec->atom), sizeof(ps->memory));
+                mark_dirty(ui, DIRTY_WINDOW);
             } else if (obj->body.otype == uris->fluida_channel_list) {
                 const LV2_Atom_Vector* vec = read_set_channel_list(uris, obj);
-                ps->instrument_list = (int*) LV2_ATOM_BODY(&vec->atom);
+                // keep a copy, the atom is only valid during this call
+                memcpy(ps->channel_instrument, LV2_ATOM_BODY(&vec->atom), sizeof(ps->channel_instrument));
+                ps->instrument_list = ps->channel_instrument;
                 if (!ps->channel_matrix) return;
                 for (int i=0;i<16;i++) {
-                    combobox_set_active_entry(ps->ichannel[i],ps->instrument_list[i]);
+                    set_active_entry(ps->ichannel[i], instrument_to_entry(ps, ps->instrument_list[i]));
                 }
             }
         }
@@ -180,6 +180,8 @@ static int ui_idle(LV2UI_Handle handle) {
         first_loop(ui);
         ui->first_loop = 1;
     }
+    // draw what changed since the last frame
+    plugin_idle(ui);
     return 0;
 }
 
@@ -70,6 +70,9 @@ void plugin_create_controller_widgets(X11_UI *ui, const char * plugin_uri);
 // free used mem on exit
 void plugin_cleanup(X11_UI *ui);
 
+// redraw the widgets marked dirty, rate limited, called from the host idle loop
+void plugin_idle(X11_UI *ui);
+
 // controller value changed message from host
 void plugin_port_event(LV2UI_Handle handle, uint32_t port_index,
                         uint32_t buffer_size, uint32_t format,
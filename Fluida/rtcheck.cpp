@@ -0,0 +1,242 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/****************************************************************
+ ** librtcheck, preload library for the RT safety audit
+ **
+ ** LD_PRELOAD=librtcheck.so host ...
+ **
+ ** interpose malloc/free, pthread mutex and condition calls and a
+ ** couple of blocking syscalls. Calls made on a thread marked with
+ ** rtcheck_enter() are recorded with a backtrace and reported on
+ ** exit. With RTCHECK_EXIT=1 in the environment the process exit
+ ** with status 1 when violations were found.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define MAX_VIOLATIONS 256
+#define MAX_FRAMES 24
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+typedef struct {
+    const char* what;
+    int frames;
+    void* stack[MAX_FRAMES];
+} Violation;
+
+static Violation violations[MAX_VIOLATIONS];
+static std::atomic<int> n_violations(0);
+
+// initial-exec TLS, so that reading it never allocate
+static __thread int rt_depth __attribute__((tls_model("initial-exec"))) = 0;
+static __thread int in_hook __attribute__((tls_model("initial-exec"))) = 0;
+
+static void record(const char* what) {
+    if (!rt_depth || in_hook) return;
+    in_hook = 1;
+    const int i = n_violations.fetch_add(1, std::memory_order_relaxed);
+    if (i < MAX_VIOLATIONS) {
+        violations[i].what = what;
+        violations[i].frames = backtrace(violations[i].stack, MAX_FRAMES);
+    }
+    in_hook = 0;
+}
+
+#define REAL(name) \
+    static decltype(&name) real_##name = NULL; \
+    if (!real_##name) real_##name = (decltype(&name))dlsym(RTLD_NEXT, #name)
+
+extern "C" {
+
+void rtcheck_enter() {
+    rt_depth++;
+}
+
+void rtcheck_leave() {
+    if (rt_depth) rt_depth--;
+}
+
+int rtcheck_violations() {
+    return n_violations.load(std::memory_order_relaxed);
+}
+
+/////////////////////////// memory ////////////////////////////
+
+void* malloc(size_t size) {
+    record("malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    record("calloc");
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    record("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    if (ptr) record("free");
+    __libc_free(ptr);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    record("posix_memalign");
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    record("mmap");
+    REAL(mmap);
+    return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+int munmap(void* addr, size_t length) {
+    record("munmap");
+    REAL(munmap);
+    return real_munmap(addr, length);
+}
+
+/////////////////////////// locks /////////////////////////////
+
+int pthread_mutex_lock(pthread_mutex_t* mutex) {
+    record("pthread_mutex_lock");
+    REAL(pthread_mutex_lock);
+    return real_pthread_mutex_lock(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+    record("pthread_cond_wait");
+    REAL(pthread_cond_wait);
+    return real_pthread_cond_wait(cond, mutex);
+}
+
+int pthread_cond_signal(pthread_cond_t* cond) {
+    record("pthread_cond_signal");
+    REAL(pthread_cond_signal);
+    return real_pthread_cond_signal(cond);
+}
+
+int pthread_cond_broadcast(pthread_cond_t* cond) {
+    record("pthread_cond_broadcast");
+    REAL(pthread_cond_broadcast);
+    return real_pthread_cond_broadcast(cond);
+}
+
+////////////////////////// syscalls ///////////////////////////
+
+int open(const char* path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+    record("open");
+    REAL(open);
+    return real_open(path, flags, mode);
+}
+
+int close(int fd) {
+    record("close");
+    REAL(close);
+    return real_close(fd);
+}
+
+ssize_t read(int fd, void* buf, size_t count) {
+    record("read");
+    REAL(read);
+    return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+    record("write");
+    REAL(write);
+    return real_write(fd, buf, count);
+}
+
+int nanosleep(const struct timespec* req, struct timespec* rem) {
+    record("nanosleep");
+    REAL(nanosleep);
+    return real_nanosleep(req, rem);
+}
+
+int usleep(useconds_t usec) {
+    record("usleep");
+    REAL(usleep);
+    return real_usleep(usec);
+}
+
+} // extern "C"
+
+__attribute__((constructor))
+static void rtcheck_init() {
+    // backtrace() load libgcc on first use, do it now and not on the audio thread
+    void* stack[2];
+    backtrace(stack, 2);
+}
+
+__attribute__((destructor))
+static void rtcheck_report() {
+    const int n = n_violations.load(std::memory_order_relaxed);
+    if (!n) {
+        fprintf(stderr, "rtcheck: no RT violations\n");
+        return;
+    }
+    fprintf(stderr, "rtcheck: %i RT violations on the audio thread\n", n);
+    for (int i = 0; i < n && i < MAX_VIOLATIONS; i++) {
+        fprintf(stderr, "rtcheck: #%i %s\n", i, violations[i].what);
+        fflush(stderr);
+        backtrace_symbols_fd(violations[i].stack, violations[i].frames, STDERR_FILENO);
+    }
+    const char* fail = getenv("RTCHECK_EXIT");
+    if (fail && atoi(fail)) {
+        fflush(NULL);
+        _exit(1);
+    }
+}
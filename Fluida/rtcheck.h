@@ -0,0 +1,60 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+/****************************************************************
+ ** RT safety audit
+ **
+ ** build with -DRTCHECK (make rtcheck) and run the host with
+ ** LD_PRELOAD=librtcheck.so. Every allocation, lock or syscall
+ ** made between rtcheck_enter() and rtcheck_leave() is recorded
+ ** with a backtrace. Without the preload library the hooks are
+ ** weak NULL symbols and nothing happens.
+ */
+
+#ifdef RTCHECK
+
+extern "C" {
+void rtcheck_enter() __attribute__((weak));
+void rtcheck_leave() __attribute__((weak));
+int rtcheck_violations() __attribute__((weak));
+}
+
+class RtCheckScope {
+public:
+    RtCheckScope() { if (rtcheck_enter) rtcheck_enter(); }
+    ~RtCheckScope() { if (rtcheck_leave) rtcheck_leave(); }
+};
+
+#define RTCHECK_SCOPE RtCheckScope rtcheck_scope_
+#define RTCHECK_VIOLATIONS() (rtcheck_violations ? rtcheck_violations() : 0)
+
+#else
+
+#define RTCHECK_SCOPE
+#define RTCHECK_VIOLATIONS() 0
+
+#endif
+
+#endif //RTCHECK_H